@@ -1,6 +1,9 @@
+// Build: gcc -O2 -Wall -o show led_music_test.c ../common/gpio*.c ../common/avsync.c ../common/bam.c ../common/control.c ../common/latency_hist.c ../common/show.c ../common/telemetry.c ../common/trace.c ../common/transition.c ../common/wav_stream.c ../common/netsync.c ../common/pcm_out.c ../common/playlist.c ../common/rt.c -lasound -lgpiod -lpthread
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <poll.h>
 #include <pthread.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -10,116 +13,332 @@
 #include <sys/resource.h>
 #include <sys/syscall.h>
 
-#include <sys/mman.h>
-
-#define GPIO_BASE_ADDR 0x20200000  // For Pi 1
-#define GPIO_LEN       0xB4        // Enough to cover all GPIO registers
-
-volatile uint32_t *gpio = NULL;
-
-#define GPFSEL0 (gpio + 0x00 / 4)
-#define GPFSEL1 (gpio + 0x04 / 4)
-#define GPFSEL2 (gpio + 0x08 / 4)
-#define GPSET0  (gpio + 0x1C / 4)
-#define GPCLR0  (gpio + 0x28 / 4)
-
+#include "../common/avsync.h"
+#include "../common/bam.h"
+#include "../common/control.h"
+#include "../common/gpio.h"
+#include "../common/latency_hist.h"
+#include "../common/netsync.h"
+#include "../common/pcm_out.h"
+#include "../common/playlist.h"
+#include "../common/rt.h"
+#include "../common/show.h"
+#include "../common/telemetry.h"
+#include "../common/timeutil.h"
+#include "../common/trace.h"
+#include "../common/transition.h"
+#include "../common/wav_stream.h"
+
+#define GPIO_SPEC "auto"  // mmap through /dev/gpiomem or /dev/mem, else gpiod
+
+gpio_backend_t *gpio = NULL;
 
 #define AUDIO_PERIOD_FRAMES 441
 #define AUDIO_THREAD_PERIOD_MS 30
-#define WAV_HEADER_SIZE 44
+#define AUDIO_TIMER_PERIODS 12     // timer mode ALSA buffer, in periods
+#define AUDIO_POLL_PERIODS 4       // poll mode: the target latency is split into this many periods
+#define AUDIO_POLL_LATENCY_MS 40   // default poll mode target latency
+#define AUDIO_POLL_MAX_FDS 8
+#define AUDIO_PAUSE_POLL_MS 10     // paused audio thread checks for resume this often
+#define XRUN_BOUND_US 2000         // LED/audio offset counted as recovered after an xrun
+#define PCM_DEVICE "default"  // "null" or "file:FILE=out.raw,FORMAT=raw" run without a sound card
 #define FILENAME "jungle.wav"
 #define LED_PATTERN "jungle.txt"
 #define LED_LOG_FILE "led_log.csv"
 #define AUDIO_LOG_FILE "audio_log.csv"
-#define MAX_RUNS 60000
-#define LED_THREAD_PERIOD_MS 10
-#define MAX_AUDIO_FRAMES 120000000
-#define MAX_PATTERNS 2048
+#define TELEM_RING_RECORDS 8192  // ~80 s of LED wakeups at 10 ms
+#define REPORT_INTERVAL_MS 10000  // live latency report period
+#define LED_THREAD_PERIOD_MS 10   // tick mode period, also the poll before audio starts
+#define LED_EVENT_MAX_SLEEP_MS 200 // event mode still re-reads the audio clock this often
+#define LED_EVENT_EARLY_NS 50000   // treat a wakeup this close to a change as on time
 
 #define CONSUMER "led_seq"
-const unsigned int led_lines[8] = {22, 5, 6, 26, 23, 24, 25, 16};
+// Channel i of the show drives led_lines[i]; -L takes any number of lines
+int led_lines[GPIO_MAX_LINES] = {22, 5, 6, 26, 23, 24, 25, 16};
+int num_leds = 8;
+
+// Tracks played back to back (-P, or the one -a/-p pair). Each holds its
+// mmapped WAV, its show (µs timestamps, frame bit i = LED i), every frame
+// pre-split into per-bank set/clear images (BAM_BITS bitplanes per frame
+// when the shows have brightness levels) and the write order of each
+// frame change, chosen to keep phantom states small.
+static playlist_t playlist;
+static bam_t bam;
+// -U: commands over a Unix socket, -R: reload a show when its file is
+// rewritten. Requests reach the RT threads only through these atomics.
+static control_t control;
+static atomic_int ctl_paused;
+static atomic_llong ctl_seek_ms = -1;   // in the track playing, taken by the audio thread
+static atomic_llong ctl_offset_ns;      // LED timeline ahead of the audio
+static atomic_int led_stop;             // the audio thread did not start
+// -O: start this far into the first track (rehearsal, restart after a crash)
+static size_t audio_start_frame;
+int bam_mode = BAM_MODE_SLEEP;
+double bam_unit_us = BAM_DEFAULT_UNIT_US;
+// CPU placement of the LED, audio and logging threads (-C)
+static rt_profile_t rt_profile;
+
+// tick: wake every LED_THREAD_PERIOD_MS and check for a change (original)
+// event: sleep straight until the next pattern change
+enum { LED_MODE_TICK, LED_MODE_EVENT };
+int led_mode = LED_MODE_EVENT;
+
+snd_pcm_t *pcm;
+int pcm_access = PCM_ACCESS_RW;  // -A mmap: copy from the WAV map straight into the device ring
+// -W timer: fixed AUDIO_THREAD_PERIOD_MS wakeups, three periods each (original)
+// -W poll[:ms]: wake on the PCM descriptors, keep the buffer at the target latency
+enum { AUDIO_WRITER_TIMER, AUDIO_WRITER_POLL };
+int audio_writer = AUDIO_WRITER_TIMER;
+unsigned target_latency_ms = AUDIO_POLL_LATENCY_MS;
+snd_pcm_uframes_t pcm_buffer_frames, pcm_period_frames;  // as granted by the device
+avsync_t av_sync;
+
+// -N leader: play audio and share the show position over UDP
+// -N follower:host: no audio, the LEDs follow the leader's position
+enum { NET_NONE, NET_LEADER, NET_FOLLOWER };
+int net_role = NET_NONE;
+netsync_t net;
+
+// Trace records leave the RT threads through per-thread SPSC rings and
+// are written out by the telemetry thread
+// Durations in the records are ns, the CSV columns stay in µs.
+enum { REC_AUDIO_CYCLE, REC_AUDIO_XRUN, REC_LED_WRITE, REC_LED_WAKE, REC_LED_FRAME };
+
+telem_writer_t telem;
+telem_channel_t audio_telem, led_telem;
+telem_channel_t frame_telem;  // -T: absolute time of every frame change
+int log_transitions;
+uint64_t led_start_ns;  // set before the LED thread pushes its first record
 
 typedef struct {
-    int duration_ms;
-    uint8_t pattern;
-} Pattern;
+    long sum, max;
+    size_t cycles;
+    unsigned underruns;
+    long led_offset_us;  // last LED/audio offset seen on the LED channel
+    uint64_t led_wakeups, led_first_ns, led_last_ns;
+
+    // Online latency histograms, updated by the telemetry thread
+    lhist_t audio_runtime, audio_wake, audio_jitter;
+    lhist_t led_write, led_jitter;
+    lhist_t led_timing;  // |change time - source timeline time|
+    int64_t led_timing_max_late, led_timing_max_early;
+    uint64_t audio_cpu_ns, audio_wall_ns;  // audio thread CPU and run time, written when it ends
+} RunStats;
+
+static RunStats run_stats;
+
+// Where the audio writer is: the track, the frame within it, and the
+// frames queued since the start, which is the position on the timeline
+typedef struct {
+    int track;
+    size_t frame;
+    int64_t written;
+    int paused;
+} audio_cursor_t;
+
+// At the end of a track move the cursor to the next ready one, waiting
+// for the loader if it is late (the device then runs dry and the gap is
+// recorded). Returns 0 at the end of the playlist.
+static int audio_next_track(audio_cursor_t *c) {
+    if (c->frame < playlist.track[c->track].audio.frames)
+        return 1;
+    int next;
+    while ((next = playlist_next(&playlist, c->track)) < 0)
+        sleep_until_ns(now_ns() + 1000000);
+    if (next == playlist.count)
+        return 0;
+    track_t *t = &playlist.track[next];
+    // Only the first time: a pause may have rewound into the track before
+    if (!t->start_ns) {
+        t->start_ns = now_ns();
+        t->gap_ns = avsync_audio_gap_ns(&av_sync, t->start_ns);
+    }
+    c->track = next;
+    c->frame = 0;
+    atomic_store_explicit(&playlist.audio_track, next, memory_order_release);
+    return 1;
+}
 
-static Pattern patterns[MAX_PATTERNS];
-int pattern_count = 0;
+// Queue up to n frames, carrying on into the next track within the same
+// call so tracks meet on a sample boundary. Returns frames written, 0 at
+// the end of the playlist, or an ALSA error.
+static snd_pcm_sframes_t audio_write(audio_cursor_t *c, size_t n) {
+    size_t done = 0;
+    while (done < n && audio_next_track(c)) {
+        track_t *t = &playlist.track[c->track];
+        size_t k = t->audio.frames - c->frame;
+        if (k > n - done) k = n - done;
+        trace_begin(TRACE_PCM_WRITE, trace_now());
+        snd_pcm_sframes_t written = pcm_out_write(pcm, pcm_access, wav_stream_frames(&t->audio, c->frame),
+                                                  k, playlist.channels);
+        trace_end(TRACE_PCM_WRITE, trace_now(), written);
+        if (written < 0)
+            return done ? (snd_pcm_sframes_t)done : written;
+        c->frame += written;
+        c->written += written;
+        done += written;
+        wav_stream_advance(&t->audio, c->frame);
+    }
+    return done;
+}
 
-static uint32_t gpio_shadow = 0; // shadow register: only update the LEDs whose states change to avoid phantom states
+// The track played before c's, if it can be rewound into: still loaded
+// and not yet left behind by the LEDs (which would let the loader free it)
+static int audio_prev_track(const audio_cursor_t *c) {
+    int prev = c->track - 1;
+    while (prev >= 0 && atomic_load_explicit(&playlist.track[prev].state, memory_order_acquire) == TRACK_FAILED)
+        prev--;
+    if (prev < 0)
+        return -1;
+    pthread_mutex_lock(&playlist.lock);
+    if (atomic_load_explicit(&playlist.track[prev].state, memory_order_acquire) != TRACK_READY ||
+        atomic_load_explicit(&playlist.led_track, memory_order_acquire) > prev)
+        prev = -1;
+    pthread_mutex_unlock(&playlist.lock);
+    return prev;
+}
 
-snd_pcm_t *pcm;
-static int16_t audio_data[MAX_AUDIO_FRAMES * 2];
+// Seek and pause/resume: drop what is queued, move the cursor and publish
+// the new position as a jump. Pausing rewinds by what was still queued,
+// back into the previous track if that is where it began, so playback
+// resumes where the sound stopped. Returns 1 when it acted.
+static int audio_control(audio_cursor_t *c) {
+    long long seek_ms = atomic_exchange_explicit(&ctl_seek_ms, -1, memory_order_acquire);
+    int paused = atomic_load_explicit(&ctl_paused, memory_order_relaxed);
+    if (seek_ms < 0 && paused == c->paused)
+        return 0;
+    snd_pcm_sframes_t delay = 0;
+    if (snd_pcm_delay(pcm, &delay) < 0 || delay < 0)
+        delay = 0;
+    snd_pcm_drop(pcm);
+    snd_pcm_prepare(pcm);
 
-size_t audio_frames = 0;
-long runtimes_us[MAX_RUNS];
-long jitter_us[MAX_RUNS];
-long wake_intervals_us[MAX_RUNS];
-size_t runtime_index = 0;
-int underrun_count = 0;
+    int prev;
+    if (seek_ms < 0 && (size_t)delay > c->frame && (prev = audio_prev_track(c)) >= 0) {
+        delay -= c->frame;
+        c->written -= c->frame;
+        c->track = prev;
+        c->frame = playlist.track[prev].audio.frames;
+        atomic_store_explicit(&playlist.audio_track, prev, memory_order_release);
+    }
+    size_t frames = playlist.track[c->track].audio.frames;
+    size_t frame = c->frame > (size_t)delay ? c->frame - delay : 0;
+    if (seek_ms >= 0)
+        frame = (size_t)(seek_ms * playlist.sample_rate / 1000);
+    if (frame > frames)
+        frame = frames;
+    c->written += (int64_t)frame - (int64_t)c->frame;
+    c->frame = frame;
+    c->paused = paused;
+    avsync_audio_update(&av_sync, c->written, 0, now_ns());
+    avsync_audio_jump(&av_sync, paused);
+    return 1;
+}
+
+// After an xrun the device played what was queued and then went silent.
+// Restart it and publish where the track resumes: where it stopped, or
+// moved on by the silent gap for the skip policy.
+static void audio_recover(uint64_t t_ns, uint32_t count, snd_pcm_sframes_t err, audio_cursor_t *c) {
+    int64_t gap_ns = avsync_audio_gap_ns(&av_sync, now_ns());
+    telem_rec_t xrun = {.t_ns = t_ns, .seq = count, .kind = REC_AUDIO_XRUN,
+                        .v = {(int32_t)err, (int32_t)(gap_ns / 1000)}};
+    telem_push(&audio_telem.ring, &xrun);
+    trace_instant(TRACE_XRUN, t_ns, err);
+    snd_pcm_prepare(pcm);
 
-long time_diff_us(struct timespec start, struct timespec end) {
-    return (end.tv_sec - start.tv_sec) * 1000000L + (end.tv_nsec - start.tv_nsec) / 1000L;
+    if (av_sync.gap_policy == AVSYNC_GAP_SKIP) {
+        const wav_stream_t *audio = &playlist.track[c->track].audio;
+        size_t skip = (size_t)(gap_ns * playlist.sample_rate / 1000000000);
+        if (skip > audio->frames - c->frame)
+            skip = audio->frames - c->frame;
+        c->frame += skip;
+        c->written += skip;
+    }
+    avsync_audio_update(&av_sync, c->written, 0, now_ns());
+    avsync_audio_gap(&av_sync);
 }
 
-void *audio_thread_fn(void *arg) {
-    size_t frame_idx = 0;
+// LED thread: time from each reported gap until the LED timeline is back
+// within xrun_bound_us of the audio
+static lhist_t xrun_recovery;
+static unsigned xrun_gaps_seen, xrun_recovered;
+static int64_t xrun_bound_us = XRUN_BOUND_US;
+
+static void track_recovery(uint64_t now) {
+    static uint64_t gap_t_ns;
+    unsigned gaps = atomic_load_explicit(&av_sync.gaps, memory_order_acquire);
+    if (gaps != xrun_gaps_seen) {
+        xrun_gaps_seen = gaps;
+        if (!gap_t_ns)
+            gap_t_ns = now;
+    }
+    int64_t err = av_sync.last_error_ns < 0 ? -av_sync.last_error_ns : av_sync.last_error_ns;
+    if (gap_t_ns && !av_sync.holding && err <= xrun_bound_us * 1000) {
+        lhist_record(&xrun_recovery, (int64_t)(now - gap_t_ns));
+        xrun_recovered = xrun_gaps_seen;
+        gap_t_ns = 0;
+    }
+}
+
+// timer: wake every AUDIO_THREAD_PERIOD_MS and write three periods
+static void audio_timer_loop(void) {
+    audio_cursor_t cur = {.frame = audio_start_frame, .written = (int64_t)audio_start_frame};
     struct timespec next_time;
     clock_gettime(CLOCK_MONOTONIC, &next_time);
 
     static struct timespec prev_wake_time = {0};
+    uint32_t cycle = 0;
+    uint32_t underrun_count = 0;
 
-    while (frame_idx + AUDIO_PERIOD_FRAMES * 3 <= audio_frames && runtime_index < MAX_RUNS) {
+    int more = 1;
+    while (more) {
         // Wait for the next release time
         clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next_time, NULL);
 
         struct timespec start_time, end_time;
         clock_gettime(CLOCK_MONOTONIC, &start_time);
 
-        long wake_us = 0;
+        int64_t wake_ns = 0;
         if (prev_wake_time.tv_sec != 0)
-            wake_us = time_diff_us(prev_wake_time, start_time);
+            wake_ns = timespec_to_ns(start_time) - timespec_to_ns(prev_wake_time);
         prev_wake_time = start_time;
+        trace_instant(TRACE_WAKE, timespec_to_ns(start_time), timespec_to_ns(start_time) - timespec_to_ns(next_time));
 
-        long total_runtime_us = 0;
-        for (int i = 0; i < 3; ++i) {
+        int64_t total_runtime_ns = 0;
+        int recovered = audio_control(&cur);
+        for (int i = 0; i < 3 && !cur.paused; ++i) {
             struct timespec call_start, call_end;
             clock_gettime(CLOCK_MONOTONIC, &call_start);
 
-            snd_pcm_sframes_t written = snd_pcm_writei(pcm, &audio_data[frame_idx * 2], AUDIO_PERIOD_FRAMES);
+            snd_pcm_sframes_t written = audio_write(&cur, AUDIO_PERIOD_FRAMES);
             if (written < 0) {
-                underrun_count++;
-                if (underrun_count <= 10 || underrun_count % 50 == 0) {
-                    fprintf(stderr, "Underrun #%d: %s\n", underrun_count, snd_strerror(written));
-                }
-                snd_pcm_prepare(pcm);
-                continue;
+                audio_recover(timespec_to_ns(call_start), ++underrun_count, written, &cur);
+                recovered = 1;
+                break;
             }
 
             clock_gettime(CLOCK_MONOTONIC, &call_end);
-            total_runtime_us += time_diff_us(call_start, call_end);
-            frame_idx += AUDIO_PERIOD_FRAMES;
+            total_runtime_ns += timespec_to_ns(call_end) - timespec_to_ns(call_start);
+            if (written < AUDIO_PERIOD_FRAMES) {
+                more = 0;
+                break;
+            }
         }
 
-        clock_gettime(CLOCK_MONOTONIC, &end_time);
-        long jitter = time_diff_us(next_time, start_time);
-        if (jitter < 0)
-            fprintf(stderr, "Deadline miss at cycle %zu by %ld us\n", runtime_index, -jitter);
-
-        runtimes_us[runtime_index] = total_runtime_us;
-        wake_intervals_us[runtime_index] = wake_us;
-        jitter_us[runtime_index] = jitter;
-
-        if (runtime_index % 100 == 0) {
-            snd_pcm_sframes_t delay;
-            if (snd_pcm_delay(pcm, &delay) == 0) {
-                fprintf(stderr, "[Cycle %zu] ALSA delay: %ld frames (%0.2f ms)\n",
-                        runtime_index, delay, (delay * 1000.0) / 44100.0);
-            }
+        // Publish where playback really is: what we queued minus what is still queued
+        snd_pcm_sframes_t delay = -1;
+        if (snd_pcm_delay(pcm, &delay) == 0) {
+            avsync_audio_update(&av_sync, cur.written, delay, now_ns());
+            trace_counter(TRACE_PCM_DELAY, trace_now(), delay);
         }
 
-        runtime_index++;
+        clock_gettime(CLOCK_MONOTONIC, &end_time);
+        int64_t jitter_ns = (int64_t)(timespec_to_ns(start_time) - timespec_to_ns(next_time));
+
+        telem_rec_t rec = {.t_ns = timespec_to_ns(start_time), .seq = cycle, .kind = REC_AUDIO_CYCLE,
+                           .v = {(int32_t)total_runtime_ns, (int32_t)wake_ns, (int32_t)jitter_ns, (int32_t)delay}};
+        telem_push(&audio_telem.ring, &rec);
+        cycle++;
 
         // Advance next_time by period
         next_time.tv_nsec += AUDIO_THREAD_PERIOD_MS * 1000000;
@@ -127,270 +346,790 @@ void *audio_thread_fn(void *arg) {
             next_time.tv_sec++;
             next_time.tv_nsec -= 1000000000;
         }
+        // The device restarts with the next write (after an xrun, seek or
+        // pause): refill it now and keep the grid in phase with the new start
+        if (recovered)
+            clock_gettime(CLOCK_MONOTONIC, &next_time);
+        trace_instant(TRACE_DEADLINE, timespec_to_ns(next_time), cycle);
+    }
+}
+
+// poll: sleep on the PCM's descriptors until a period is free, then top
+// the buffer (sized to the target latency) up with exactly what is free
+static void audio_poll_loop(void) {
+    audio_cursor_t cur = {.frame = audio_start_frame, .written = (int64_t)audio_start_frame};
+    uint64_t prev_wake_ns = 0;
+    uint32_t cycle = 0, underrun_count = 0;
+    struct pollfd fds[AUDIO_POLL_MAX_FDS];
+    int nfds = snd_pcm_poll_descriptors(pcm, fds, AUDIO_POLL_MAX_FDS);
+
+    for (;;) {
+        audio_control(&cur);
+        if (cur.paused) {
+            sleep_until_ns(now_ns() + AUDIO_PAUSE_POLL_MS * 1000000ull);
+            continue;
+        }
+        snd_pcm_sframes_t avail = snd_pcm_avail_update(pcm);
+        if (avail >= 0 && (snd_pcm_uframes_t)avail < pcm_period_frames) {
+            unsigned short revents = 0;
+            poll(fds, nfds, PCM_OUT_WAIT_MS);
+            snd_pcm_poll_descriptors_revents(pcm, fds, nfds, &revents);
+            avail = snd_pcm_avail_update(pcm);
+        }
+        uint64_t wake_ns = now_ns();
+        if (avail < 0) {
+            audio_recover(wake_ns, ++underrun_count, avail, &cur);
+            continue;
+        }
+        if ((snd_pcm_uframes_t)avail < pcm_period_frames)
+            continue;
+
+        snd_pcm_sframes_t written = audio_write(&cur, avail);
+        if (written < 0) {
+            audio_recover(wake_ns, ++underrun_count, written, &cur);
+            continue;
+        }
+        if (written == 0)
+            break;
+        uint64_t end_ns = now_ns();
+
+        snd_pcm_sframes_t delay = -1;
+        if (snd_pcm_delay(pcm, &delay) == 0) {
+            avsync_audio_update(&av_sync, cur.written, delay, end_ns);
+            trace_counter(TRACE_PCM_DELAY, end_ns, delay);
+        }
+
+        // Lateness: how far past avail_min the device got before we ran.
+        // The first wake fills the empty buffer and has no lateness.
+        int64_t late_ns = cycle ? (int64_t)(avail - pcm_period_frames) * 1000000000 / playlist.sample_rate : 0;
+        telem_rec_t rec = {.t_ns = wake_ns, .seq = cycle, .kind = REC_AUDIO_CYCLE,
+                           .v = {(int32_t)(end_ns - wake_ns), (int32_t)(prev_wake_ns ? wake_ns - prev_wake_ns : 0),
+                                 (int32_t)late_ns, (int32_t)delay}};
+        telem_push(&audio_telem.ring, &rec);
+        trace_instant(TRACE_WAKE, wake_ns, late_ns);
+        prev_wake_ns = wake_ns;
+        cycle++;
     }
+}
 
+void *audio_thread_fn(void *arg) {
+    rt_thread_enter("audio");
+    trace_thread("audio");
+    struct timespec cpu0, cpu1;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu0);
+    uint64_t thread_start_ns = now_ns();
+
+    if (audio_writer == AUDIO_WRITER_POLL)
+        audio_poll_loop();
+    else
+        audio_timer_loop();
+
+    avsync_audio_finished(&av_sync);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu1);
+    run_stats.audio_cpu_ns = timespec_to_ns(cpu1) - timespec_to_ns(cpu0);
+    run_stats.audio_wall_ns = now_ns() - thread_start_ns;
+    rt_thread_exit();
     return NULL;
 }
 
-void *led_thread_fn(void *arg) {
+// Where track i's audio ends on the show timeline. The last track (and
+// a follower's only one) ends with its show.
+static int64_t track_end_ns(int i) {
+    if (i == playlist.count - 1 || net_role == NET_FOLLOWER)
+        return INT64_MAX;
+    return playlist_end_frame(&playlist.track[i]) * 1000000000 / playlist.sample_rate;
+}
 
-    FILE *log = fopen(LED_LOG_FILE, "w");
-    fprintf(log, "tick,time_us,write_time_us\n");
+// Frame lookups by time on the LED thread (start, seeks, swaps)
+static unsigned led_finds;
+static int64_t led_find_max_ns;
 
-    int current_index = 0, tick_count = 0, ticks_for_current = 0;
+void *led_thread_fn(void *arg) {
+    rt_thread_enter("led");
+    trace_thread("led");
+
+    // Show timestamps are relative to the track, which starts at start_ns.
+    // The track's show table is re-read every wakeup: a control "load" or
+    // a file reload swaps it under us.
+    int ti = 0;
+    const track_t *track = &playlist.track[0];
+    show_table_t *table = NULL, *on_pins = NULL;
+    int64_t start_ns = 0, end_ns = track_end_ns(0), offset_ns = 0;
+    unsigned jumps = 0;
+    uint32_t pattern_count = 1, current_index = 0, written_index = UINT32_MAX;
+    int64_t pattern_end_ns = 0;
     struct timespec start, next_time;
     clock_gettime(CLOCK_MONOTONIC, &start);
     next_time = start;
+    led_start_ns = timespec_to_ns(start);
 
-    int tick = 0;
-    while (current_index < pattern_count) {
+    int tick = 0, next = 0;
+    // Runs until the show of the last track has ended
+    while (!atomic_load_explicit(&led_stop, memory_order_relaxed) &&
+           (current_index < pattern_count || (next = playlist_next(&playlist, ti)) != playlist.count)) {
         clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next_time, NULL);
 
         struct timespec tick_start, write_start, write_end;
         clock_gettime(CLOCK_MONOTONIC, &tick_start);
-
-        if (tick_count == 0) {
-            int values[8];
-            for (int j = 0; j < 8; ++j)
-                values[j] = (patterns[current_index].pattern >> (7 - j)) & 1;
-
-            uint32_t set_mask = 0, clr_mask = 0;
-            for (int j = 0; j < 8; ++j) {
-                int pin = led_lines[j];
-                if (values[j]) set_mask |= (1u << pin);
-                else clr_mask |= (1u << pin);
+        int32_t release_jitter_ns = (int32_t)(timespec_to_ns(tick_start) - timespec_to_ns(next_time));
+        trace_instant(TRACE_WAKE, timespec_to_ns(tick_start), release_jitter_ns);
+        int wrote = 0;
+
+        // The show position comes from the audio device (steered with
+        // bounded slew), so the LEDs follow the music instead of counting
+        // their own ticks. Nothing lights up before audio is playing.
+        unsigned j = atomic_load_explicit(&av_sync.jumps, memory_order_acquire);
+        int64_t show_ns = avsync_led_position_ns(&av_sync, timespec_to_ns(tick_start));
+        if (show_ns >= 0)
+            track_recovery(timespec_to_ns(tick_start));
+        if (show_ns >= 0) {
+            int64_t early = led_mode == LED_MODE_EVENT ? LED_EVENT_EARLY_NS : 0;
+            // The next track's first frame goes out where its audio begins.
+            // Until then a show that ended early holds its last frame.
+            while (show_ns + early >= end_ns && (next = playlist_next(&playlist, ti)) >= 0 &&
+                   next < playlist.count) {
+                ti = next;
+                track = &playlist.track[ti];
+                start_ns = track->start_frame * 1000000000 / playlist.sample_rate;
+                end_ns = track_end_ns(ti);
+                table = NULL;
             }
-
-            clock_gettime(CLOCK_MONOTONIC, &write_start);
-
-            // Corrected version:
-            uint32_t desired_state = gpio_shadow;
-
-            desired_state &= ~clr_mask;
-            desired_state |= set_mask;
-
-            uint32_t led_mask = (1u << 5) | (1u << 6) | (1u << 16) | (1u << 22) | (1u << 23) | (1u << 24) | (1u << 25) | (1u << 26);
-
-            uint32_t bits_to_clear = (gpio_shadow & ~desired_state) & led_mask;
-            uint32_t bits_to_set   = (~gpio_shadow & desired_state) & led_mask;
-
-	    uint32_t set_count = __builtin_popcount(bits_to_set);
-            uint32_t clr_count = __builtin_popcount(bits_to_clear);
-
-/*            if ((set_count | clr_count) == 0) {
-            // No change, skip write
-            } else if (set_count >= clr_count) {
-                *GPSET0 = bits_to_set;
-                __sync_synchronize();
-                *GPCLR0 = bits_to_clear;
-            } else {
-                *GPCLR0 = bits_to_clear;
-                __sync_synchronize();
-                *GPSET0 = bits_to_set;
+            int64_t o = atomic_load_explicit(&ctl_offset_ns, memory_order_relaxed);
+            show_ns += o;
+
+            // New table, seek, pause or offset change (or the start, which
+            // may be mid-show): look the frame up by time
+            show_table_t *t = atomic_load_explicit(&track->table, memory_order_acquire);
+            int resync = 0;
+            if (t != table || j != jumps || o != offset_ns) {
+                resync = table != NULL;
+                if (t != table)
+                    written_index = UINT32_MAX;
+                table = t;
+                jumps = j;
+                offset_ns = o;
+                pattern_count = table->show.frame_count;
+                uint64_t find_start = now_ns();
+                int64_t at_ns = show_ns + early - start_ns;
+                current_index = show_find(&table->show, at_ns > 0 ? at_ns / 1000 : 0);
+                if (current_index > 0)
+                    resync = 1;  // joined mid-show
+                pattern_end_ns = start_ns + show_end_us(&table->show, current_index) * 1000;
+                int64_t find_ns = now_ns() - find_start;
+                if (find_ns > led_find_max_ns)
+                    led_find_max_ns = find_ns;
+                led_finds++;
+            }
+            while (current_index < pattern_count && show_ns + early >= pattern_end_ns) {
+                current_index++;
+                if (current_index < pattern_count)
+                    pattern_end_ns = start_ns + show_end_us(&table->show, current_index) * 1000;
             }
-*/
-	    *GPSET0 = bits_to_set;
-	    __sync_synchronize(); // CPU barrier
-            *GPCLR0 = bits_to_clear;
-
-            gpio_shadow = desired_state;  // Finally update the shadow to match
-
-            clock_gettime(CLOCK_MONOTONIC, &write_end);
-
-            int duration = patterns[current_index].duration_ms;
-            if (duration < 70) duration = 70;
-            duration = ((duration + 5) / 10) * 10;
-
-            ticks_for_current = duration / LED_THREAD_PERIOD_MS;
-            tick_count = ticks_for_current;
 
-            fprintf(log, "%d,%ld,%ld\n", tick, time_diff_us(start, tick_start), time_diff_us(write_start, write_end));
+            // Past the end the last frame stays up, from the current table
+            uint32_t shown = current_index < pattern_count ? current_index : pattern_count - 1;
+            if (shown != written_index) {
+                clock_gettime(CLOCK_MONOTONIC, &write_start);
+                trace_begin(TRACE_GPIO_WRITE, timespec_to_ns(write_start));
+
+                // Mapped and ordered at load time: only changing banks are written
+                const show_record_t *frame = show_record(&table->show, shown);
+                if (playlist.bam)
+                    bam_set_frame(&bam, gpio_plan_frame(&table->plan, shown * BAM_BITS));
+                else
+                    transition_play(gpio, &table->transitions, shown);
+
+                clock_gettime(CLOCK_MONOTONIC, &write_end);
+                trace_end(TRACE_GPIO_WRITE, timespec_to_ns(write_end), shown);
+                written_index = shown;
+                on_pins = table;
+
+                // Where on the show timeline the change really landed
+                int64_t landed_ns = show_ns + (int64_t)(timespec_to_ns(write_end) - timespec_to_ns(tick_start));
+                int64_t timing_error_ns = landed_ns - start_ns - (int64_t)frame->t_us * 1000;
+
+                telem_rec_t rec = {.t_ns = timespec_to_ns(tick_start), .seq = tick, .kind = REC_LED_WRITE,
+                                   .v = {(int32_t)timing_error_ns,
+                                         (int32_t)(timespec_to_ns(write_end) - timespec_to_ns(write_start)),
+                                         (int32_t)(av_sync.last_error_ns / 1000), release_jitter_ns}};
+                // A frame put back after a jump was not due now: no timing error
+                if (resync)
+                    rec.kind = REC_LED_WAKE;
+                telem_push(&led_telem.ring, &rec);
+                if (log_transitions) {
+                    telem_rec_t tr = {.t_ns = timespec_to_ns(write_end), .seq = shown,
+                                      .kind = REC_LED_FRAME};
+                    telem_push(&frame_telem.ring, &tr);
+                }
+                wrote = 1;
+            }
+            // The earlier tracks' images are no longer on the pins and can go
+            if (ti != atomic_load_explicit(&playlist.led_track, memory_order_relaxed) &&
+                written_index != UINT32_MAX)
+                atomic_store_explicit(&playlist.led_track, ti, memory_order_release);
+        }
+        if (!wrote) {
+            // Still feeds the release jitter histogram, no CSV row
+            telem_rec_t rec = {.t_ns = timespec_to_ns(tick_start), .seq = tick, .kind = REC_LED_WAKE,
+                               .v = {0, 0, 0, release_jitter_ns}};
+            telem_push(&led_telem.ring, &rec);
         }
+        playlist_led_quiescent(&playlist, on_pins);
 
-        tick_count--;
-        if (tick_count == 0) current_index++;
         tick++;
-
-        next_time.tv_nsec += LED_THREAD_PERIOD_MS * 1000000;
-        while (next_time.tv_nsec >= 1000000000) {
-            next_time.tv_sec++;
-            next_time.tv_nsec -= 1000000000;
+        // The next change, or the next track's start when that comes first
+        int64_t until = current_index < pattern_count && pattern_end_ns < end_ns ? pattern_end_ns : end_ns;
+        if (led_mode == LED_MODE_TICK || show_ns < 0 || until <= show_ns ||
+            atomic_load_explicit(&av_sync.paused, memory_order_relaxed)) {
+            // until <= show_ns: waiting on the loader for the next track
+            timespec_add_ns(&next_time, LED_THREAD_PERIOD_MS * 1000000L);
+        } else {
+            // Sleep until the LED timeline reaches the next change, but
+            // keep sampling the audio clock during long holds
+            uint64_t wake = timespec_to_ns(tick_start);
+            uint64_t deadline = avsync_led_deadline_ns(&av_sync, until - offset_ns);
+            uint64_t cap = wake + LED_EVENT_MAX_SLEEP_MS * 1000000ull;
+            next_time = ns_to_timespec(deadline < cap ? deadline : cap);
         }
+        trace_instant(TRACE_DEADLINE, timespec_to_ns(next_time), current_index);
     }
 
-    fclose(log);
+    playlist_led_exit(&playlist);
+    rt_thread_exit();
     return NULL;
 }
 
-void setup_alsa(unsigned int sample_rate, unsigned int channels) {
+void setup_alsa(const char *device, unsigned int sample_rate, unsigned int channels) {
     snd_pcm_hw_params_t *params;
-    snd_pcm_open(&pcm, "default", SND_PCM_STREAM_PLAYBACK, 0);
+    int err = snd_pcm_open(&pcm, device, SND_PCM_STREAM_PLAYBACK, 0);
+    if (err < 0) {
+        fprintf(stderr, "snd_pcm_open %s: %s\n", device, snd_strerror(err));
+        exit(1);
+    }
     snd_pcm_hw_params_malloc(&params);
     snd_pcm_hw_params_any(pcm, params);
-    snd_pcm_hw_params_set_access(pcm, params, SND_PCM_ACCESS_RW_INTERLEAVED);
+    pcm_access = pcm_set_access(pcm, params, pcm_access);
     snd_pcm_hw_params_set_format(pcm, params, SND_PCM_FORMAT_S16_LE);
     snd_pcm_hw_params_set_channels(pcm, params, channels);
     snd_pcm_hw_params_set_rate(pcm, params, sample_rate, 0);
 
-    snd_pcm_uframes_t buffer_size = AUDIO_PERIOD_FRAMES * 12;
+    snd_pcm_uframes_t buffer_size = AUDIO_PERIOD_FRAMES * AUDIO_TIMER_PERIODS;
     snd_pcm_uframes_t period_size = AUDIO_PERIOD_FRAMES;
+    if (audio_writer == AUDIO_WRITER_POLL) {
+        // The buffer is the latency: the writer keeps it full
+        buffer_size = (snd_pcm_uframes_t)sample_rate * target_latency_ms / 1000;
+        period_size = buffer_size / AUDIO_POLL_PERIODS;
+    }
     snd_pcm_hw_params_set_period_size_near(pcm, params, &period_size, 0);
     snd_pcm_hw_params_set_buffer_size_near(pcm, params, &buffer_size);
-    snd_pcm_hw_params(pcm, params);
+    err = snd_pcm_hw_params(pcm, params);
     snd_pcm_hw_params_free(params);
-    snd_pcm_prepare(pcm);
-}
-
-void load_wav(const char *filename, uint32_t *sample_rate, uint16_t *channels) {
-    FILE *f = fopen(filename, "rb");
-    if (!f) { perror("fopen"); exit(1); }
-
-    fseek(f, 0, SEEK_END);
-    long size = ftell(f);
-    fseek(f, WAV_HEADER_SIZE, SEEK_SET);
-    long data_size = size - WAV_HEADER_SIZE;
-
-    fseek(f, 24, SEEK_SET); fread(sample_rate, sizeof(uint32_t), 1, f);
-    fseek(f, 22, SEEK_SET); fread(channels, sizeof(uint16_t), 1, f);
-
-    audio_frames = data_size / (*channels * sizeof(int16_t));
-
-    size_t max_bytes = sizeof(audio_data);
-    if ((size_t)data_size > max_bytes) {
-        fprintf(stderr, "WAV too large! Max %zu bytes, got %ld\n", max_bytes, data_size);
+    if (err < 0) {
+        fprintf(stderr, "snd_pcm_hw_params: %s\n", snd_strerror(err));
         exit(1);
     }
-    size_t read_bytes = fread(audio_data, 1, data_size, f);
-    if (read_bytes != data_size) {
-        fprintf(stderr, "Read error: expected %ld bytes, got %zu\n", data_size, read_bytes);
-        exit(1);
+    if (snd_pcm_get_params(pcm, &pcm_buffer_frames, &pcm_period_frames) < 0) {
+        pcm_buffer_frames = buffer_size;
+        pcm_period_frames = period_size;
     }
 
+    // Wake the poll writer once a whole period is free
+    snd_pcm_sw_params_t *sw;
+    snd_pcm_sw_params_malloc(&sw);
+    snd_pcm_sw_params_current(pcm, sw);
+    snd_pcm_sw_params_set_avail_min(pcm, sw, pcm_period_frames);
+    snd_pcm_sw_params(pcm, sw);
+    snd_pcm_sw_params_free(sw);
+    snd_pcm_prepare(pcm);
+    fprintf(stderr, "ALSA: %s writer, %s access, buffer %lu frames (%.1f ms), period %lu\n",
+            audio_writer == AUDIO_WRITER_POLL ? "poll" : "timer", pcm_access_name(pcm_access),
+            pcm_buffer_frames, pcm_buffer_frames * 1000.0 / sample_rate, pcm_period_frames);
+}
 
+// Telemetry formatters, run on the telemetry thread. f is NULL when the
+// rows go to a binary file; statistics are still kept.
+static void audio_row(FILE *f, const telem_rec_t *r, void *ctx) {
+    RunStats *st = ctx;
+    if (r->kind == REC_AUDIO_XRUN) {
+        st->underruns = r->seq;
+        if (r->seq <= 10 || r->seq % 50 == 0)
+            fprintf(stderr, "Underrun #%u: %s, %.1f ms silent\n", r->seq, snd_strerror(r->v[0]), r->v[1] / 1000.0);
+        return;
+    }
 
-    fclose(f);
+    long runtime = r->v[0] / 1000, jitter = r->v[2] / 1000, delay = r->v[3];
+    if (f) fprintf(f, "%u,%ld,%d,%ld\n", r->seq, runtime, r->v[1] / 1000, jitter);
+    lhist_record(&st->audio_runtime, r->v[0]);
+    if (r->seq > 0) lhist_record(&st->audio_wake, r->v[1]);
+    lhist_record(&st->audio_jitter, r->v[2]);
+    st->sum += runtime;
+    if (runtime > st->max) st->max = runtime;
+    st->cycles++;
+
+    if (jitter < 0)
+        fprintf(stderr, "Deadline miss at cycle %u by %ld us\n", r->seq, -jitter);
+    if (r->seq % 100 == 0 && delay >= 0)
+        fprintf(stderr, "[Cycle %u] ALSA delay: %ld frames (%0.2f ms), LED offset %ld us\n",
+                r->seq, delay, (delay * 1000.0) / av_sync.rate, st->led_offset_us);
 }
 
-void load_patterns(const char *filename) {
-    FILE *f = fopen(filename, "r");
-    if (!f) {
-        perror("pattern file");
-        exit(1);
-    }
+static void audio_summary(FILE *f, void *ctx) {
+    RunStats *st = ctx;
+    if (!f) return;
+    double avg = st->cycles ? (double)st->sum / st->cycles : 0;
+    fprintf(f, "\nWriter,%s\nBuffer (ms),%.1f\n", audio_writer == AUDIO_WRITER_POLL ? "poll" : "timer",
+            pcm_buffer_frames * 1000.0 / av_sync.rate);
+    fprintf(f, "Average (us),%lf\nMax (us),%ld\n", avg, st->max);
+    fprintf(f, "Total underruns,%u\n", st->underruns);
+    lhist_print_csv(f, &st->audio_runtime);
+    lhist_print_csv(f, &st->audio_wake);
+    lhist_print_csv(f, &st->audio_jitter);
+}
 
-    char line[64];
-    pattern_count = 0;  // Always reset before loading
+static void led_row(FILE *f, const telem_rec_t *r, void *ctx) {
+    RunStats *st = ctx;
+    lhist_record(&st->led_jitter, r->v[3]);
+    if (st->led_wakeups++ == 0) st->led_first_ns = r->t_ns;
+    st->led_last_ns = r->t_ns;
+    if (r->kind != REC_LED_WRITE)
+        return;
+    int64_t e = r->v[0];
+    lhist_record(&st->led_timing, e < 0 ? -e : e);
+    if (e > st->led_timing_max_late) st->led_timing_max_late = e;
+    if (e < st->led_timing_max_early) st->led_timing_max_early = e;
+    lhist_record(&st->led_write, r->v[1]);
+    st->led_offset_us = r->v[2];
+    if (f) fprintf(f, "%u,%llu,%d,%d,%.1f\n", r->seq, (unsigned long long)(r->t_ns - led_start_ns) / 1000,
+                   r->v[1] / 1000, r->v[2], e / 1000.0);
+}
 
-    while (fgets(line, sizeof(line), f)) {
-        if (pattern_count >= MAX_PATTERNS) {
-            fprintf(stderr, "Too many patterns! Max allowed is %d\n", MAX_PATTERNS);
-            fclose(f);
-            exit(1);
-        }
+static void frame_row(FILE *f, const telem_rec_t *r, void *ctx) {
+    if (f) fprintf(f, "%u,%llu\n", r->seq, (unsigned long long)r->t_ns);
+}
 
-        int dur;
-        char bits[10];
-        if (sscanf(line, "%d %9s", &dur, bits) == 2) {
-            // Round duration
-            if (dur < 70) dur = 70;
-            dur = ((dur + 5) / 10) * 10;
-
-            uint8_t p = 0;
-            for (int i = 0, j = 0; i < 8 && bits[j]; ++j) {
-                if (bits[j] == '.') continue;
-                p = (p << 1) | (bits[j] == '1' ? 1 : 0);
-                ++i;
-            }
-            patterns[pattern_count++] = (Pattern){.duration_ms = dur, .pattern = p};
+// Per track: load time by stage, how long before its audio was due the
+// loader had it ready, and the silence between it and the track before
+static void playlist_report(FILE *f) {
+    fprintf(f, "%-5s %-24s %9s %9s %9s %11s %9s\n", "track", "audio", "wav_ms", "show_ms", "plan_ms",
+            "ahead_ms", "gap_ms");
+    for (int i = 0; i < playlist.count; ++i) {
+        const track_t *t = &playlist.track[i];
+        const char *name = strrchr(t->audio_path, '/') ? strrchr(t->audio_path, '/') + 1 : t->audio_path;
+        int state = atomic_load(&t->state);
+        if (state == TRACK_FAILED || state == TRACK_PENDING) {
+            fprintf(f, "%-5d %-24.24s %s\n", i + 1, name, state == TRACK_FAILED ? "skipped" : "not reached");
+            continue;
         }
+        fprintf(f, "%-5d %-24.24s %9.2f %9.2f %9.2f", i + 1, name, t->audio_ns / 1e6, t->show_ns / 1e6,
+                t->plan_ns / 1e6);
+        if (t->start_ns)
+            fprintf(f, " %11.1f %9.3f\n", ((int64_t)t->start_ns - (int64_t)t->ready_ns) / 1e6, t->gap_ns / 1e6);
+        else
+            fprintf(f, " %11s %9s\n", "-", "-");
     }
-
-    fclose(f);
 }
 
-
-void save_runtime_log(const char *filename) {
-    FILE *f = fopen(filename, "w");
-    if (!f) { perror("log fopen"); return; }
-
-    fprintf(f, "index,runtime_us,wake_interval_us,jitter_us\n");
-    long sum = 0, max = 0;
-    for (size_t i = 0; i < runtime_index; ++i) {
-        fprintf(f, "%zu,%ld,%ld,%ld\n", i, runtimes_us[i], wake_intervals_us[i], jitter_us[i]);
-        sum += runtimes_us[i];
-        if (runtimes_us[i] > max) max = runtimes_us[i];
+// Control commands, on the control thread. Seek and pause are carried
+// out by the audio thread, show loads swap the table the LED thread reads.
+static void control_command(void *ctx, char *line, char *reply, size_t len) {
+    char cmd[16] = "", arg[CONTROL_LINE_MAX] = "";
+    sscanf(line, "%15s %511[^\n]", cmd, arg);
+    int ti = atomic_load_explicit(&playlist.audio_track, memory_order_acquire);
+    int has_audio = net_role != NET_FOLLOWER;
+
+    if ((!strcmp(cmd, "pause") || !strcmp(cmd, "resume") || !strcmp(cmd, "seek")) && !has_audio) {
+        snprintf(reply, len, "error a follower has no audio to %s", cmd);
+    } else if (!strcmp(cmd, "pause") || !strcmp(cmd, "resume")) {
+        atomic_store_explicit(&ctl_paused, cmd[0] == 'p', memory_order_relaxed);
+        snprintf(reply, len, "ok");
+    } else if (!strcmp(cmd, "seek") && *arg) {
+        double sec = atof(arg);
+        if (sec < 0) {
+            snprintf(reply, len, "error seek to a time >= 0");
+            return;
+        }
+        atomic_store_explicit(&ctl_seek_ms, (long long)(sec * 1000), memory_order_release);
+        snprintf(reply, len, "ok track %d %.3f s", ti + 1, sec);
+    } else if (!strcmp(cmd, "offset") && *arg) {
+        atomic_store_explicit(&ctl_offset_ns, (long long)(atof(arg) * 1e6), memory_order_relaxed);
+        snprintf(reply, len, "ok");
+    } else if (!strcmp(cmd, "load") && *arg) {
+        uint64_t t0 = now_ns();
+        if (playlist_reload(&playlist, ti, arg) < 0)
+            snprintf(reply, len, "error %s not loaded", arg);
+        else
+            snprintf(reply, len, "ok track %d %.2f ms", ti + 1, (now_ns() - t0) / 1e6);
+    } else if (!strcmp(cmd, "pos")) {
+        // Timeline position of the music and the frame the show is at
+        int64_t pos_ns = 0;
+        avsync_audio_position_ns(&av_sync, now_ns(), &pos_ns);
+        pthread_mutex_lock(&playlist.lock);
+        const track_t *t = &playlist.track[ti];
+        const show_table_t *table = atomic_load_explicit(&t->table, memory_order_acquire);
+        int64_t track_us = (pos_ns - t->start_frame * 1000000000 / (playlist.sample_rate ? playlist.sample_rate : 1)) / 1000
+                           + atomic_load_explicit(&ctl_offset_ns, memory_order_relaxed) / 1000;
+        uint32_t frame = table ? show_find(&table->show, track_us > 0 ? track_us : 0) : 0;
+        snprintf(reply, len, "track %d/%d %.3f s frame %u/%u%s", ti + 1, playlist.count, track_us / 1e6,
+                 frame, table ? table->show.frame_count : 0,
+                 atomic_load_explicit(&ctl_paused, memory_order_relaxed) ? " paused" : "");
+        pthread_mutex_unlock(&playlist.lock);
+    } else {
+        snprintf(reply, len, "error commands: pause, resume, seek <s>, offset <ms>, load <show>, pos");
     }
+}
 
-    double avg = (double)sum / runtime_index;
-    fprintf(f, "\nAverage (us),%lf\nMax (us),%ld\n", avg, max);
-    fprintf(f, "Total underruns,%d\n", underrun_count);
-    fclose(f);
+// A show file was rewritten: swap it into every loaded track that plays it
+static void control_change(void *ctx, const char *path) {
+    for (int i = 0; i < playlist.count; ++i) {
+        if (strcmp(playlist.track[i].show_path, path) != 0 ||
+            atomic_load_explicit(&playlist.track[i].state, memory_order_acquire) != TRACK_READY)
+            continue;
+        if (playlist_reload(&playlist, i, path) == 0)
+            fprintf(stderr, "Reloaded %s for track %d\n", path, i + 1);
+    }
 }
 
-int main() {
+// Leader: the audio-derived position is what followers lock to
+static int leader_position(void *ctx, uint64_t now, int64_t *pos_ns) {
+    return avsync_audio_position_ns(&av_sync, now, pos_ns);
+}
 
-    int fd = open("/dev/mem", O_RDWR | O_SYNC);
-    if (fd < 0) { perror("open /dev/mem"); exit(1); }
+static void latency_report(void *ctx) {
+    RunStats *st = ctx;
+    lhist_print_header(stderr);
+    lhist_print(stderr, &st->audio_runtime);
+    lhist_print(stderr, &st->audio_wake);
+    lhist_print(stderr, &st->audio_jitter);
+    lhist_print(stderr, &st->led_write);
+    lhist_print(stderr, &st->led_jitter);
+    lhist_print(stderr, &st->led_timing);
+    fprintf(stderr, "LED timing vs source: max late %.1f us, max early %.1f us\n",
+            st->led_timing_max_late / 1000.0, -st->led_timing_max_early / 1000.0);
+    double secs = (st->led_last_ns - st->led_first_ns) / 1e9;
+    fprintf(stderr, "LED %s mode: %llu wakeups, %.1f/s\n", led_mode == LED_MODE_TICK ? "tick" : "event",
+            (unsigned long long)st->led_wakeups, secs > 0 ? st->led_wakeups / secs : 0.0);
+    rt_report(stderr);
+}
 
-    gpio = (volatile uint32_t *) mmap(NULL, GPIO_LEN, PROT_READ | PROT_WRITE, MAP_SHARED, fd, GPIO_BASE_ADDR);
-    if (gpio == MAP_FAILED) { perror("mmap"); exit(1); }
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-D pcm] [-a audio.wav] [-p patterns.txt|.show] [-P playlist.txt] [-S max_slew_ppm] [-m tick|event] [-L gpio,gpio,...]\n"
+                    "          [-B sleep|spin|timerfd[:unit_us]] [-N leader[:port] | follower:host[:port]] [-J delay_us,jitter_us,loss_pct] [-T frames.csv]\n"
+                    "          [-C led=cpu,audio=cpu,log=cpu] [-A rw|mmap] [-W timer|poll[:latency_ms]]\n"
+                    "          [-X slew|pause|skip[:bound_us]] [-F xrun@s[:ms],stall@s[:ms],...] [-U control.sock] [-R] [-O start_s]\n"
+                    "          [-t trace.json] [-M]\n", prog);
+    exit(1);
+}
 
-    // Set all 8 lines to output (safe, bit-by-bit for clarity)
-    for (int i = 0; i < 8; ++i) {
-        int gpio_num = led_lines[i];
-        volatile uint32_t *fsel = gpio + (gpio_num / 10);
-        int shift = (gpio_num % 10) * 3;
-        *fsel = (*fsel & ~(7 << shift)) | (1 << shift);  // set to 001 (output)
+int main(int argc, char **argv) {
+    const char *pcm_device = PCM_DEVICE;
+    const char *wav_file = FILENAME;
+    const char *pattern_file = LED_PATTERN;
+    const char *playlist_file = NULL;
+    long max_slew_ppm = AVSYNC_DEFAULT_SLEW_PPM;
+    const char *net_host = NULL, *transitions_file = NULL;
+    int net_port = NETSYNC_DEFAULT_PORT;
+    long net_delay_us = 0, net_jitter_us = 0;
+    int net_loss_pct = 0;
+    const char *cpu_spec = NULL;
+    int gap_policy = AVSYNC_GAP_PAUSE;
+    const char *control_socket = NULL;
+    int reload_shows = 0;
+    double start_sec = 0;
+    const char *trace_file = NULL;
+    int trace_markers = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "D:a:p:P:S:m:L:B:N:J:T:C:A:W:X:F:U:RO:t:M")) != -1) {
+        switch (opt) {
+        case 'D': pcm_device = optarg; break;
+        case 'a': wav_file = optarg; break;
+        case 'p': pattern_file = optarg; break;
+        case 'P': playlist_file = optarg; break;
+        case 'U': control_socket = optarg; break;
+        case 'R': reload_shows = 1; break;
+        case 'O': start_sec = atof(optarg); break;
+        case 't': trace_file = optarg; break;
+        case 'M': trace_markers = 1; break;
+        case 'S': max_slew_ppm = atol(optarg); break;
+        case 'L':
+            num_leds = 0;
+            for (char *p = optarg; *p && num_leds < GPIO_MAX_LINES; ) {
+                char *end;
+                led_lines[num_leds++] = (int)strtol(p, &end, 0);
+                if (end == p) usage(argv[0]);
+                p = *end == ',' ? end + 1 : end;
+            }
+            break;
+        case 'N': {
+            char *port;
+            if (strncmp(optarg, "leader", 6) == 0) {
+                net_role = NET_LEADER;
+                port = strchr(optarg, ':');
+            } else if (strncmp(optarg, "follower:", 9) == 0) {
+                net_role = NET_FOLLOWER;
+                net_host = strdup(optarg + 9);
+                port = strchr(net_host, ':');
+                if (port) *port = '\0';
+            } else {
+                usage(argv[0]);
+            }
+            if (port) net_port = atoi(port + 1);
+            break;
+        }
+        case 'J':
+            if (sscanf(optarg, "%ld,%ld,%d", &net_delay_us, &net_jitter_us, &net_loss_pct) < 1)
+                usage(argv[0]);
+            break;
+        case 'T': transitions_file = optarg; break;
+        case 'C': cpu_spec = optarg; break;
+        case 'W': {
+            char *ms = strchr(optarg, ':');
+            if (ms) {
+                *ms = '\0';
+                target_latency_ms = atoi(ms + 1);
+            }
+            if (strcmp(optarg, "timer") == 0) audio_writer = AUDIO_WRITER_TIMER;
+            else if (strcmp(optarg, "poll") == 0) audio_writer = AUDIO_WRITER_POLL;
+            else usage(argv[0]);
+            if (target_latency_ms < 4) usage(argv[0]);
+            break;
+        }
+        case 'X': {
+            char *bound = strchr(optarg, ':');
+            if (bound) {
+                *bound = '\0';
+                xrun_bound_us = atol(bound + 1);
+            }
+            if ((gap_policy = avsync_gap_policy_parse(optarg)) < 0 || xrun_bound_us <= 0) usage(argv[0]);
+            break;
+        }
+        case 'F':
+            if (pcm_out_set_faults(optarg) < 0) usage(argv[0]);
+            break;
+        case 'A':
+            if ((pcm_access = pcm_access_parse(optarg)) < 0) usage(argv[0]);
+            break;
+        case 'B': {
+            char *unit = strchr(optarg, ':');
+            if (unit) {
+                *unit = '\0';
+                bam_unit_us = atof(unit + 1);
+            }
+            bam_mode = bam_mode_parse(optarg);
+            if (bam_mode < 0 || bam_unit_us <= 0) usage(argv[0]);
+            break;
+        }
+        case 'm':
+            if (strcmp(optarg, "tick") == 0) led_mode = LED_MODE_TICK;
+            else if (strcmp(optarg, "event") == 0) led_mode = LED_MODE_EVENT;
+            else usage(argv[0]);
+            break;
+        default: usage(argv[0]);
+        }
     }
 
+    // A follower has no audio to carry it from one track to the next
+    if (rt_profile_init(&rt_profile, cpu_spec) < 0 || (playlist_file && net_role == NET_FOLLOWER) || start_sec < 0)
+        usage(argv[0]);
+    rt_profile_print(&rt_profile, stderr);
+    // Everything touched from here on stays resident
+    rt_lock_memory();
 
-
-
+    gpio = gpio_open(gpio_default_spec(GPIO_SPEC), led_lines, num_leds);
+    if (!gpio) { fprintf(stderr, "Failed to open GPIO backend\n"); exit(1); }
 
     pthread_t audio_thread, led_thread;
 
-    struct sched_param audio_param = {.sched_priority = 75};  // Lower priority
-    struct sched_param led_param   = {.sched_priority = 80};  // Higher priority
-
-    pthread_attr_t audio_attr, led_attr;
-    pthread_attr_init(&audio_attr);
-    pthread_attr_setinheritsched(&audio_attr, PTHREAD_EXPLICIT_SCHED);
-    pthread_attr_setschedpolicy(&audio_attr, SCHED_FIFO);
-    pthread_attr_setschedparam(&audio_attr, &audio_param);
-
-    pthread_attr_init(&led_attr);
-    pthread_attr_setinheritsched(&led_attr, PTHREAD_EXPLICIT_SCHED);
-    pthread_attr_setschedpolicy(&led_attr, SCHED_FIFO);
-    pthread_attr_setschedparam(&led_attr, &led_param);
-
-    uint32_t sample_rate;
-    uint16_t channels;
-    load_wav(FILENAME, &sample_rate, &channels);
-    if (audio_frames > MAX_AUDIO_FRAMES) {
-    fprintf(stderr, "Audio too long: %zu frames, max allowed is %d\n", audio_frames, MAX_AUDIO_FRAMES);
-    exit(1);
-}
+    playlist_init(&playlist, gpio, num_leds, WAV_STREAM_WINDOW_MS);
+    if (playlist_file) {
+        if (playlist_read(&playlist, playlist_file) <= 0) {
+            fprintf(stderr, "%s: no tracks\n", playlist_file);
+            exit(1);
+        }
+    } else if (playlist_add(&playlist, net_role == NET_FOLLOWER ? NULL : wav_file, pattern_file) < 0) {
+        exit(1);
+    }
 
+    // The first track is loaded here and fixes the PCM format; the loader
+    // prepares each following one while the one before it plays. Only the
+    // first window of a WAV is faulted in, so this is fast for any length.
+    if (playlist_load(&playlist, 0) < 0)
+        exit(1);
+    track_t *first = &playlist.track[0];
+    if (net_role != NET_FOLLOWER) {
+        // The LED thread finds its first frame from the audio position. The
+        // window moves there now, so the audio thread starts on resident pages.
+        audio_start_frame = (size_t)(start_sec * playlist.sample_rate);
+        if (audio_start_frame >= first->audio.frames) {
+            fprintf(stderr, "Start at %.3f s is past the end of %s\n", start_sec, first->audio_path);
+            exit(1);
+        }
+        uint64_t seek_ns = 0;
+        if (audio_start_frame) {
+            uint64_t t0 = now_ns();
+            wav_stream_seek(&first->audio, audio_start_frame);
+            seek_ns = now_ns() - t0;
+        }
+        fprintf(stderr, "Audio: %zu frames, %u Hz, %u ch, ready in %.2f ms (%s)\n",
+                first->audio.frames, playlist.sample_rate, playlist.channels, (first->audio_ns + seek_ns) / 1e6,
+                first->audio.locked ? "window locked" : "window prefaulted");
+        setup_alsa(pcm_device, playlist.sample_rate, playlist.channels);
+    }
+    const show_table_t *first_table = atomic_load(&first->table);
+    if (!playlist.bam)
+        fprintf(stderr, "Transitions: %llu phantom states, %llu LEDs wrong in them over %u frames\n",
+                (unsigned long long)first_table->transitions.phantoms,
+                (unsigned long long)first_table->transitions.wrong_bits, first_table->show.frame_count);
+    avsync_init(&av_sync, playlist.sample_rate, max_slew_ppm, AVSYNC_DEFAULT_STEP_US);
+    av_sync.gap_policy = gap_policy;
+
+    if (net_role == NET_LEADER && netsync_leader_open(&net, net_port, leader_position, NULL) < 0)
+        exit(1);
+    if (net_role == NET_FOLLOWER) {
+        if (netsync_follower_open(&net, net_host, net_port, &av_sync) < 0)
+            exit(1);
+        netsync_set_impairment(&net, net_delay_us, net_jitter_us, net_loss_pct);
+    }
 
-    setup_alsa(sample_rate, channels);
-    load_patterns(LED_PATTERN);
+    // Logging runs at normal priority and never blocks the RT threads
+    lhist_init(&run_stats.audio_runtime, "audio_runtime");
+    lhist_init(&run_stats.audio_wake, "audio_wake");
+    lhist_init(&run_stats.audio_jitter, "audio_jitter");
+    lhist_init(&run_stats.led_write, "led_write");
+    lhist_init(&run_stats.led_jitter, "led_jitter");
+    lhist_init(&run_stats.led_timing, "led_timing_error");
+    lhist_init(&xrun_recovery, "xrun_recovery");
+    telem_writer_init(&telem, TELEM_PERIOD_MS);
+    telem_writer_set_tick(&telem, latency_report, &run_stats, REPORT_INTERVAL_MS);
+    if (telem_channel_init(&audio_telem, TELEM_RING_RECORDS, AUDIO_LOG_FILE,
+                           "index,runtime_us,wake_interval_us,jitter_us",
+                           audio_row, audio_summary, &run_stats) < 0 ||
+        telem_channel_init(&led_telem, TELEM_RING_RECORDS, LED_LOG_FILE,
+                           "tick,time_us,write_time_us,sync_error_us,timing_error_us",
+                           led_row, NULL, &run_stats) < 0)
+        exit(1);
+    telem_writer_add(&telem, &audio_telem);
+    telem_writer_add(&telem, &led_telem);
+    if (transitions_file) {
+        if (telem_channel_init(&frame_telem, TELEM_RING_RECORDS, transitions_file,
+                               "frame,t_ns", frame_row, NULL, NULL) < 0)
+            exit(1);
+        telem_writer_add(&telem, &frame_telem);
+        log_transitions = 1;
+    }
+    telem_writer_start(&telem);
+    rt_pin_thread(telem.thread, rt_profile.log_cpu);
+    if (first->audio.helper_running)
+        rt_pin_thread(first->audio.helper, rt_profile.log_cpu);
+    // Levels: the BAM thread owns the GPIO, the LED thread only switches
+    // frames. It runs before the loader, which waits on it to free planes.
+    if (playlist.bam) {
+        if (bam_start(&bam, gpio, NULL, (uint64_t)(bam_unit_us * 1000), bam_mode, BAM_PRIORITY) < 0)
+            exit(1);
+        rt_pin_thread(bam.thread, rt_profile.led_cpu);
+        playlist.bam_engine = &bam;
+    }
+    // The loader's WAV helpers inherit its CPU
+    if (playlist.count > 1) {
+        if (playlist_start(&playlist) < 0)
+            exit(1);
+        rt_pin_thread(playlist.loader, rt_profile.log_cpu);
+    }
+    if (net_role != NET_NONE) {
+        netsync_start(&net);
+        rt_pin_thread(net.thread, rt_profile.log_cpu);
+    }
 
-    pthread_create(&led_thread, &led_attr, led_thread_fn, NULL);
-    pthread_create(&audio_thread, &audio_attr, audio_thread_fn, NULL);
+    // -t/-M: per-thread event buffers for the LED and audio threads
+    if ((trace_file || trace_markers) && trace_open(trace_file, 2, TRACE_DEFAULT_EVENTS, trace_markers) < 0)
+        exit(1);
 
-    pthread_join(audio_thread, NULL);
+    int err = rt_thread_create(&led_thread, RT_PRIO_LED, rt_profile.led_cpu, led_thread_fn, NULL);
+    if (err) {
+        fprintf(stderr, "LED thread: %s\n", strerror(err));
+        if (playlist.bam)
+            bam_stop(&bam);
+        gpio_close(gpio);
+        exit(1);
+    }
+    if (net_role != NET_FOLLOWER) {
+        err = rt_thread_create(&audio_thread, RT_PRIO_AUDIO, rt_profile.audio_cpu, audio_thread_fn, NULL);
+        if (err) {
+            fprintf(stderr, "Audio thread: %s\n", strerror(err));
+            atomic_store(&led_stop, 1);
+            pthread_join(led_thread, NULL);
+            if (playlist.bam)
+                bam_stop(&bam);
+            gpio_write(gpio, 0);
+            gpio_close(gpio);
+            exit(1);
+        }
+    }
+    if (control_socket || reload_shows) {
+        if (control_open(&control, control_socket, control_command, control_change, NULL) < 0)
+            exit(1);
+        for (int i = 0; reload_shows && i < playlist.count; ++i)
+            control_watch(&control, playlist.track[i].show_path);
+        if (control_start(&control) < 0)
+            exit(1);
+        rt_pin_thread(control.thread, rt_profile.log_cpu);
+    }
+    if (net_role != NET_FOLLOWER)
+        pthread_join(audio_thread, NULL);
     pthread_join(led_thread, NULL);
+    if (control_socket || reload_shows) {
+        control_stop(&control);
+        control_report(&control, stderr);
+        fprintf(stderr, "Show table swaps: %lu, longest grace period %.2f ms\n",
+                playlist.swaps, playlist.max_grace_ns / 1e6);
+    }
+    if (net_role != NET_NONE) {
+        netsync_stop(&net);
+        netsync_report(&net, stderr);
+    }
     
-    // 1. Turn off all LEDs
-    *GPCLR0 = (1u << 5) | (1u << 6) | (1u << 16) | (1u << 22) | (1u << 23) | (1u << 24) | (1u << 25) | (1u << 26);
+    if (playlist.bam) {
+        bam_stop(&bam);
+        bam_report(&bam, stderr);
+    }
 
-    // 2. Unmap and close /dev/mem safely
-    if (gpio && gpio != MAP_FAILED) {
-        munmap((void *)gpio, GPIO_LEN);
+    // Turn off all LEDs and release the backend
+    gpio_write(gpio, 0);
+    gpio_close(gpio);
+
+    telem_writer_stop(&telem);
+    if (trace_file || trace_markers)
+        trace_close(stderr);
+    latency_report(&run_stats);
+    if (playlist.count > 1)
+        playlist_report(stderr);
+    playlist_close(&playlist);
+    if (run_stats.audio_wall_ns)
+        fprintf(stderr, "Audio thread: %s writer, %s access, %.1f ms CPU in %.1f s (%.3f%%), mean cycle %.1f us\n",
+                audio_writer == AUDIO_WRITER_POLL ? "poll" : "timer", pcm_access_name(pcm_access), run_stats.audio_cpu_ns / 1e6, run_stats.audio_wall_ns / 1e9,
+                100.0 * run_stats.audio_cpu_ns / run_stats.audio_wall_ns,
+                run_stats.cycles ? (double)run_stats.sum / run_stats.cycles : 0.0);
+    unsigned injected_xruns, injected_stalls;
+    pcm_out_fault_counts(&injected_xruns, &injected_stalls);
+    unsigned gaps = atomic_load(&av_sync.gaps);
+    if (gaps || injected_xruns || injected_stalls) {
+        fprintf(stderr, "Xruns (%s): %u injected, %u stalls injected, %u gaps (%u during the show), "
+                "%u back within %lld us, %lu LED holds\n",
+                avsync_gap_policy_name(gap_policy), injected_xruns, injected_stalls, gaps, xrun_gaps_seen,
+                xrun_recovered, (long long)xrun_bound_us, av_sync.holds);
+        if (xrun_gaps_seen) {
+            lhist_print_header(stderr);
+            lhist_print(stderr, &xrun_recovery);
+        }
+        if (xrun_recovered < xrun_gaps_seen)
+            fprintf(stderr, "Xrun recovery: LED/audio offset %.1f us at the end, outside the bound\n",
+                    av_sync.last_error_ns / 1000.0);
     }
-    close(fd);
-    
-    save_runtime_log(AUDIO_LOG_FILE);
+    if (led_finds)
+        fprintf(stderr, "Frame lookups: %u (start, seeks, swaps), slowest %.1f us\n",
+                led_finds, led_find_max_ns / 1000.0);
+    fprintf(stderr, "A/V sync: max LED offset %ld us, %lu hard steps\n",
+            (long)(av_sync.max_abs_error_ns / 1000), av_sync.steps);
     return 0;
 }
 
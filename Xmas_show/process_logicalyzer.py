@@ -9,6 +9,7 @@ import re
 
 # === CONFIGURATION ===
 SAMPLE_RATE = 20000  # Hz (change this if you used 20 kHz, etc.)
+CHANNELS = 8  # Probes decoded by the Parallel decoder, D0 = channel 0
 INPUT_FILE = "20kHz_rm_logicalyzer_llgpio_30buffer"  # Input text file from PulseView
 OUTPUT_FILE = "20kHz_rm_logicalyzer_llgpio_30buffer.txt"  # Output file for your LED+music sequencer
 # ======================
@@ -16,10 +17,10 @@ OUTPUT_FILE = "20kHz_rm_logicalyzer_llgpio_30buffer.txt"  # Output file for your
 SAMPLE_PERIOD_MS = 1000.0 / SAMPLE_RATE  # e.g. 0.02 ms for 50kHz
 
 def hex_to_split_bin(hex_str):
-    """Convert hex to 8-bit binary, reverse it (little-endian), and insert a dot in the middle."""
-    bin_str = format(int(hex_str, 16), '08b')
+    """Convert hex to CHANNELS bits, channel 0 first, with a dot every 4 channels."""
+    bin_str = format(int(hex_str, 16), f"0{CHANNELS}b")
     reversed_bin = bin_str[::-1]  # Reverse the bit order
-    return f"{reversed_bin[:4]}.{reversed_bin[4:]}"
+    return ".".join(reversed_bin[i:i + 4] for i in range(0, len(reversed_bin), 4))
 
 def main():
     with open(INPUT_FILE, "r") as f:
@@ -42,11 +43,12 @@ def main():
             prev_end = start_sample
 
         delay_samples = end_sample - prev_end
-        delay_ms = round(delay_samples * SAMPLE_PERIOD_MS)
+        # Keep µs resolution, the sequencer reads fractional milliseconds
+        delay_ms = round(delay_samples * SAMPLE_PERIOD_MS, 3)
         prev_end = end_sample
 
         bin_value = hex_to_split_bin(hex_value)
-        output_lines.append(f"{delay_ms:04d} {bin_value}")
+        output_lines.append(f"{delay_ms:08.3f} {bin_value}")
 
     with open(OUTPUT_FILE, "w") as f:
         f.write("\n".join(output_lines))
@@ -0,0 +1,55 @@
+# -*- coding: utf-8 -*-
+"""
+Inter-node transition skew of a multi-controller show.
+
+Every node is run with -T frames.csv (frame index, CLOCK_MONOTONIC ns of
+the change). On one machine all nodes share the clock, so the skew of a
+frame is simply the spread of its change times across nodes. Between
+machines, capture the LED outputs on one logic analyzer instead.
+
+    python3 transition_skew.py leader.csv follower1.csv follower2.csv
+"""
+
+import csv
+import sys
+
+SETTLE_FRAMES = 20  # Ignore the first frames while followers lock on
+
+
+def load(path):
+    with open(path, newline="") as f:
+        return {int(row["frame"]): int(row["t_ns"]) for row in csv.DictReader(f)}
+
+
+def percentile(sorted_values, p):
+    if not sorted_values:
+        return 0.0
+    k = min(len(sorted_values) - 1, int(round(p / 100.0 * (len(sorted_values) - 1))))
+    return sorted_values[k]
+
+
+def main():
+    if len(sys.argv) < 3:
+        print(__doc__)
+        sys.exit(1)
+
+    nodes = [load(p) for p in sys.argv[1:]]
+    common = sorted(set.intersection(*(set(n) for n in nodes)))
+    common = [f for f in common if f >= SETTLE_FRAMES]
+    if not common:
+        print("No frames seen by every node")
+        sys.exit(1)
+
+    skews = sorted((max(n[f] for n in nodes) - min(n[f] for n in nodes)) / 1000.0 for f in common)
+    print(f"{len(nodes)} nodes, {len(common)} common transitions")
+    print(f"skew us: p50 {percentile(skews, 50):.1f}  p99 {percentile(skews, 99):.1f}  max {skews[-1]:.1f}")
+
+    # Per node: mean signed offset from the first file
+    ref = nodes[0]
+    for path, node in zip(sys.argv[2:], nodes[1:]):
+        d = [(node[f] - ref[f]) / 1000.0 for f in common]
+        print(f"{path}: mean {sum(d) / len(d):+.1f} us vs {sys.argv[1]}, worst {max(d, key=abs):+.1f} us")
+
+
+if __name__ == "__main__":
+    main()
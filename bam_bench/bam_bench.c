@@ -0,0 +1,57 @@
+// Build: gcc -O2 -Wall -o bam_bench bam_bench.c ../common/gpio*.c ../common/bam.c ../common/latency_hist.c ../common/rt.c -lgpiod -lpthread
+//
+// Run the BAM brightness engine on a level gradient and report what it
+// achieves on this board: refresh rate, CPU cost of the thread, slot
+// lateness and the brightness error caused by timing jitter. Compare the
+// sleep, spin and timerfd modes and different units on sim and mmap.
+//
+//   ./bam_bench [backend-spec] [sleep|spin|timerfd] [unit-us] [seconds]
+//   e.g.  ./bam_bench mmap spin 10 5
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "../common/bam.h"
+#include "../common/gpio.h"
+
+const int LED_PINS[8] = {22, 5, 6, 26, 23, 24, 25, 16}; // BCM numbers
+#define GPIO_SPEC "auto"
+#define DEFAULT_SECONDS 5
+
+int main(int argc, char **argv) {
+    const char *spec = argc > 1 ? argv[1] : gpio_default_spec(GPIO_SPEC);
+    int mode = bam_mode_parse(argc > 2 ? argv[2] : "sleep");
+    double unit_us = argc > 3 ? atof(argv[3]) : BAM_DEFAULT_UNIT_US;
+    int seconds = argc > 4 ? atoi(argv[4]) : DEFAULT_SECONDS;
+    if (mode < 0 || unit_us <= 0 || seconds <= 0) {
+        fprintf(stderr, "Usage: %s [backend-spec] [sleep|spin|timerfd] [unit-us] [seconds]\n", argv[0]);
+        return 1;
+    }
+
+    gpio_backend_t *gpio = gpio_open(spec, LED_PINS, 8);
+    if (!gpio) {
+        fprintf(stderr, "Open GPIO backend %s failed\n", spec);
+        return 1;
+    }
+
+    // 1, 3, 7, ... 255: every plane is used by at least one channel
+    uint8_t levels[8];
+    for (int i = 0; i < 8; ++i)
+        levels[i] = (2u << i) - 1;
+    uint32_t planes[BAM_BITS * GPIO_MAX_BANKS];
+    bam_map(gpio, levels, 8, planes);
+
+    bam_t bam;
+    if (bam_start(&bam, gpio, planes, (uint64_t)(unit_us * 1000), mode, BAM_PRIORITY) < 0) {
+        gpio_close(gpio);
+        return 1;
+    }
+    sleep(seconds);
+    bam_stop(&bam);
+
+    printf("backend %s\n", gpio->name);
+    bam_report(&bam, stdout);
+    gpio_close(gpio);
+    return 0;
+}
@@ -0,0 +1,406 @@
+// Build: gcc -O3 -Wall -o choreo choreo.c ../common/show.c ../common/wav_stream.c -lpthread -lm
+//        (add -mfpu=neon on 32-bit Raspberry Pi OS so the float vectors map to NEON)
+//
+// Generate a light show from a WAV file. The track is cut into
+// overlapping 1024-sample windows and each one goes through an FFT; the
+// spectrum is split into one log-spaced band per channel (channel 0 =
+// bass). A channel lights when its band has an onset (a jump of the band
+// energy above its recent average) and stays on for half a beat. Beats
+// come from the autocorrelation of the summed onset strength; on a beat
+// every band that is louder than usual lights as well.
+//
+// The FFT and band sums use GCC vector types, which compile to SSE on a
+// PC and NEON on the Pi, and the track is split across threads by
+// segment. Output is a pattern file (.txt) or a compiled show (.show).
+//
+//   ./choreo [-c channels] [-t threads] [-s sensitivity] track.wav out.txt|out.show
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "../common/show.h"
+#include "../common/timeutil.h"
+#include "../common/wav_stream.h"
+
+#define FFT_SIZE        1024
+#define FFT_LOG2        10
+#define HOP             512
+#define MAX_THREADS     16
+#define MAX_CHANNELS    64
+#define BAND_LOW_HZ     40.0
+#define BAND_HIGH_HZ    16000.0
+#define FLUX_HISTORY    3      // hops the band energy is compared against
+#define THRESH_WINDOW   24     // hops on each side for the adaptive threshold
+#define DEFAULT_SENSITIVITY 0.15  // log10 energy rise above the local mean
+#define TEMPO_MIN_BPM   60.0
+#define TEMPO_MAX_BPM   180.0
+#define HOLD_MIN_MS     50.0
+#define HOLD_MAX_MS     250.0
+
+typedef float v4f __attribute__((vector_size(16)));
+
+// Read-only tables shared by the workers
+static float window_fn[FFT_SIZE];
+static float twiddle_re[FFT_SIZE] __attribute__((aligned(16)));
+static float twiddle_im[FFT_SIZE] __attribute__((aligned(16)));
+static uint16_t bitrev[FFT_SIZE];
+static int band_lo[MAX_CHANNELS], band_hi[MAX_CHANNELS];
+
+static wav_stream_t wav;
+static int channels = 8;
+static size_t hops;
+static float *energy;       // hops x channels, log10 band energy
+
+typedef struct {
+    pthread_t thread;
+    size_t first, last;     // hop range
+} worker_t;
+
+static void tables_init(uint32_t sample_rate) {
+    for (int i = 0; i < FFT_SIZE; ++i) {
+        window_fn[i] = 0.5f - 0.5f * cosf(2 * M_PI * i / FFT_SIZE);  // Hann
+        int r = 0;
+        for (int b = 0; b < FFT_LOG2; ++b)
+            r |= ((i >> b) & 1) << (FFT_LOG2 - 1 - b);
+        bitrev[i] = r;
+    }
+    // Stage with half-size h uses twiddle[h + j], j < h
+    for (int h = 1; h < FFT_SIZE; h <<= 1)
+        for (int j = 0; j < h; ++j) {
+            twiddle_re[h + j] = cosf(-M_PI * j / h);
+            twiddle_im[h + j] = sinf(-M_PI * j / h);
+        }
+
+    // Log-spaced bands, at least one bin each
+    double high = BAND_HIGH_HZ < sample_rate / 2.0 ? BAND_HIGH_HZ : sample_rate / 2.0;
+    double bin_hz = (double)sample_rate / FFT_SIZE;
+    int prev = 1;
+    for (int c = 0; c < channels; ++c) {
+        double edge = BAND_LOW_HZ * pow(high / BAND_LOW_HZ, (double)(c + 1) / channels);
+        int hi = (int)(edge / bin_hz);
+        if (hi <= prev) hi = prev + 1;
+        if (hi > FFT_SIZE / 2) hi = FFT_SIZE / 2;
+        band_lo[c] = prev;
+        band_hi[c] = hi;
+        prev = hi;
+    }
+}
+
+// In-place radix-2 FFT on split real/imaginary arrays. From h = 4 on,
+// four butterflies run at once.
+static void fft(float *re, float *im) {
+    for (int i = 0; i < FFT_SIZE; ++i) {
+        int r = bitrev[i];
+        if (r > i) {
+            float t = re[i]; re[i] = re[r]; re[r] = t;
+            t = im[i]; im[i] = im[r]; im[r] = t;
+        }
+    }
+    for (int h = 1; h < 4; h <<= 1)
+        for (int k = 0; k < FFT_SIZE; k += 2 * h)
+            for (int j = 0; j < h; ++j) {
+                float wr = twiddle_re[h + j], wi = twiddle_im[h + j];
+                float br = re[k + j + h] * wr - im[k + j + h] * wi;
+                float bi = re[k + j + h] * wi + im[k + j + h] * wr;
+                re[k + j + h] = re[k + j] - br;
+                im[k + j + h] = im[k + j] - bi;
+                re[k + j] += br;
+                im[k + j] += bi;
+            }
+    for (int h = 4; h < FFT_SIZE; h <<= 1)
+        for (int k = 0; k < FFT_SIZE; k += 2 * h)
+            for (int j = 0; j < h; j += 4) {
+                v4f *ar = (v4f *)&re[k + j], *ai = (v4f *)&im[k + j];
+                v4f *br = (v4f *)&re[k + j + h], *bi = (v4f *)&im[k + j + h];
+                v4f wr = *(const v4f *)&twiddle_re[h + j], wi = *(const v4f *)&twiddle_im[h + j];
+                v4f tr = *br * wr - *bi * wi;
+                v4f ti = *br * wi + *bi * wr;
+                *br = *ar - tr;
+                *bi = *ai - ti;
+                *ar += tr;
+                *ai += ti;
+            }
+}
+
+static void *worker_fn(void *arg) {
+    worker_t *w = arg;
+    float re[FFT_SIZE] __attribute__((aligned(16)));
+    float im[FFT_SIZE] __attribute__((aligned(16)));
+    float power[FFT_SIZE / 2 + 4] __attribute__((aligned(16)));
+    const float scale = 1.0f / (32768.0f * wav.channels);
+
+    for (size_t hop = w->first; hop < w->last; ++hop) {
+        // Mono, windowed; past the end of the track is silence
+        size_t start = hop * HOP;
+        for (int i = 0; i < FFT_SIZE; ++i) {
+            float sum = 0;
+            if (start + i < wav.frames) {
+                const int16_t *frame = wav_stream_frames(&wav, start + i);
+                for (int ch = 0; ch < wav.channels; ++ch)
+                    sum += frame[ch];
+            }
+            re[i] = sum * scale * window_fn[i];
+            im[i] = 0;
+        }
+        fft(re, im);
+
+        for (int i = 0; i < FFT_SIZE / 2; i += 4) {
+            v4f r = *(v4f *)&re[i], m = *(v4f *)&im[i];
+            *(v4f *)&power[i] = r * r + m * m;
+        }
+
+        float *out = energy + hop * channels;
+        for (int c = 0; c < channels; ++c) {
+            int i = band_lo[c], hi = band_hi[c];
+            float sum = 0;
+            for (; i < hi && (i & 3); ++i)
+                sum += power[i];
+            v4f acc = {0, 0, 0, 0};
+            for (; i + 4 <= hi; i += 4)
+                acc += *(v4f *)&power[i];
+            for (; i < hi; ++i)
+                sum += power[i];
+            sum += acc[0] + acc[1] + acc[2] + acc[3];
+            out[c] = log10f(sum + 1e-10f);
+        }
+    }
+    return NULL;
+}
+
+// Tempo from the autocorrelation of the onset strength, weighted towards
+// 120 BPM so half/double tempo does not win on noise. The peak lag is
+// refined between hops so the beat grid does not drift over a whole
+// track. Returns the beat period in hops (0 if none) and the grid phase.
+static double find_beats(const float *odf, double hop_s, double *phase) {
+    int lag_min = (int)(60.0 / TEMPO_MAX_BPM / hop_s);
+    int lag_max = (int)(60.0 / TEMPO_MIN_BPM / hop_s) + 1;
+    if (lag_min < 2) lag_min = 2;
+    if ((size_t)lag_max >= hops) return 0;
+
+    double mean = 0;
+    for (size_t t = 0; t < hops; ++t)
+        mean += odf[t];
+    mean /= hops;
+
+    double score[lag_max + 2];
+    int best_lag = 0;
+    for (int lag = lag_min - 1; lag <= lag_max + 1; ++lag) {
+        double acc = 0;
+        for (size_t t = lag; t < hops; ++t)
+            acc += (odf[t] - mean) * (odf[t - lag] - mean);
+        double octaves = log2(60.0 / (lag * hop_s) / 120.0);
+        score[lag] = acc * exp(-0.5 * octaves * octaves) / (hops - lag);
+        if (lag >= lag_min && lag <= lag_max && (!best_lag || score[lag] > score[best_lag]))
+            best_lag = lag;
+    }
+    double a = score[best_lag - 1], b = score[best_lag], c = score[best_lag + 1];
+    double period = best_lag;
+    if (a - 2 * b + c < 0)
+        period += 0.5 * (a - c) / (a - 2 * b + c);
+
+    // Phase with the most onset strength on the grid, in tenths of a hop
+    double best = -1;
+    for (int p10 = 0; p10 < (int)(period * 10); ++p10) {
+        double acc = 0;
+        for (double t = p10 / 10.0; t < hops; t += period)
+            acc += odf[(size_t)(t + 0.5) < hops ? (size_t)(t + 0.5) : hops - 1];
+        if (acc > best) {
+            best = acc;
+            *phase = p10 / 10.0;
+        }
+    }
+    return period;
+}
+
+static int cmp_float(const void *a, const void *b) {
+    float x = *(const float *)a, y = *(const float *)b;
+    return (x > y) - (x < y);
+}
+
+static void format_bits(const uint32_t *bits, char *out) {
+    for (int c = 0; c < channels; ++c) {
+        if (c && c % 4 == 0) *out++ = '.';
+        *out++ = (bits[c / 32] >> (c % 32)) & 1 ? '1' : '0';
+    }
+    *out = '\0';
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-c channels] [-t threads] [-s sensitivity] track.wav out.txt|out.show\n", prog);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    double sensitivity = DEFAULT_SENSITIVITY;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:t:s:")) != -1) {
+        switch (opt) {
+        case 'c': channels = atoi(optarg); break;
+        case 't': threads = atoi(optarg); break;
+        case 's': sensitivity = atof(optarg); break;
+        default: usage(argv[0]);
+        }
+    }
+    if (argc - optind != 2 || channels < 1 || channels > MAX_CHANNELS)
+        usage(argv[0]);
+    if (threads < 1) threads = 1;
+    if (threads > MAX_THREADS) threads = MAX_THREADS;
+    const char *wav_path = argv[optind], *out_path = argv[optind + 1];
+
+    if (wav_stream_open(&wav, wav_path, WAV_STREAM_WINDOW_MS) < 0)
+        return 1;
+    uint64_t t0 = now_ns();
+    tables_init(wav.sample_rate);
+    hops = wav.frames / HOP + 1;
+    energy = malloc(hops * channels * sizeof(float));
+    float *flux = calloc(hops * channels, sizeof(float));
+    float *odf = calloc(hops, sizeof(float));
+    uint8_t *onset = calloc(hops * channels, 1);
+    if (!energy || !flux || !odf || !onset) {
+        perror("choreo: alloc");
+        return 1;
+    }
+
+    // Spectra of different segments are independent
+    worker_t workers[MAX_THREADS];
+    size_t per = (hops + threads - 1) / threads;
+    for (int i = 0; i < threads; ++i) {
+        workers[i].first = i * per < hops ? i * per : hops;
+        workers[i].last = (i + 1) * per < hops ? (i + 1) * per : hops;
+        if (pthread_create(&workers[i].thread, NULL, worker_fn, &workers[i]) != 0) {
+            perror("choreo: pthread_create");
+            return 1;
+        }
+    }
+    for (int i = 0; i < threads; ++i)
+        pthread_join(workers[i].thread, NULL);
+    uint64_t t_fft = now_ns();
+
+    // Rectified rise of each band over its recent average
+    for (size_t t = FLUX_HISTORY; t < hops; ++t)
+        for (int c = 0; c < channels; ++c) {
+            float avg = 0;
+            for (int k = 1; k <= FLUX_HISTORY; ++k)
+                avg += energy[(t - k) * channels + c];
+            float d = energy[t * channels + c] - avg / FLUX_HISTORY;
+            flux[t * channels + c] = d > 0 ? d : 0;
+            odf[t] += flux[t * channels + c];
+        }
+
+    // Median energy per band: quieter moments do not make onsets, and on a
+    // beat only bands that are louder than usual light
+    float *median = malloc(channels * sizeof(float));
+    float *column = malloc(hops * sizeof(float));
+    for (int c = 0; c < channels; ++c) {
+        for (size_t t = 0; t < hops; ++t)
+            column[t] = energy[t * channels + c];
+        qsort(column, hops, sizeof(float), cmp_float);
+        median[c] = column[hops / 2];
+    }
+    free(column);
+
+    // Onset: local peak of the flux that clears the local mean by the sensitivity
+    size_t onsets = 0;
+    for (int c = 0; c < channels; ++c) {
+        double sum = 0;
+        size_t lo = 0, hi = 0;
+        for (size_t t = 0; t < hops; ++t) {
+            while (hi < hops && hi <= t + THRESH_WINDOW)
+                sum += flux[hi++ * channels + c];
+            while (lo + THRESH_WINDOW < t)
+                sum -= flux[lo++ * channels + c];
+            float f = flux[t * channels + c];
+            int peak = (t == 0 || f >= flux[(t - 1) * channels + c]) &&
+                       (t + 1 == hops || f > flux[(t + 1) * channels + c]);
+            if (peak && f > sum / (hi - lo) + sensitivity && energy[t * channels + c] > median[c]) {
+                onset[t * channels + c] = 1;
+                onsets++;
+            }
+        }
+    }
+
+    double hop_s = (double)HOP / wav.sample_rate;
+    double phase = 0;
+    double beat_period = find_beats(odf, hop_s, &phase);
+    double hold_ms = beat_period ? beat_period * hop_s * 500 : HOLD_MAX_MS;
+    if (hold_ms < HOLD_MIN_MS) hold_ms = HOLD_MIN_MS;
+    if (hold_ms > HOLD_MAX_MS) hold_ms = HOLD_MAX_MS;
+    size_t hold = (size_t)(hold_ms / 1000 / hop_s + 0.5);
+
+
+    // Light timeline, one state per hop, centred on its window
+    uint32_t *lit_until = calloc(channels, sizeof(uint32_t));
+    size_t beats = 0;
+    double next_beat = beat_period ? phase : INFINITY;
+    FILE *txt = NULL;
+    show_writer_t *w = NULL;
+    size_t len = strlen(out_path);
+    if (len > 5 && strcmp(out_path + len - 5, ".show") == 0)
+        w = show_writer_open(out_path, channels, 0);
+    else if (!(txt = fopen(out_path, "w")))
+        perror("choreo: create output");
+    if (!w && !txt)
+        return 1;
+
+    uint64_t duration_us = (uint64_t)wav.frames * 1000000 / wav.sample_rate;
+    uint32_t bits[(MAX_CHANNELS + 31) / 32], cur[(MAX_CHANNELS + 31) / 32] = {0};
+    uint64_t cur_us = 0;
+    size_t frames = 0;
+    char pattern[MAX_CHANNELS * 5 / 4 + 1];
+    for (size_t t = 0; t <= hops; ++t) {
+        uint64_t t_us = ((uint64_t)t * HOP + FFT_SIZE / 2) * 1000000 / wav.sample_rate;
+        if (t < hops && t_us < duration_us) {
+            int on_beat = t + 0.5 >= next_beat;
+            if (on_beat) {
+                next_beat += beat_period;
+                beats++;
+            }
+            memset(bits, 0, sizeof(bits));
+            for (int c = 0; c < channels; ++c) {
+                if (onset[t * channels + c] || (on_beat && energy[t * channels + c] > median[c]))
+                    lit_until[c] = t + hold;
+                if (t < lit_until[c])
+                    bits[c / 32] |= 1u << (c % 32);
+            }
+            if (memcmp(bits, cur, sizeof(bits)) == 0)
+                continue;
+        } else {
+            t_us = duration_us;  // The last state lasts to the end of the track
+        }
+
+        if (t_us > cur_us) {
+            if (w) {
+                show_writer_add(w, cur_us, cur, NULL);
+            } else {
+                format_bits(cur, pattern);
+                fprintf(txt, "%08.3f %s\n", (t_us - cur_us) / 1000.0, pattern);
+            }
+            frames++;
+        }
+        if (t_us == duration_us)
+            break;
+        memcpy(cur, bits, sizeof(bits));
+        cur_us = t_us;
+    }
+    int ret = w ? show_writer_close(w, duration_us) : fclose(txt);
+    if (ret != 0) {
+        fprintf(stderr, "choreo: failed to write %s\n", out_path);
+        return 1;
+    }
+    uint64_t t_end = now_ns();
+
+    fprintf(stderr, "%s: %.1f s of audio, %zu windows on %d threads in %.1f ms (FFT %.1f ms)\n",
+            wav_path, duration_us / 1e6, hops, threads, (t_end - t0) / 1e6, (t_fft - t0) / 1e6);
+    fprintf(stderr, "%s: %zu frames, %d channels, %.1f BPM, %zu beats, %zu onsets, hold %.0f ms\n",
+            out_path, frames, channels, beat_period ? 60.0 / (beat_period * hop_s) : 0.0, beats, onsets, hold_ms);
+
+    wav_stream_close(&wav);
+    free(energy); free(flux); free(odf); free(onset); free(median); free(lit_until);
+    return 0;
+}
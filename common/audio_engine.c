@@ -0,0 +1,360 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#ifndef AUDIO_NO_MPG123
+#include <mpg123.h>
+#endif
+
+#include "audio_engine.h"
+#include "pcm_out.h"
+#include "rt.h"
+#include "timeutil.h"
+
+#define DECODE_CHUNK_FRAMES 4096
+#define DECODE_IDLE_NS      5000000   // decoder nap when the ring is full
+
+static int is_wav_path(const char *path) {
+    size_t len = strlen(path);
+    return len > 4 && strcasecmp(path + len - 4, ".wav") == 0;
+}
+
+static int open_decoder(audio_engine_t *e) {
+    if (e->is_wav) {
+        if (wav_stream_open(&e->wav, e->path, WAV_STREAM_WINDOW_MS) < 0)
+            return -1;
+        e->sample_rate = e->wav.sample_rate;
+        e->channels = e->wav.channels;
+        e->start_frame = e->start_us * e->sample_rate / 1000000;
+        if (e->start_frame >= e->wav.frames) {
+            fprintf(stderr, "audio: start past the end of %s\n", e->path);
+            return -1;
+        }
+        wav_stream_seek(&e->wav, e->start_frame);
+        return 0;
+    }
+#ifndef AUDIO_NO_MPG123
+    int err;
+    mpg123_init();
+    mpg123_handle *mh = mpg123_new(NULL, &err);
+    if (!mh) {
+        fprintf(stderr, "audio: mpg123_new: %s\n", mpg123_plain_strerror(err));
+        return -1;
+    }
+    long rate;
+    int channels, encoding;
+    if (mpg123_open(mh, e->path) != MPG123_OK ||
+        mpg123_getformat(mh, &rate, &channels, &encoding) != MPG123_OK) {
+        fprintf(stderr, "audio: %s: %s\n", e->path, mpg123_strerror(mh));
+        mpg123_delete(mh);
+        return -1;
+    }
+    // Keep the stream's rate and layout, always decode to S16
+    mpg123_format_none(mh);
+    mpg123_format(mh, rate, channels, MPG123_ENC_SIGNED_16);
+    e->decoder = mh;
+    e->sample_rate = rate;
+    e->channels = channels;
+    // Sample-accurate with the stream's seek table or Xing TOC
+    e->start_frame = e->start_us * e->sample_rate / 1000000;
+    if (e->start_frame && mpg123_seek(mh, (off_t)e->start_frame, SEEK_SET) < 0) {
+        fprintf(stderr, "audio: seek in %s: %s\n", e->path, mpg123_strerror(mh));
+        return -1;
+    }
+    return 0;
+#else
+    fprintf(stderr, "audio: %s: built with AUDIO_NO_MPG123, only .wav is supported\n", e->path);
+    return -1;
+#endif
+}
+
+// Fill up to n frames at dst. Returns frames decoded, 0 at the end, -1 on error.
+static long decode(audio_engine_t *e, int16_t *dst, size_t n, size_t *wav_pos) {
+    if (e->is_wav) {
+        size_t left = e->wav.frames - *wav_pos;
+        if (n > left) n = left;
+        memcpy(dst, wav_stream_frames(&e->wav, *wav_pos), n * e->channels * sizeof(int16_t));
+        *wav_pos += n;
+        wav_stream_advance(&e->wav, *wav_pos);
+        return n;
+    }
+#ifndef AUDIO_NO_MPG123
+    size_t frame_bytes = e->channels * sizeof(int16_t), done = 0;
+    int err;
+    do {
+        err = mpg123_read(e->decoder, dst, n * frame_bytes, &done);
+    } while (err == MPG123_NEW_FORMAT && done == 0);
+    if (err != MPG123_OK && err != MPG123_DONE && err != MPG123_NEW_FORMAT) {
+        fprintf(stderr, "audio: decode: %s\n", mpg123_strerror(e->decoder));
+        return -1;
+    }
+    return done / frame_bytes;
+#else
+    return -1;
+#endif
+}
+
+static void *decode_fn(void *arg) {
+    audio_engine_t *e = arg;
+    uint32_t cap = e->ring_mask + 1;
+    size_t wav_pos = e->start_frame;
+
+    while (!atomic_load_explicit(&e->stop, memory_order_relaxed)) {
+        unsigned head = atomic_load_explicit(&e->head, memory_order_relaxed);
+        unsigned tail = atomic_load_explicit(&e->tail, memory_order_acquire);
+        uint32_t space = cap - (head - tail);
+        if (space < DECODE_CHUNK_FRAMES && space < cap / 2) {
+            sleep_until_ns(now_ns() + DECODE_IDLE_NS);
+            continue;
+        }
+
+        // Decode straight into the ring, one contiguous span at a time
+        uint32_t idx = head & e->ring_mask;
+        uint32_t n = cap - idx;
+        if (n > space) n = space;
+        if (n > DECODE_CHUNK_FRAMES) n = DECODE_CHUNK_FRAMES;
+        long got = decode(e, e->ring + (size_t)idx * e->channels, n, &wav_pos);
+        if (got <= 0)
+            break;
+        atomic_store_explicit(&e->head, head + (unsigned)got, memory_order_release);
+    }
+    atomic_store_explicit(&e->eof, 1, memory_order_release);
+    return NULL;
+}
+
+// When the first period really started playing, from the PCM trigger
+// timestamp (CLOCK_MONOTONIC), or the caller's estimate if there is none
+static uint64_t trigger_ns(snd_pcm_t *pcm, uint64_t fallback) {
+    snd_pcm_status_t *status;
+    uint64_t t = fallback;
+    if (snd_pcm_status_malloc(&status) < 0)
+        return t;
+    if (snd_pcm_status(pcm, status) == 0) {
+        snd_htimestamp_t ts;
+        snd_pcm_status_get_trigger_htstamp(status, &ts);
+        if (ts.tv_sec || ts.tv_nsec)
+            t = timespec_to_ns(ts);
+    }
+    snd_pcm_status_free(status);
+    return t;
+}
+
+// Straight from the ring into the device's buffer: the wrapped part of
+// the ring and any padding are separate commits, period_buf is unused.
+// *used is set to the track frames committed, also when a later commit
+// fails.
+static snd_pcm_sframes_t write_ring_mmap(audio_engine_t *e, uint32_t idx, uint32_t first,
+                                         uint32_t n, uint32_t pad, uint32_t *used) {
+    snd_pcm_sframes_t err;
+    *used = 0;
+    if ((err = pcm_out_write(e->pcm, PCM_ACCESS_MMAP, e->ring + (size_t)idx * e->channels, first, e->channels)) < 0)
+        return err;
+    *used = first;
+    if ((err = pcm_out_write(e->pcm, PCM_ACCESS_MMAP, e->ring, n - first, e->channels)) < 0)
+        return err;
+    *used = n;
+    if ((err = pcm_out_write(e->pcm, PCM_ACCESS_MMAP, NULL, pad, e->channels)) < 0)
+        return err;
+    return n + pad;
+}
+
+static void *write_fn(void *arg) {
+    audio_engine_t *e = arg;
+    uint16_t ch = e->channels;
+    rt_thread_enter("audio_writer");
+    unsigned prefill = (uint64_t)e->sample_rate * AUDIO_ENGINE_PREFILL_MS / 1000;
+    if (prefill > e->ring_mask) prefill = e->ring_mask;
+
+    // Wait for the decoder to get ahead, then start together with the LEDs
+    while (!atomic_load_explicit(&e->stop, memory_order_relaxed) &&
+           !atomic_load_explicit(&e->eof, memory_order_acquire) &&
+           atomic_load_explicit(&e->head, memory_order_acquire) < prefill)
+        sleep_until_ns(now_ns() + 1000000);
+    if (e->start)
+        pthread_barrier_wait(e->start);
+    e->release_ns = now_ns();
+
+    int64_t track_frames = 0;   // of the track sent to the device, not the silence
+    int started = 0;
+    while (!atomic_load_explicit(&e->stop, memory_order_relaxed)) {
+        // eof first: once it is set, head is final
+        int eof = atomic_load_explicit(&e->eof, memory_order_acquire);
+        unsigned tail = atomic_load_explicit(&e->tail, memory_order_relaxed);
+        unsigned head = atomic_load_explicit(&e->head, memory_order_acquire);
+        uint32_t avail = head - tail;
+        if (avail == 0 && eof)
+            break;
+
+        uint32_t n = avail < AUDIO_ENGINE_PERIOD ? avail : AUDIO_ENGINE_PERIOD;
+        uint32_t idx = tail & e->ring_mask, first = e->ring_mask + 1 - idx;
+        if (first > n) first = n;
+
+        // Decoder fell behind: play silence rather than wait and xrun
+        uint32_t pad = n < AUDIO_ENGINE_PERIOD && !eof ? AUDIO_ENGINE_PERIOD - n : 0;
+        if (pad)
+            atomic_fetch_add_explicit(&e->underflows, 1, memory_order_relaxed);
+
+        uint64_t before;
+        snd_pcm_sframes_t written;
+        uint32_t used;
+        if (e->access == PCM_ACCESS_MMAP) {
+            before = now_ns();
+            written = write_ring_mmap(e, idx, first, n, pad, &used);
+        } else {
+            memcpy(e->period_buf, e->ring + (size_t)idx * ch, first * ch * sizeof(int16_t));
+            memcpy(e->period_buf + (size_t)first * ch, e->ring, (n - first) * ch * sizeof(int16_t));
+            memset(e->period_buf + (size_t)n * ch, 0, pad * ch * sizeof(int16_t));
+            before = now_ns();
+            written = snd_pcm_writei(e->pcm, e->period_buf, n + pad);
+            used = written < 0 ? 0 : (uint32_t)written < n ? (uint32_t)written : n;
+        }
+        // Only what reached the device leaves the ring; the rest goes out
+        // with the next write, so an xrun loses time but no track frames
+        track_frames += used;
+        atomic_store_explicit(&e->tail, tail + used, memory_order_release);
+        if (written < 0) {
+            e->xruns++;
+            snd_pcm_recover(e->pcm, written, 1);
+            continue;
+        }
+        if (!started) {
+            started = 1;
+            e->start_ns = trigger_ns(e->pcm, before);
+        }
+
+        // Position of the track, not counting the silence we inserted
+        snd_pcm_sframes_t delay;
+        if (e->sync && snd_pcm_delay(e->pcm, &delay) == 0)
+            avsync_audio_update(e->sync, e->start_frame + track_frames, delay, now_ns());
+    }
+
+    if (atomic_load_explicit(&e->stop, memory_order_relaxed))
+        snd_pcm_drop(e->pcm);
+    else
+        snd_pcm_drain(e->pcm);
+    if (e->sync)
+        avsync_audio_finished(e->sync);
+    rt_thread_exit();
+    return NULL;
+}
+
+static int setup_pcm(audio_engine_t *e) {
+    const char *device = e->device ? e->device : "default";
+    int err = snd_pcm_open(&e->pcm, device, SND_PCM_STREAM_PLAYBACK, 0);
+    if (err < 0) {
+        fprintf(stderr, "audio: snd_pcm_open %s: %s\n", device, snd_strerror(err));
+        return -1;
+    }
+
+    snd_pcm_hw_params_t *params;
+    snd_pcm_hw_params_malloc(&params);
+    snd_pcm_hw_params_any(e->pcm, params);
+    e->access = pcm_set_access(e->pcm, params, e->access);
+    snd_pcm_hw_params_set_format(e->pcm, params, SND_PCM_FORMAT_S16_LE);
+    snd_pcm_hw_params_set_channels(e->pcm, params, e->channels);
+    snd_pcm_hw_params_set_rate(e->pcm, params, e->sample_rate, 0);
+    snd_pcm_uframes_t buffer_size = AUDIO_ENGINE_PERIOD * AUDIO_ENGINE_PERIODS;
+    snd_pcm_uframes_t period_size = AUDIO_ENGINE_PERIOD;
+    snd_pcm_hw_params_set_period_size_near(e->pcm, params, &period_size, 0);
+    snd_pcm_hw_params_set_buffer_size_near(e->pcm, params, &buffer_size);
+    err = snd_pcm_hw_params(e->pcm, params);
+    snd_pcm_hw_params_free(params);
+    if (err < 0) {
+        fprintf(stderr, "audio: %u Hz/%u ch on %s: %s\n", e->sample_rate, e->channels, device, snd_strerror(err));
+        return -1;
+    }
+
+    // Start on the first write and timestamp the trigger on CLOCK_MONOTONIC
+    snd_pcm_sw_params_t *sw;
+    snd_pcm_sw_params_malloc(&sw);
+    snd_pcm_sw_params_current(e->pcm, sw);
+    snd_pcm_sw_params_set_start_threshold(e->pcm, sw, 1);
+    snd_pcm_sw_params_set_tstamp_mode(e->pcm, sw, SND_PCM_TSTAMP_ENABLE);
+    snd_pcm_sw_params_set_tstamp_type(e->pcm, sw, SND_PCM_TSTAMP_TYPE_MONOTONIC);
+    snd_pcm_sw_params(e->pcm, sw);
+    snd_pcm_sw_params_free(sw);
+    snd_pcm_prepare(e->pcm);
+    return 0;
+}
+
+int audio_engine_open(audio_engine_t *e) {
+    e->decoder = NULL;
+    e->pcm = NULL;
+    e->ring = e->period_buf = NULL;
+    e->start_ns = e->release_ns = 0;
+    e->xruns = 0;
+    e->running = 0;
+    atomic_init(&e->underflows, 0);
+    atomic_init(&e->head, 0);
+    atomic_init(&e->tail, 0);
+    atomic_init(&e->eof, 0);
+    atomic_init(&e->stop, 0);
+    e->is_wav = is_wav_path(e->path);
+
+    if (open_decoder(e) < 0)
+        return -1;
+    if (setup_pcm(e) < 0) {
+        audio_engine_close(e);
+        return -1;
+    }
+
+    // Touch the ring and the period buffer now, not on the RT thread
+    uint32_t want = (uint64_t)e->sample_rate * AUDIO_ENGINE_RING_MS / 1000, cap = 1;
+    while (cap < want) cap <<= 1;
+    e->ring = calloc((size_t)cap * e->channels, sizeof(int16_t));
+    e->period_buf = calloc((size_t)AUDIO_ENGINE_PERIOD * e->channels, sizeof(int16_t));
+    if (!e->ring || !e->period_buf) {
+        audio_engine_close(e);
+        return -1;
+    }
+    memset(e->ring, 0, (size_t)cap * e->channels * sizeof(int16_t));
+    e->ring_mask = cap - 1;
+    return 0;
+}
+
+int audio_engine_start(audio_engine_t *e) {
+    if (pthread_create(&e->decode_thread, NULL, decode_fn, e) != 0)
+        return -1;
+
+    int err = rt_thread_create(&e->write_thread, e->priority, -1, write_fn, e);
+    if (err != 0) {
+        atomic_store(&e->stop, 1);
+        pthread_join(e->decode_thread, NULL);
+        return -1;
+    }
+    e->running = 1;
+    return 0;
+}
+
+void audio_engine_wait(audio_engine_t *e) {
+    if (!e->running)
+        return;
+    pthread_join(e->write_thread, NULL);
+    atomic_store(&e->stop, 1);  // Writer is done, release the decoder
+    pthread_join(e->decode_thread, NULL);
+    e->running = 0;
+}
+
+void audio_engine_stop(audio_engine_t *e) {
+    atomic_store(&e->stop, 1);
+    audio_engine_wait(e);
+}
+
+void audio_engine_close(audio_engine_t *e) {
+    audio_engine_stop(e);
+    if (e->pcm)
+        snd_pcm_close(e->pcm);
+    if (e->is_wav)
+        wav_stream_close(&e->wav);
+#ifndef AUDIO_NO_MPG123
+    else if (e->decoder) {
+        mpg123_close(e->decoder);
+        mpg123_delete(e->decoder);
+    }
+#endif
+    free(e->ring);
+    free(e->period_buf);
+    e->pcm = NULL;
+    e->decoder = NULL;
+    e->ring = e->period_buf = NULL;
+}
@@ -0,0 +1,77 @@
+#ifndef AUDIO_ENGINE_H
+#define AUDIO_ENGINE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <alsa/asoundlib.h>
+
+#include "avsync.h"
+#include "wav_stream.h"
+
+// In-process replacement for system("mpg123 ..."). A normal-priority
+// decoder thread turns the track (MP3 through libmpg123, or 16-bit WAV)
+// into S16 frames in a lock-free SPSC ring; a SCHED_FIFO writer thread
+// feeds ALSA from the ring and never waits on the decoder. Once the ring
+// is prefilled the writer meets the LED thread on a shared start barrier,
+// so both sides are released together and the audio trigger time can be
+// compared against the LED start.
+//
+// Build with -DAUDIO_NO_MPG123 to drop libmpg123 (WAV only).
+
+#define AUDIO_ENGINE_RING_MS     2000  // decoded audio buffered ahead of ALSA
+#define AUDIO_ENGINE_PREFILL_MS  500   // ring level before the start barrier
+#define AUDIO_ENGINE_PERIOD      441   // frames per ALSA write
+#define AUDIO_ENGINE_PERIODS     12    // ALSA buffer size in periods
+#define AUDIO_ENGINE_PRIORITY    75    // writer priority, below the LED threads
+
+typedef struct {
+    // Configuration, set before audio_engine_open
+    const char *path;           // .wav is mapped, anything else goes to libmpg123
+    const char *device;         // ALSA PCM, "default" when NULL
+    int priority;               // SCHED_FIFO priority of the writer, 0 = normal
+    int access;                 // PCM_ACCESS_RW (writei) or PCM_ACCESS_MMAP
+    pthread_barrier_t *start;   // shared with the LED thread, NULL = no wait
+    avsync_t *sync;             // optional, fed with the playback position
+    uint64_t start_us;          // play from here instead of the start
+
+    // Format of the track
+    uint32_t sample_rate;
+    uint16_t channels;
+
+    // Results
+    uint64_t start_ns;          // CLOCK_MONOTONIC time the PCM was triggered
+    uint64_t release_ns;        // when the writer left the start barrier
+    atomic_uint underflows;     // writer found the ring empty, wrote silence
+    unsigned xruns;
+
+    // Internal
+    void *decoder;              // mpg123_handle
+    wav_stream_t wav;
+    int is_wav;
+    uint64_t start_frame;       // start_us at the track's rate
+    snd_pcm_t *pcm;
+    int16_t *ring;
+    int16_t *period_buf;        // one ALSA write, owned by the writer
+    uint32_t ring_mask;         // in frames
+    _Alignas(64) atomic_uint head;  // frames written by the decoder
+    _Alignas(64) atomic_uint tail;  // frames taken by the writer
+    atomic_int eof;             // decoder has pushed the last frame
+    atomic_int stop;
+    pthread_t decode_thread, write_thread;
+    int running;
+} audio_engine_t;
+
+// Open the track and the PCM and allocate the ring. Returns 0 or -1.
+int audio_engine_open(audio_engine_t *e);
+// Start decoding and the writer. The writer blocks on e->start once the
+// ring holds AUDIO_ENGINE_PREFILL_MS, so the other party must reach it.
+int audio_engine_start(audio_engine_t *e);
+// Block until the track has played out (or audio_engine_stop was called)
+void audio_engine_wait(audio_engine_t *e);
+// Stop early and discard what is still queued
+void audio_engine_stop(audio_engine_t *e);
+// Also safe after a failed audio_engine_open
+void audio_engine_close(audio_engine_t *e);
+
+#endif
@@ -0,0 +1,176 @@
+#include <string.h>
+
+#include "avsync.h"
+
+void avsync_init(avsync_t *s, unsigned int rate, long max_slew_ppm, long step_us) {
+    memset(s, 0, sizeof(*s));
+    atomic_init(&s->seq, 0);
+    atomic_init(&s->finished, 0);
+    atomic_init(&s->gaps, 0);
+    atomic_init(&s->jumps, 0);
+    atomic_init(&s->paused, 0);
+    s->rate = rate;
+    s->max_slew_ppm = max_slew_ppm;
+    s->step_us = step_us;
+}
+
+void avsync_reference_update(avsync_t *s, int64_t pos_ns, uint64_t t_ns) {
+    // Odd sequence while the sample is being written
+    atomic_fetch_add_explicit(&s->seq, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    s->sample_t_ns = t_ns;
+    s->sample_pos_ns = pos_ns;
+    atomic_fetch_add_explicit(&s->seq, 1, memory_order_release);
+}
+
+int avsync_gap_policy_parse(const char *name) {
+    if (strcmp(name, "slew") == 0) return AVSYNC_GAP_SLEW;
+    if (strcmp(name, "pause") == 0) return AVSYNC_GAP_PAUSE;
+    if (strcmp(name, "skip") == 0) return AVSYNC_GAP_SKIP;
+    return -1;
+}
+
+const char *avsync_gap_policy_name(int policy) {
+    return policy == AVSYNC_GAP_PAUSE ? "pause" : policy == AVSYNC_GAP_SKIP ? "skip" : "slew";
+}
+
+void avsync_audio_update(avsync_t *s, int64_t frames_written, long delay_frames, uint64_t t_ns) {
+    int64_t played = frames_written - delay_frames;
+    if (played < 0) played = 0;
+    s->sample_queued_ns = (int64_t)delay_frames * 1000000000LL / s->rate;
+    avsync_reference_update(s, played * 1000000000LL / s->rate, t_ns);
+}
+
+int64_t avsync_audio_gap_ns(const avsync_t *s, uint64_t now) {
+    if (s->sample_t_ns == 0)
+        return 0;
+    int64_t gap = (int64_t)(now - s->sample_t_ns) - s->sample_queued_ns;
+    return gap > 0 ? gap : 0;
+}
+
+void avsync_audio_gap(avsync_t *s) {
+    atomic_fetch_add_explicit(&s->gaps, 1, memory_order_release);
+}
+
+void avsync_audio_jump(avsync_t *s, int paused) {
+    atomic_store_explicit(&s->paused, paused, memory_order_relaxed);
+    atomic_fetch_add_explicit(&s->jumps, 1, memory_order_release);
+}
+
+void avsync_audio_finished(avsync_t *s) {
+    atomic_store_explicit(&s->finished, 1, memory_order_release);
+}
+
+int avsync_audio_position_ns(avsync_t *s, uint64_t now, int64_t *pos_ns) {
+    uint64_t t_ns;
+    int64_t pos;
+    unsigned int seq;
+    do {
+        seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+        t_ns = s->sample_t_ns;
+        pos = s->sample_pos_ns;
+        atomic_thread_fence(memory_order_acquire);
+    } while ((seq & 1) || seq != atomic_load_explicit(&s->seq, memory_order_relaxed));
+
+    if (t_ns == 0)
+        return -1;
+
+    // Between samples the device plays in real time. If samples stop
+    // coming (xrun, stalled writer) the position must stop too.
+    int64_t since = (int64_t)(now - t_ns);
+    if (since < 0 || atomic_load_explicit(&s->paused, memory_order_relaxed)) since = 0;
+    if (since > AVSYNC_MAX_EXTRAPOLATE_NS && !atomic_load_explicit(&s->finished, memory_order_acquire))
+        since = AVSYNC_MAX_EXTRAPOLATE_NS;
+
+    *pos_ns = pos + since;
+    return 0;
+}
+
+static int64_t led_position_at(const avsync_t *s, uint64_t t) {
+    int64_t dt = (int64_t)(t - s->anchor_t_ns);
+    return s->anchor_show_ns + dt + dt / 1000000 * s->adj_ppm
+           + (dt % 1000000) * s->adj_ppm / 1000000;
+}
+
+int64_t avsync_led_position_ns(avsync_t *s, uint64_t now) {
+    // Jumps first: the position read after it is at least as new
+    unsigned jumps = atomic_load_explicit(&s->jumps, memory_order_acquire);
+    int64_t audio_ns;
+    if (avsync_audio_position_ns(s, now, &audio_ns) < 0)
+        return -1;
+
+    // Paused: the lights stay on the audio position, which stands still
+    if (!s->locked || jumps != s->seen_jumps || atomic_load_explicit(&s->paused, memory_order_relaxed)) {
+        s->locked = 1;
+        s->seen_jumps = jumps;
+        s->holding = 0;
+        s->anchor_t_ns = now;
+        s->anchor_show_ns = audio_ns;
+        s->adj_ppm = (long)s->drift_ppm;
+        return audio_ns;
+    }
+
+    unsigned gaps = atomic_load_explicit(&s->gaps, memory_order_acquire);
+    if (gaps != s->seen_gaps) {
+        s->seen_gaps = gaps;
+        if (s->gap_policy == AVSYNC_GAP_PAUSE && !s->holding) {
+            s->anchor_show_ns = led_position_at(s, now);
+            s->holding = 1;
+            s->holds++;
+        }
+    }
+    if (s->holding) {
+        // Frozen where the lights were when the gap was reported; the
+        // timeline restarts on the audio once it has played up to here
+        s->last_error_ns = audio_ns - s->anchor_show_ns;
+        s->anchor_t_ns = now;
+        if (audio_ns < s->anchor_show_ns)
+            return s->anchor_show_ns;
+        s->holding = 0;
+        s->anchor_show_ns = audio_ns;
+        s->adj_ppm = (long)s->drift_ppm;
+        s->last_error_ns = 0;
+        return audio_ns;
+    }
+
+    int64_t led_ns = led_position_at(s, now);
+    int64_t err = audio_ns - led_ns;
+    int64_t abs_err = err < 0 ? -err : err;
+    s->last_error_ns = err;
+    if (abs_err > s->max_abs_error_ns)
+        s->max_abs_error_ns = abs_err;
+
+    if (abs_err > (int64_t)s->step_us * 1000) {
+        // Too far off to slew in reasonable time
+        led_ns = audio_ns;
+        s->adj_ppm = (long)s->drift_ppm;
+        s->steps++;
+    } else {
+        // PI steering: the integral learns the steady drift of the sound
+        // card clock, the proportional part removes the remaining error
+        // over the horizon. The sum is held within the slew bound.
+        double err_ppm = (double)err * 1e6 / AVSYNC_HORIZON_NS;
+        double dt = (double)(now - s->anchor_t_ns);
+        if (err_ppm < s->max_slew_ppm && err_ppm > -s->max_slew_ppm)  // no windup while catching up
+            s->drift_ppm += err_ppm * dt / AVSYNC_INTEGRAL_NS;
+        if (s->drift_ppm > s->max_slew_ppm) s->drift_ppm = s->max_slew_ppm;
+        if (s->drift_ppm < -s->max_slew_ppm) s->drift_ppm = -s->max_slew_ppm;
+
+        double ppm = s->drift_ppm + err_ppm;
+        if (ppm > s->max_slew_ppm) ppm = s->max_slew_ppm;
+        if (ppm < -s->max_slew_ppm) ppm = -s->max_slew_ppm;
+        s->adj_ppm = (long)ppm;
+    }
+
+    s->anchor_t_ns = now;
+    s->anchor_show_ns = led_ns;
+    return led_ns;
+}
+
+uint64_t avsync_led_deadline_ns(const avsync_t *s, int64_t show_ns) {
+    int64_t ds = show_ns - s->anchor_show_ns;
+    if (ds <= 0)
+        return s->anchor_t_ns;
+    // Invert position = anchor + dt * (1 + adj)
+    return s->anchor_t_ns + (uint64_t)((double)ds * 1e6 / (1e6 + s->adj_ppm));
+}
@@ -0,0 +1,110 @@
+#ifndef AVSYNC_H
+#define AVSYNC_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+// Audio-mastered show clock. The audio thread publishes how far playback
+// has really got (frames written minus snd_pcm_delay) and the LED thread
+// steers its own timeline towards that position. Corrections are slewed
+// by at most max_slew_ppm, so the lights never jump on normal jitter;
+// only errors larger than step_us (an xrun, a stalled device) are fixed by
+// stepping the LED timeline straight to the audio position.
+//
+// After an xrun the device has played everything queued and then sat
+// silent for a while. The audio thread reports the gap and the policy
+// decides how the two timelines meet again:
+//
+//   slew   nothing special: the LEDs slew (or step) onto the audio
+//   pause  the LEDs hold their position until the audio catches up
+//   skip   the audio thread moves the track on by the gap, so the music
+//          continues where wall time says it should and the LEDs never
+//          leave it
+//
+// A seek or pause is not an error to steer out: the audio thread reports
+// it as a jump and the LED timeline steps to the new position at once.
+// While paused the position does not advance between samples.
+//
+// The reference does not have to be the local sound card: a follower in a
+// multi-controller show feeds the leader's position received over the
+// network through avsync_reference_update() and steers the same way.
+
+#define AVSYNC_DEFAULT_SLEW_PPM   20000   // LEDs may run 2% fast or slow
+#define AVSYNC_DEFAULT_STEP_US    250000
+#define AVSYNC_HORIZON_NS         1000000000LL  // remove an error over ~1 s
+#define AVSYNC_INTEGRAL_NS        10000000000LL // learn clock drift over ~10 s
+#define AVSYNC_MAX_EXTRAPOLATE_NS 100000000LL   // stale audio stops advancing
+
+enum { AVSYNC_GAP_SLEW, AVSYNC_GAP_PAUSE, AVSYNC_GAP_SKIP };
+
+typedef struct {
+    unsigned int rate;
+    long max_slew_ppm;
+    long step_us;
+
+    // Written by the audio thread under a sequence counter
+    atomic_uint seq;
+    uint64_t sample_t_ns;       // 0 until audio has started
+    int64_t sample_pos_ns;      // show position actually played at sample_t_ns
+    int64_t sample_queued_ns;   // audio still queued at sample_t_ns, audio thread only
+    atomic_int finished;        // no more samples, the device drains in real time
+    int gap_policy;
+    atomic_uint gaps;           // xruns reported by the audio thread
+    atomic_uint jumps;          // seeks and pauses reported by the audio thread
+    atomic_int paused;
+
+    // LED timeline, owned by the LED thread
+    int locked;
+    uint64_t anchor_t_ns;
+    int64_t anchor_show_ns;
+    long adj_ppm;
+    double drift_ppm;           // learned audio vs CLOCK_MONOTONIC rate difference
+    unsigned seen_gaps, seen_jumps;
+    int holding;                // pause policy: frozen until the audio passes
+
+    // Statistics for the run report
+    int64_t last_error_ns;
+    int64_t max_abs_error_ns;
+    unsigned long steps;
+    unsigned long holds;
+} avsync_t;
+
+void avsync_init(avsync_t *s, unsigned int rate, long max_slew_ppm, long step_us);
+
+// Audio thread: publish frames written so far and the current PCM delay
+void avsync_audio_update(avsync_t *s, int64_t frames_written, long delay_frames, uint64_t t_ns);
+
+// Any other master: show position pos_ns was reached at t_ns
+void avsync_reference_update(avsync_t *s, int64_t pos_ns, uint64_t t_ns);
+
+// "slew", "pause" or "skip", -1 for anything else
+int avsync_gap_policy_parse(const char *name);
+const char *avsync_gap_policy_name(int policy);
+
+// Audio thread, after an xrun: how long the device has been silent,
+// assuming it played everything queued at the last update
+int64_t avsync_audio_gap_ns(const avsync_t *s, uint64_t now);
+// Audio thread: an xrun was recovered and the position published with
+// avsync_audio_update is where playback resumes (moved on by the gap
+// for the skip policy)
+void avsync_audio_gap(avsync_t *s);
+
+// Audio thread: playback was moved or paused/resumed, and the position
+// published with avsync_audio_update is where it now stands
+void avsync_audio_jump(avsync_t *s, int paused);
+
+// Audio thread: all audio has been queued, stop bounding extrapolation
+void avsync_audio_finished(avsync_t *s);
+
+// Playback position derived from the audio device, extrapolated to now.
+// Returns 0, or -1 while audio has not started yet.
+int avsync_audio_position_ns(avsync_t *s, uint64_t now, int64_t *pos_ns);
+
+// LED thread: steer the LED timeline and return its show position at now
+// (-1 while audio has not started). Call once per LED wakeup.
+int64_t avsync_led_position_ns(avsync_t *s, uint64_t now);
+
+// CLOCK_MONOTONIC time at which the LED timeline reaches show_ns
+uint64_t avsync_led_deadline_ns(const avsync_t *s, int64_t show_ns);
+
+#endif
@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+#include "bam.h"
+#include "rt.h"
+#include "timeutil.h"
+
+static const uint32_t dark[BAM_BITS * GPIO_MAX_BANKS];
+
+int bam_mode_parse(const char *name) {
+    if (strcmp(name, "sleep") == 0) return BAM_MODE_SLEEP;
+    if (strcmp(name, "spin") == 0) return BAM_MODE_SPIN;
+    if (strcmp(name, "timerfd") == 0) return BAM_MODE_TIMERFD;
+    return -1;
+}
+
+void bam_map(const gpio_backend_t *b, const uint8_t *levels, int channels, uint32_t *planes) {
+    uint32_t bits[GPIO_WORDS(GPIO_MAX_LINES)];
+    for (int p = 0; p < BAM_BITS; ++p) {
+        memset(bits, 0, sizeof(bits));
+        for (int i = 0; i < channels && i < GPIO_MAX_LINES; ++i)
+            if ((levels[i] >> p) & 1)
+                bits[i / 32] |= 1u << (i % 32);
+        gpio_map(b, bits, channels, planes + p * b->num_banks);
+    }
+}
+
+static void wait_slot(bam_t *m, uint64_t deadline) {
+    if (m->mode == BAM_MODE_TIMERFD) {
+        struct itimerspec its = {.it_value = ns_to_timespec(deadline)};
+        uint64_t expirations;
+        if (timerfd_settime(m->timer_fd, TFD_TIMER_ABSTIME, &its, NULL) == 0 &&
+            read(m->timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+            return;
+        // Timer trouble, fall through to a plain sleep
+    } else if (m->mode == BAM_MODE_SPIN) {
+        if (deadline > BAM_SPIN_NS && now_ns() < deadline - BAM_SPIN_NS)
+            sleep_until_ns(deadline - BAM_SPIN_NS);
+        while (now_ns() < deadline)
+            ;
+        return;
+    }
+    sleep_until_ns(deadline);
+}
+
+// Worst error over all levels for one cycle: a level picks any subset of
+// planes, so the worst case sums all positive or all negative deviations.
+static int64_t cycle_error_ppb(const uint64_t *slot, uint64_t cycle_end) {
+    double period = (double)(cycle_end - slot[0]);
+    double over = 0, under = 0;
+    for (int p = 0; p < BAM_BITS; ++p) {
+        uint64_t end = p + 1 < BAM_BITS ? slot[p + 1] : cycle_end;
+        double delta = (end - slot[p]) / period - (double)(1u << p) / 255.0;
+        if (delta > 0) over += delta;
+        else under -= delta;
+    }
+    return (int64_t)((over > under ? over : under) * 1e9);
+}
+
+static void *bam_thread(void *arg) {
+    bam_t *m = arg;
+    gpio_backend_t *gpio = m->gpio;
+    uint64_t cycle_ns = m->unit_ns * ((1u << BAM_BITS) - 1);
+    uint64_t slot[BAM_BITS];
+    struct timespec cpu0, cpu1;
+
+    rt_thread_enter("bam");
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu0);
+    uint64_t next = m->start_ns = now_ns();
+    int have_cycle = 0;
+
+    while (!atomic_load_explicit(&m->stop, memory_order_relaxed)) {
+        for (int p = 0; p < BAM_BITS; ++p) {
+            wait_slot(m, next);
+            uint64_t t = now_ns();
+            if (p == 0) {
+                if (have_cycle)
+                    lhist_record(&m->error, cycle_error_ppb(slot, t));
+                have_cycle = 1;
+                m->cycles++;
+            }
+            lhist_record(&m->lateness, (int64_t)(t - next));
+            slot[p] = t;
+
+            const uint32_t *planes = atomic_load(&m->planes);
+            gpio_write_image(gpio, (planes ? planes : dark) + p * gpio->num_banks);
+            atomic_fetch_add(&m->slots, 1);
+            next += m->unit_ns << p;
+        }
+
+        // More than a cycle behind: restart the schedule instead of bursting
+        uint64_t now = now_ns();
+        if (now > next + cycle_ns) {
+            next = now;
+            have_cycle = 0;
+            m->overruns++;
+        }
+    }
+
+    m->end_ns = now_ns();
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu1);
+    m->cpu_ns = timespec_to_ns(cpu1) - timespec_to_ns(cpu0);
+    gpio_write_image(gpio, dark);
+    atomic_store(&m->exited, 1);
+    rt_thread_exit();
+    return NULL;
+}
+
+void bam_quiescent(bam_t *m) {
+    // A slot that read the old planes ends with an increment seen here
+    unsigned slots = atomic_load(&m->slots);
+    while (!atomic_load(&m->exited) && atomic_load(&m->slots) == slots)
+        sleep_until_ns(now_ns() + m->unit_ns);
+}
+
+int bam_start(bam_t *m, gpio_backend_t *gpio, const uint32_t *planes,
+              uint64_t unit_ns, int mode, int priority) {
+    memset(m, 0, sizeof(*m));
+    m->gpio = gpio;
+    m->unit_ns = unit_ns ? unit_ns : BAM_DEFAULT_UNIT_US * 1000ull;
+    m->mode = mode;
+    m->timer_fd = -1;
+    atomic_init(&m->planes, planes);
+    atomic_init(&m->slots, 0);
+    atomic_init(&m->exited, 0);
+    lhist_init(&m->lateness, "bam_slot");
+    lhist_init(&m->error, "bam_error");
+
+    if (mode == BAM_MODE_TIMERFD) {
+        m->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+        if (m->timer_fd < 0) {
+            perror("bam: timerfd_create");
+            return -1;
+        }
+    }
+
+    int err = rt_thread_create(&m->thread, priority, -1, bam_thread, m);
+    if (err != 0) {
+        fprintf(stderr, "bam: pthread_create: %s\n", strerror(err));
+        atomic_store(&m->exited, 1);
+        if (m->timer_fd >= 0)
+            close(m->timer_fd);
+        return -1;
+    }
+    m->running = 1;
+    return 0;
+}
+
+void bam_stop(bam_t *m) {
+    if (!m->running)
+        return;
+    atomic_store(&m->stop, 1);
+    pthread_join(m->thread, NULL);
+    if (m->timer_fd >= 0)
+        close(m->timer_fd);
+    m->timer_fd = -1;
+    m->running = 0;
+}
+
+void bam_report(const bam_t *m, FILE *f) {
+    static const char *modes[] = {"sleep", "spin", "timerfd"};
+    double secs = (m->end_ns - m->start_ns) / 1e9;
+    if (secs <= 0)
+        return;
+    fprintf(f, "BAM (%s, %.1f us unit): %.1f Hz refresh (nominal %.1f), CPU %.1f%%, %llu overruns\n",
+            modes[m->mode], m->unit_ns / 1e3, m->cycles / secs,
+            1e9 / (m->unit_ns * ((1u << BAM_BITS) - 1)), 100.0 * m->cpu_ns / (m->end_ns - m->start_ns),
+            (unsigned long long)m->overruns);
+    lhist_print_header(f);
+    lhist_print(f, &m->lateness);
+    // Error histogram holds ppb, print ppm and 8-bit levels
+    fprintf(f, "Brightness error per cycle: p50 %.0f ppm, p99 %.0f ppm, max %.0f ppm (%.2f levels)\n",
+            lhist_percentile(&m->error, 50) / 1e3, lhist_percentile(&m->error, 99) / 1e3,
+            m->error.max / 1e3, m->error.max * 255 / 1e9);
+}
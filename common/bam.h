@@ -0,0 +1,77 @@
+#ifndef BAM_H
+#define BAM_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "gpio.h"
+#include "latency_hist.h"
+
+// Software brightness by bit-angle modulation. A level 0-255 is split
+// into its 8 bits; plane b holds bit b of every channel and is shown for
+// 2^b time units, so one cycle of 255 units lights each channel for
+// level/255 of the time. The planes of a frame are mapped to bank images
+// once (bam_map), and the thread only does one gpio_write_image per plane,
+// 8 writes per cycle whatever the channel count.
+//
+// With the default 10 µs unit a cycle is 2.55 ms (392 Hz). Timing errors
+// of the short planes show up directly as brightness errors of the low
+// levels, which is what bam_report measures: for every cycle the actual
+// plane durations give the worst error over all 256 levels, in ppm of
+// full scale (3922 ppm = one level).
+
+#define BAM_BITS             8
+#define BAM_DEFAULT_UNIT_US  10
+#define BAM_SPIN_NS          50000   // spin mode: busy-wait the last 50 µs
+#define BAM_PRIORITY         85      // above the LED sequencer (80)
+
+enum { BAM_MODE_SLEEP, BAM_MODE_SPIN, BAM_MODE_TIMERFD };
+
+typedef struct {
+    gpio_backend_t *gpio;
+    uint64_t unit_ns;
+    int mode;
+    _Atomic(const uint32_t *) planes;   // BAM_BITS images of num_banks words
+    atomic_uint slots;          // plane writes finished, for bam_quiescent
+    atomic_int exited;
+    atomic_int stop;
+    pthread_t thread;
+    int running;
+    int timer_fd;
+
+    // Statistics, valid after bam_stop
+    uint64_t cycles, overruns;
+    uint64_t start_ns, end_ns, cpu_ns;
+    lhist_t lateness;           // plane write vs its slot start
+    lhist_t error;              // per cycle worst brightness error, ppb
+} bam_t;
+
+// Mode names "sleep", "spin", "timerfd"; -1 if unknown
+int bam_mode_parse(const char *name);
+
+// Levels of the given channels -> BAM_BITS bank images. planes must hold
+// BAM_BITS * num_banks words; do it at load time.
+void bam_map(const gpio_backend_t *b, const uint8_t *levels, int channels, uint32_t *planes);
+
+// Start the modulation thread on planes (may be NULL = all off). The
+// thread owns the GPIO until bam_stop. priority 0 = normal scheduling.
+int bam_start(bam_t *m, gpio_backend_t *gpio, const uint32_t *planes,
+              uint64_t unit_ns, int mode, int priority);
+
+// Switch frames; the new planes are used from the next slot on
+static inline void bam_set_frame(bam_t *m, const uint32_t *planes) {
+    atomic_store(&m->planes, planes);
+}
+
+// Grace period before freeing planes that bam_set_frame has replaced:
+// the thread may have loaded the old pointer just before the switch and
+// still be writing from it. Returns once that slot is over (or the thread
+// has ended). Never call it from the thread that switches frames.
+void bam_quiescent(bam_t *m);
+
+void bam_stop(bam_t *m);
+void bam_report(const bam_t *m, FILE *f);
+
+#endif
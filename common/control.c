@@ -0,0 +1,225 @@
+#define _GNU_SOURCE
+#include <libgen.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "control.h"
+#include "timeutil.h"
+
+int control_open(control_t *c, const char *sock_path, control_command_fn command,
+                 control_change_fn change, void *ctx) {
+    memset(c, 0, sizeof(*c));
+    c->listen_fd = c->inotify_fd = -1;
+    for (int i = 0; i < CONTROL_MAX_CLIENTS; ++i)
+        c->client[i].fd = -1;
+    c->command = command;
+    c->change = change;
+    c->ctx = ctx;
+    atomic_init(&c->stop, 0);
+    if (!sock_path)
+        return 0;
+
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(sock_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "control: socket path too long: %s\n", sock_path);
+        return -1;
+    }
+    strcpy(addr.sun_path, sock_path);
+    c->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (c->listen_fd < 0) {
+        perror("control: socket");
+        return -1;
+    }
+    // A socket left behind by an earlier run would make bind fail
+    unlink(sock_path);
+    if (bind(c->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(c->listen_fd, 4) < 0) {
+        perror(sock_path);
+        close(c->listen_fd);
+        c->listen_fd = -1;
+        return -1;
+    }
+    strcpy(c->sock_path, sock_path);
+    return 0;
+}
+
+int control_watch(control_t *c, const char *path) {
+    for (int i = 0; i < c->watches; ++i)
+        if (strcmp(c->watch_path[i], path) == 0)
+            return 0;
+    if (c->watches == CONTROL_MAX_WATCHES) {
+        fprintf(stderr, "control: more than %d watched files\n", CONTROL_MAX_WATCHES);
+        return -1;
+    }
+    if (c->inotify_fd < 0 && (c->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0) {
+        perror("control: inotify");
+        return -1;
+    }
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", path);
+    int wd = inotify_add_watch(c->inotify_fd, dirname(dir), IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (wd < 0) {
+        perror(path);
+        return -1;
+    }
+    c->watch_wd[c->watches] = wd;
+    c->watch_path[c->watches++] = strdup(path);
+    return 0;
+}
+
+static void run_command(control_t *c, control_client_t *cl, char *line) {
+    char reply[CONTROL_LINE_MAX];
+    uint64_t t0 = now_ns();
+    reply[0] = '\0';
+    c->command(c->ctx, line, reply, sizeof(reply) - 1);
+    uint64_t dt = now_ns() - t0;
+    if (dt > c->max_command_ns)
+        c->max_command_ns = dt;
+    c->commands++;
+
+    size_t n = strlen(reply);
+    reply[n++] = '\n';
+    if (send(cl->fd, reply, n, MSG_NOSIGNAL) < 0) {
+        close(cl->fd);
+        cl->fd = -1;
+    }
+}
+
+static void read_client(control_t *c, control_client_t *cl) {
+    ssize_t n = recv(cl->fd, cl->buf + cl->used, sizeof(cl->buf) - 1 - cl->used, 0);
+    if (n <= 0) {
+        close(cl->fd);
+        cl->fd = -1;
+        return;
+    }
+    cl->used += n;
+    cl->buf[cl->used] = '\0';
+    char *line = cl->buf, *nl;
+    while (cl->fd >= 0 && (nl = strchr(line, '\n'))) {
+        *nl = '\0';
+        if (nl > line && nl[-1] == '\r')
+            nl[-1] = '\0';
+        run_command(c, cl, line);
+        line = nl + 1;
+    }
+    cl->used -= line - cl->buf;
+    memmove(cl->buf, line, cl->used);
+    if (cl->used == sizeof(cl->buf) - 1) {
+        fprintf(stderr, "control: command longer than %d bytes, client dropped\n", CONTROL_LINE_MAX);
+        close(cl->fd);
+        cl->fd = -1;
+        cl->used = 0;
+    }
+}
+
+static void accept_client(control_t *c) {
+    int fd = accept4(c->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd < 0)
+        return;
+    for (int i = 0; i < CONTROL_MAX_CLIENTS; ++i)
+        if (c->client[i].fd < 0) {
+            c->client[i].fd = fd;
+            c->client[i].used = 0;
+            return;
+        }
+    static const char busy[] = "error too many clients\n";
+    send(fd, busy, sizeof(busy) - 1, MSG_NOSIGNAL);
+    close(fd);
+}
+
+static void read_changes(control_t *c) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t n;
+    while ((n = read(c->inotify_fd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + n; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len) {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            if (!ev->len)
+                continue;
+            for (int i = 0; i < c->watches; ++i) {
+                const char *base = strrchr(c->watch_path[i], '/');
+                base = base ? base + 1 : c->watch_path[i];
+                if (ev->wd == c->watch_wd[i] && strcmp(ev->name, base) == 0) {
+                    c->changes++;
+                    c->change(c->ctx, c->watch_path[i]);
+                }
+            }
+        }
+    }
+}
+
+static void *control_fn(void *arg) {
+    control_t *c = arg;
+    while (!atomic_load_explicit(&c->stop, memory_order_relaxed)) {
+        struct pollfd fds[CONTROL_MAX_CLIENTS + 2];
+        control_client_t *owner[CONTROL_MAX_CLIENTS + 2];
+        int nfds = 0;
+        if (c->listen_fd >= 0) {
+            owner[nfds] = NULL;
+            fds[nfds++] = (struct pollfd){.fd = c->listen_fd, .events = POLLIN};
+        }
+        if (c->inotify_fd >= 0) {
+            owner[nfds] = NULL;
+            fds[nfds++] = (struct pollfd){.fd = c->inotify_fd, .events = POLLIN};
+        }
+        for (int i = 0; i < CONTROL_MAX_CLIENTS; ++i)
+            if (c->client[i].fd >= 0) {
+                owner[nfds] = &c->client[i];
+                fds[nfds++] = (struct pollfd){.fd = c->client[i].fd, .events = POLLIN};
+            }
+        if (poll(fds, nfds, CONTROL_POLL_MS) <= 0)
+            continue;
+
+        for (int i = 0; i < nfds; ++i) {
+            if (!fds[i].revents)
+                continue;
+            if (owner[i])
+                read_client(c, owner[i]);
+            else if (fds[i].fd == c->listen_fd)
+                accept_client(c);
+            else
+                read_changes(c);
+        }
+    }
+    return NULL;
+}
+
+int control_start(control_t *c) {
+    if (pthread_create(&c->thread, NULL, control_fn, c) != 0) {
+        perror("control thread");
+        return -1;
+    }
+    c->running = 1;
+    return 0;
+}
+
+void control_stop(control_t *c) {
+    if (c->running) {
+        atomic_store(&c->stop, 1);
+        pthread_join(c->thread, NULL);
+        c->running = 0;
+    }
+    for (int i = 0; i < CONTROL_MAX_CLIENTS; ++i)
+        if (c->client[i].fd >= 0)
+            close(c->client[i].fd);
+    if (c->listen_fd >= 0) {
+        close(c->listen_fd);
+        unlink(c->sock_path);
+    }
+    if (c->inotify_fd >= 0)
+        close(c->inotify_fd);
+    for (int i = 0; i < c->watches; ++i)
+        free(c->watch_path[i]);
+    c->listen_fd = c->inotify_fd = -1;
+    c->watches = 0;
+}
+
+void control_report(const control_t *c, FILE *f) {
+    fprintf(f, "control: %lu commands (slowest %.2f ms), %lu file changes\n",
+            c->commands, c->max_command_ns / 1e6, c->changes);
+}
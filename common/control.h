@@ -0,0 +1,66 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Live control of a running show from outside the process. A normal
+// priority thread serves a Unix stream socket, one command per line and
+// one reply line per command, and watches files with inotify. Both end
+// up in the owner's callbacks on that thread, so a handler may block
+// (load a show, wait out a grace period) without the RT threads noticing;
+// what it changes must reach them through atomics.
+//
+//   $ printf 'pos\n' | socat - UNIX-CONNECT:/tmp/led_show.sock
+
+#define CONTROL_DEFAULT_SOCKET "/tmp/led_show.sock"
+#define CONTROL_MAX_CLIENTS 8
+#define CONTROL_MAX_WATCHES 16
+#define CONTROL_LINE_MAX    512
+#define CONTROL_POLL_MS     100     // how often the thread checks for stop
+
+// Handle one command line (no newline). Write a one-line reply.
+typedef void (*control_command_fn)(void *ctx, char *line, char *reply, size_t len);
+// A watched file was rewritten (closed after writing or renamed over)
+typedef void (*control_change_fn)(void *ctx, const char *path);
+
+typedef struct {
+    int fd;
+    size_t used;
+    char buf[CONTROL_LINE_MAX];
+} control_client_t;
+
+typedef struct {
+    int listen_fd;              // -1 without a socket
+    char sock_path[108];
+    control_client_t client[CONTROL_MAX_CLIENTS];
+    int inotify_fd;             // -1 until something is watched
+    int watch_wd[CONTROL_MAX_WATCHES];
+    char *watch_path[CONTROL_MAX_WATCHES];
+    int watches;
+
+    control_command_fn command;
+    control_change_fn change;
+    void *ctx;
+    atomic_int stop;
+    pthread_t thread;
+    int running;
+
+    // Statistics, control thread only
+    unsigned long commands, changes;
+    uint64_t max_command_ns;
+} control_t;
+
+// Listen on sock_path (NULL: file watches only)
+int control_open(control_t *c, const char *sock_path, control_command_fn command,
+                 control_change_fn change, void *ctx);
+// Report changes to path; its directory is watched so editors that
+// replace the file are seen too
+int control_watch(control_t *c, const char *path);
+int control_start(control_t *c);
+void control_stop(control_t *c);
+void control_report(const control_t *c, FILE *f);
+
+#endif
@@ -0,0 +1,440 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "effect.h"
+
+#define EFFECT_MAX_ARGS     6
+#define RECORD_SIZE         16    // t_us and one word of bits, 8-byte aligned
+
+static effect_t *new_effect(int kind) {
+    effect_t *e = calloc(1, sizeof(*e));
+    if (!e)
+        perror("effect");
+    else
+        e->kind = kind;
+    return e;
+}
+
+static int check_leds(const char *name, int leds, uint64_t step_us) {
+    if (leds < 1 || leds > EFFECT_MAX_LEDS || step_us == 0) {
+        fprintf(stderr, "effect: %s needs 1-%d LEDs and a step above 0\n", name, EFFECT_MAX_LEDS);
+        return -1;
+    }
+    return 0;
+}
+
+effect_t *effect_const(uint32_t mask) {
+    effect_t *e = new_effect(EFFECT_CONST);
+    if (e)
+        e->mask = mask;
+    return e;
+}
+
+effect_t *effect_blink(uint32_t mask, uint64_t on_us, uint64_t off_us) {
+    if (on_us == 0) {
+        fprintf(stderr, "effect: blink needs an on time above 0\n");
+        return NULL;
+    }
+    effect_t *e = new_effect(EFFECT_BLINK);
+    if (e) {
+        e->mask = mask;
+        e->step_us = on_us;
+        e->off_us = off_us;
+    }
+    return e;
+}
+
+effect_t *effect_chase(int leds, uint64_t step_us, int width, int dark) {
+    if (check_leds("chase", leds, step_us) < 0 || width < 1 || width > leds || dark < 0)
+        return NULL;
+    effect_t *e = new_effect(EFFECT_CHASE);
+    if (e) {
+        e->leds = leds;
+        e->step_us = step_us;
+        e->width = width;
+        e->dark = dark;
+    }
+    return e;
+}
+
+effect_t *effect_bounce(int leds, uint64_t step_us, int width) {
+    if (check_leds("bounce", leds, step_us) < 0 || width < 1 || width > leds)
+        return NULL;
+    effect_t *e = new_effect(EFFECT_BOUNCE);
+    if (e) {
+        e->leds = leds;
+        e->step_us = step_us;
+        e->width = width;
+    }
+    return e;
+}
+
+effect_t *effect_sparkle(int leds, uint64_t step_us, uint32_t percent, uint32_t seed) {
+    if (check_leds("sparkle", leds, step_us) < 0)
+        return NULL;
+    effect_t *e = new_effect(EFFECT_SPARKLE);
+    if (e) {
+        e->leds = leds;
+        e->step_us = step_us;
+        e->percent = percent;
+        e->seed = seed;
+    }
+    return e;
+}
+
+effect_t *effect_rotate(uint32_t pattern, int leds, uint64_t step_us, int dir) {
+    if (check_leds("rotate", leds, step_us) < 0)
+        return NULL;
+    effect_t *e = new_effect(EFFECT_ROTATE);
+    if (e) {
+        e->mask = pattern;
+        e->leds = leds;
+        e->step_us = step_us;
+        e->dir = dir;
+    }
+    return e;
+}
+
+effect_t *effect_layer(int op, effect_t *a, effect_t *b) {
+    effect_t *e = a && b ? new_effect(op) : NULL;
+    if (!e) {
+        effect_free(a);
+        effect_free(b);
+        return NULL;
+    }
+    e->a = a;
+    e->b = b;
+    return e;
+}
+
+void effect_free(effect_t *e) {
+    if (!e)
+        return;
+    effect_free(e->a);
+    effect_free(e->b);
+    free(e);
+}
+
+// Lowest width bits set
+static inline uint32_t run_bits(int width) {
+    return width >= 32 ? 0xFFFFFFFFu : (1u << width) - 1;
+}
+
+// Stateless per-step randomness, so sparkle can be evaluated at any time
+static inline uint64_t mix64(uint64_t x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+uint32_t effect_eval(const effect_t *e, uint64_t t_us) {
+    uint64_t step = e->step_us ? t_us / e->step_us : 0;
+    switch (e->kind) {
+    case EFFECT_CONST:
+        return e->mask;
+    case EFFECT_BLINK:
+        return t_us % (e->step_us + e->off_us) < e->step_us ? e->mask : 0;
+    case EFFECT_CHASE: {
+        // The head enters at LED 0 and moves up until the tail has left
+        uint64_t k = step % (e->leds + e->width - 1 + e->dark);
+        if (k >= (uint64_t)(e->leds + e->width - 1))
+            return 0;
+        return (uint32_t)(((uint64_t)run_bits(e->width) << k) >> (e->width - 1)) & run_bits(e->leds);
+    }
+    case EFFECT_BOUNCE: {
+        uint64_t span = e->leds - e->width, period = span ? 2 * span : 1;
+        uint64_t k = step % period;
+        return run_bits(e->width) << (k <= span ? k : period - k);
+    }
+    case EFFECT_SPARKLE: {
+        uint32_t bits = 0;
+        for (int c = 0; c < e->leds; ++c)
+            if (mix64(step * 0x9e3779b97f4a7c15ull ^ ((uint64_t)e->seed << 32 | c)) % 100 < e->percent)
+                bits |= 1u << c;
+        return bits;
+    }
+    case EFFECT_ROTATE: {
+        uint64_t p = e->mask & run_bits(e->leds);
+        int n = step % e->leds;
+        if (e->dir < 0 && n)
+            n = e->leds - n;
+        return n ? (uint32_t)((p << n | p >> (e->leds - n)) & run_bits(e->leds)) : (uint32_t)p;
+    }
+    case EFFECT_OR:   return effect_eval(e->a, t_us) | effect_eval(e->b, t_us);
+    case EFFECT_AND:  return effect_eval(e->a, t_us) & effect_eval(e->b, t_us);
+    case EFFECT_XOR:  return effect_eval(e->a, t_us) ^ effect_eval(e->b, t_us);
+    case EFFECT_MASK: return effect_eval(e->a, t_us) & ~effect_eval(e->b, t_us);
+    }
+    return 0;
+}
+
+uint64_t effect_next_change(const effect_t *e, uint64_t t_us) {
+    switch (e->kind) {
+    case EFFECT_CONST:
+        return UINT64_MAX;
+    case EFFECT_BLINK: {
+        if (!e->off_us)
+            return UINT64_MAX;
+        uint64_t phase = t_us % (e->step_us + e->off_us);
+        return t_us - phase + (phase < e->step_us ? e->step_us : e->step_us + e->off_us);
+    }
+    case EFFECT_CHASE:
+    case EFFECT_BOUNCE:
+    case EFFECT_SPARKLE:
+    case EFFECT_ROTATE:
+        return (t_us / e->step_us + 1) * e->step_us;
+    }
+    uint64_t a = effect_next_change(e->a, t_us), b = effect_next_change(e->b, t_us);
+    return a < b ? a : b;
+}
+
+int effect_channels(const effect_t *e) {
+    switch (e->kind) {
+    case EFFECT_CONST:
+    case EFFECT_BLINK:
+        return e->mask ? 32 - __builtin_clz(e->mask) : 1;
+    case EFFECT_CHASE:
+    case EFFECT_BOUNCE:
+    case EFFECT_SPARKLE:
+    case EFFECT_ROTATE:
+        return e->leds;
+    }
+    int a = effect_channels(e->a), b = effect_channels(e->b);
+    return a > b ? a : b;
+}
+
+// Text form: name(arg, ...) or a bare number
+
+static const struct {
+    const char *name;
+    int kind, min_args, max_args;
+} effect_names[] = {
+    {"blink", EFFECT_BLINK, 2, 3},
+    {"chase", EFFECT_CHASE, 2, 4},
+    {"bounce", EFFECT_BOUNCE, 2, 3},
+    {"sparkle", EFFECT_SPARKLE, 2, 4},
+    {"rotate", EFFECT_ROTATE, 3, 4},
+    {"or", EFFECT_OR, 2, 0},
+    {"and", EFFECT_AND, 2, 0},
+    {"xor", EFFECT_XOR, 2, 0},
+    {"mask", EFFECT_MASK, 2, 2},
+};
+
+static const char *skip_space(const char *p) {
+    while (isspace((unsigned char)*p)) p++;
+    return p;
+}
+
+static effect_t *parse_effect(const char **pp);
+
+// Layer operands, folded from the left: or(a, b, c) = or(or(a, b), c)
+static effect_t *parse_layer(const char **pp, int kind, const char *name, int max_args) {
+    effect_t *e = NULL;
+    int n = 0;
+    for (;;) {
+        effect_t *operand = parse_effect(pp);
+        if (!operand) {
+            effect_free(e);
+            return NULL;
+        }
+        e = n++ ? effect_layer(kind, e, operand) : operand;
+        if (!e)
+            return NULL;
+        *pp = skip_space(*pp);
+        if (**pp != ',')
+            break;
+        (*pp)++;
+    }
+    if (n < 2 || (max_args && n > max_args)) {
+        fprintf(stderr, "effect: %s takes %s%d operands\n", name, max_args ? "" : "at least ", max_args ? max_args : 2);
+        effect_free(e);
+        return NULL;
+    }
+    return e;
+}
+
+static effect_t *parse_generator(const char **pp, int kind, const char *name, int min_args, int max_args) {
+    double arg[EFFECT_MAX_ARGS];
+    int n = 0;
+    for (;;) {
+        char *end;
+        const char *p = skip_space(*pp);
+        if (n == max_args) {
+            fprintf(stderr, "effect: %s takes at most %d arguments\n", name, max_args);
+            return NULL;
+        }
+        arg[n] = strtod(p, &end);
+        if (end == p) {
+            fprintf(stderr, "effect: %s: expected a number at \"%s\"\n", name, p);
+            return NULL;
+        }
+        n++;
+        *pp = skip_space(end);
+        if (**pp != ',')
+            break;
+        (*pp)++;
+    }
+    if (n < min_args) {
+        fprintf(stderr, "effect: %s takes at least %d arguments\n", name, min_args);
+        return NULL;
+    }
+
+    switch (kind) {
+    case EFFECT_BLINK:
+        return effect_blink((uint32_t)arg[0], arg[1] * 1000, (n > 2 ? arg[2] : arg[1]) * 1000);
+    case EFFECT_CHASE:
+        return effect_chase(arg[0], arg[1] * 1000, n > 2 ? arg[2] : 1, n > 3 ? arg[3] : 0);
+    case EFFECT_BOUNCE:
+        return effect_bounce(arg[0], arg[1] * 1000, n > 2 ? arg[2] : 1);
+    case EFFECT_SPARKLE:
+        return effect_sparkle(arg[0], arg[1] * 1000, n > 2 ? arg[2] : 30, n > 3 ? arg[3] : 1);
+    case EFFECT_ROTATE:
+        return effect_rotate((uint32_t)arg[0], arg[1], arg[2] * 1000, n > 3 ? arg[3] : 1);
+    }
+    return NULL;
+}
+
+static effect_t *parse_effect(const char **pp) {
+    const char *p = skip_space(*pp);
+    if (isdigit((unsigned char)*p)) {
+        char *end;
+        unsigned long mask = strtoul(p, &end, 0);
+        *pp = end;
+        return effect_const((uint32_t)mask);
+    }
+
+    const char *name = p;
+    while (isalpha((unsigned char)*p)) p++;
+    size_t len = p - name;
+    p = skip_space(p);
+    for (size_t i = 0; i < sizeof(effect_names) / sizeof(effect_names[0]); ++i) {
+        if (strlen(effect_names[i].name) != len || strncmp(effect_names[i].name, name, len) != 0)
+            continue;
+        if (*p != '(') {
+            fprintf(stderr, "effect: expected '(' after %s\n", effect_names[i].name);
+            return NULL;
+        }
+        p++;
+        effect_t *e = effect_names[i].kind >= EFFECT_OR
+                          ? parse_layer(&p, effect_names[i].kind, effect_names[i].name, effect_names[i].max_args)
+                          : parse_generator(&p, effect_names[i].kind, effect_names[i].name,
+                                            effect_names[i].min_args, effect_names[i].max_args);
+        if (!e)
+            return NULL;
+        if (*p != ')') {
+            fprintf(stderr, "effect: expected ')' at \"%s\"\n", p);
+            effect_free(e);
+            return NULL;
+        }
+        *pp = p + 1;
+        return e;
+    }
+    fprintf(stderr, "effect: unknown effect at \"%s\"\n", name);
+    return NULL;
+}
+
+effect_t *effect_parse(const char *spec) {
+    const char *p = spec;
+    effect_t *e = parse_effect(&p);
+    if (e && *skip_space(p)) {
+        fprintf(stderr, "effect: trailing text \"%s\"\n", skip_space(p));
+        effect_free(e);
+        return NULL;
+    }
+    return e;
+}
+
+int effect_stream_init(effect_stream_t *s, const effect_t *fx, uint64_t start_us, uint64_t end_us) {
+    memset(s, 0, sizeof(*s));
+    s->fx = fx;
+    s->t_us = start_us;
+    s->end_us = end_us;
+
+    // The window is laid out like an in-memory show so players read it
+    // with show_record
+    size_t len = sizeof(show_header_t) + (size_t)EFFECT_LOOKAHEAD * RECORD_SIZE;
+    show_header_t *hdr = calloc(1, len);
+    if (!hdr) {
+        perror("effect stream");
+        return -1;
+    }
+    memcpy(hdr->magic, SHOW_MAGIC, sizeof(SHOW_MAGIC));
+    hdr->version = SHOW_VERSION;
+    hdr->header_size = sizeof(show_header_t);
+    hdr->record_size = RECORD_SIZE;
+    hdr->channels = effect_channels(fx);
+    s->window.hdr = hdr;
+    s->window.records = (const uint8_t *)hdr + hdr->header_size;
+    s->window.channels = hdr->channels;
+    s->window.record_size = RECORD_SIZE;
+    s->window.map_len = len;
+    s->window.owned = 1;
+    return 0;
+}
+
+uint32_t effect_stream_fill(effect_stream_t *s) {
+    uint8_t *rec = (uint8_t *)s->window.records;
+    uint32_t n = 0;
+    while (n < EFFECT_LOOKAHEAD && s->t_us != UINT64_MAX && (!s->end_us || s->t_us < s->end_us)) {
+        uint64_t t = s->t_us;
+        uint32_t bits = effect_eval(s->fx, t);
+        uint64_t next = effect_next_change(s->fx, t);
+        // Steps where no visible LED changes are part of this frame
+        for (int m = 0; m < EFFECT_MAX_MERGE && next != UINT64_MAX && (!s->end_us || next < s->end_us) &&
+                        effect_eval(s->fx, next) == bits; ++m)
+            next = effect_next_change(s->fx, next);
+        if (s->end_us && next > s->end_us)
+            next = s->end_us;
+
+        memcpy(rec, &t, sizeof(t));
+        memcpy(rec + 8, &bits, sizeof(bits));
+        rec += RECORD_SIZE;
+        s->t_us = next;
+        n++;
+    }
+    s->window.frame_count = n;
+    s->window.duration_us = s->t_us;
+    return n;
+}
+
+void effect_stream_free(effect_stream_t *s) {
+    show_close(&s->window);
+}
+
+long effect_compile(const effect_t *fx, uint64_t duration_us, const char *path) {
+    effect_stream_t s;
+    if (duration_us == 0) {
+        fprintf(stderr, "effect: a compiled show needs a duration above 0\n");
+        return -1;
+    }
+    if (effect_stream_init(&s, fx, 0, duration_us) < 0)
+        return -1;
+    show_writer_t *w = show_writer_open(path, s.window.channels, 0);
+    if (!w) {
+        effect_stream_free(&s);
+        return -1;
+    }
+    long frames = 0;
+    uint32_t n;
+    while ((n = effect_stream_fill(&s))) {
+        for (uint32_t i = 0; i < n; ++i) {
+            const show_record_t *r = show_record(&s.window, i);
+            if (show_writer_add(w, r->t_us, r->bits, NULL) < 0) {
+                show_writer_close(w, duration_us);
+                effect_stream_free(&s);
+                return -1;
+            }
+        }
+        frames += n;
+    }
+    effect_stream_free(&s);
+    if (show_writer_close(w, duration_us) < 0) {
+        perror(path);
+        return -1;
+    }
+    return frames;
+}
@@ -0,0 +1,122 @@
+#ifndef EFFECT_H
+#define EFFECT_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "gpio.h"
+#include "show.h"
+#include "timeutil.h"
+
+// Procedural effects for up to 32 LEDs. An effect is a tree of generators
+// combined with bitwise layers; effect_eval gives the frame at any time
+// in µs without state, so a stream can start anywhere. A stream evaluates
+// the tree into show records a window at a time (EFFECT_LOOKAHEAD frames,
+// the next window is generated while the last frame of the current one
+// is on), and effect_play walks them with the same absolute deadlines and
+// single bulk write per frame as a compiled show. show_compile -e writes
+// the same records to a .show file instead.
+//
+// Text form, times in ms (fractions allowed), masks in any C base:
+//
+//   blink(mask, on[, off])             mask on for on ms, off for off (= on)
+//   chase(leds, step[, width[, dark]]) a run of width LEDs moving up from
+//                                      LED 0, then dark empty steps
+//   bounce(leds, step[, width])        a run going up and back down
+//   sparkle(leds, step[, percent[, seed]])  each LED lit with percent
+//                                      chance per step (default 30)
+//   rotate(pattern, leds, step[, dir]) pattern rotated one LED per step,
+//                                      upwards, downwards for dir < 0
+//   or(a, b, ...)  and(a, b, ...)  xor(a, b, ...)
+//   mask(a, b)                         a with the LEDs lit in b cut out
+//
+// A bare number is a constant frame:  and(chase(8, 70), 0x0f)
+//                                     xor(blink(0xff, 500), bounce(8, 60, 2))
+
+#define EFFECT_LOOKAHEAD  64    // frames generated at a time
+#define EFFECT_MAX_MERGE  4096  // unchanged steps folded into one frame
+#define EFFECT_MAX_LEDS   32
+#define EFFECT_HOLD_POLL_MS 100 // a frame that never changes: how often to check stop
+
+enum {
+    EFFECT_CONST, EFFECT_BLINK, EFFECT_CHASE, EFFECT_BOUNCE, EFFECT_SPARKLE, EFFECT_ROTATE,
+    EFFECT_OR, EFFECT_AND, EFFECT_XOR, EFFECT_MASK,
+};
+
+typedef struct effect {
+    int kind;
+    uint32_t mask;              // const and blink frame, rotate pattern
+    int leds, width, dark, dir;
+    uint32_t percent, seed;
+    uint64_t step_us;           // blink: on time
+    uint64_t off_us;            // blink only
+    struct effect *a, *b;       // layers
+} effect_t;
+
+// Constructors return NULL with a message for parameters out of range or
+// out of memory. Layers take ownership of their operands (and free them
+// on failure).
+effect_t *effect_const(uint32_t mask);
+effect_t *effect_blink(uint32_t mask, uint64_t on_us, uint64_t off_us);
+effect_t *effect_chase(int leds, uint64_t step_us, int width, int dark);
+effect_t *effect_bounce(int leds, uint64_t step_us, int width);
+effect_t *effect_sparkle(int leds, uint64_t step_us, uint32_t percent, uint32_t seed);
+effect_t *effect_rotate(uint32_t pattern, int leds, uint64_t step_us, int dir);
+effect_t *effect_layer(int op, effect_t *a, effect_t *b);
+void effect_free(effect_t *e);
+
+// Parse the text form. NULL with a message on stderr when malformed.
+effect_t *effect_parse(const char *spec);
+
+// Frame at t_us, and the next time after t_us it may change
+// (UINT64_MAX: never)
+uint32_t effect_eval(const effect_t *e, uint64_t t_us);
+uint64_t effect_next_change(const effect_t *e, uint64_t t_us);
+// LEDs the effect can reach, 1 + the highest one
+int effect_channels(const effect_t *e);
+
+typedef struct {
+    const effect_t *fx;
+    uint64_t t_us;              // start of the next frame to generate
+    uint64_t end_us;            // 0: runs forever
+    show_t window;              // the frames generated last, as show records;
+                                // window.duration_us is where the last one ends
+} effect_stream_t;
+
+// Stream of fx from start_us. Returns 0 or -1.
+int effect_stream_init(effect_stream_t *s, const effect_t *fx, uint64_t start_us, uint64_t end_us);
+// Replace the window with the next frames, identical steps merged.
+// Returns the number of frames, 0 at the end of the stream.
+uint32_t effect_stream_fill(effect_stream_t *s);
+void effect_stream_free(effect_stream_t *s);
+
+// Play a stream with the effect's time 0 at start_ns (CLOCK_MONOTONIC):
+// sleep to each frame's absolute start and write it in one bulk write.
+// Runs until the stream ends or *stop is set (stop may be NULL). Inline
+// so tools that only compile effects need no GPIO backend.
+static inline void effect_play(gpio_backend_t *gpio, effect_stream_t *s, uint64_t start_ns, atomic_int *stop) {
+    // The next window is generated right after the last frame of this one
+    // is written, a whole frame ahead of its deadline
+    while (effect_stream_fill(s)) {
+        for (uint32_t i = 0; i < s->window.frame_count; ++i) {
+            if (stop && atomic_load_explicit(stop, memory_order_relaxed))
+                return;
+            const show_record_t *r = show_record(&s->window, i);
+            sleep_until_ns(start_ns + r->t_us * 1000);
+            gpio_write(gpio, r->bits[0]);
+        }
+    }
+    if (s->end_us) {
+        sleep_until_ns(start_ns + s->end_us * 1000);
+        return;
+    }
+    // Nothing changes any more and the stream has no end: hold the frame
+    while (!(stop && atomic_load_explicit(stop, memory_order_relaxed)))
+        sleep_until_ns(now_ns() + EFFECT_HOLD_POLL_MS * 1000000ull);
+}
+
+// Write fx from 0 to duration_us as a compiled show. Returns the number
+// of frames or -1.
+long effect_compile(const effect_t *fx, uint64_t duration_us, const char *path);
+
+#endif
@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gpio.h"
+
+const char *gpio_default_spec(const char *fallback) {
+    const char *env = getenv(GPIO_SPEC_ENV);
+    return (env && *env) ? env : fallback;
+}
+
+gpio_backend_t *gpio_open(const char *spec, const int *lines, int num_lines) {
+    if (num_lines <= 0 || num_lines > GPIO_MAX_LINES) {
+        fprintf(stderr, "gpio: %d lines requested, max is %d\n", num_lines, GPIO_MAX_LINES);
+        return NULL;
+    }
+    if (!spec || !*spec)
+        spec = GPIO_DEFAULT_SPEC;
+
+    // Split "name:arg"
+    char name[16];
+    const char *arg = strchr(spec, ':');
+    size_t len = arg ? (size_t)(arg - spec) : strlen(spec);
+    if (len >= sizeof(name)) len = sizeof(name) - 1;
+    memcpy(name, spec, len);
+    name[len] = '\0';
+    if (arg) arg++;
+
+    gpio_backend_t *b = NULL;
+    if (strcmp(name, "gpiod") == 0) {
+        b = gpio_gpiod_open(arg, lines, num_lines);
+    } else if (strcmp(name, "mmap") == 0) {
+        b = gpio_mmap_open(arg, lines, num_lines);
+    } else if (strcmp(name, "sim") == 0) {
+        b = gpio_sim_open(arg, lines, num_lines);
+    } else if (strcmp(name, "auto") == 0) {
+        // Register writes are cheapest; fall back to the character device
+        b = gpio_mmap_open(NULL, lines, num_lines);
+        if (!b)
+            b = gpio_gpiod_open(NULL, lines, num_lines);
+    } else {
+        fprintf(stderr, "gpio: unknown backend '%s' (use gpiod, mmap, sim or auto)\n", spec);
+        return NULL;
+    }
+
+    if (!b) {
+        fprintf(stderr, "gpio: could not open backend '%s'\n", spec);
+        return NULL;
+    }
+    memcpy(b->lines, lines, num_lines * sizeof(int));
+    b->num_lines = num_lines;
+    fprintf(stderr, "gpio: using %s backend for %d lines in %d bank%s\n",
+            b->name, num_lines, b->num_banks, b->num_banks == 1 ? "" : "s");
+    return b;
+}
+
+void gpio_map(const gpio_backend_t *b, const uint32_t *bits, int channels, uint32_t *image) {
+    memset(image, 0, b->num_banks * sizeof(uint32_t));
+    if (channels > b->num_lines)
+        channels = b->num_lines;
+    for (int i = 0; i < channels; ++i)
+        if ((bits[i / 32] >> (i % 32)) & 1)
+            image[b->line_bank[i]] |= 1u << b->line_bit[i];
+}
+
+int gpio_write_bits(gpio_backend_t *b, const uint32_t *bits) {
+    uint32_t image[GPIO_MAX_BANKS];
+    gpio_map(b, bits, b->num_lines, image);
+    return gpio_write_image(b, image);
+}
+
+int gpio_plan_init(gpio_plan_t *p, const gpio_backend_t *b, uint32_t frames) {
+    p->banks = b->num_banks;
+    p->frames = frames;
+    // Every frame is set at load time, playback only reads it
+    p->image = calloc((size_t)frames * p->banks, sizeof(uint32_t));
+    if (!p->image) {
+        perror("gpio: plan");
+        return -1;
+    }
+    return 0;
+}
+
+void gpio_plan_free(gpio_plan_t *p) {
+    free(p->image);
+    p->image = NULL;
+}
+
+void gpio_close(gpio_backend_t *b) {
+    if (!b) return;
+    b->close(b);
+}
@@ -0,0 +1,153 @@
+#ifndef GPIO_H
+#define GPIO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// One output interface for every sequencer. A frame is a bitset where
+// bit i (word i / 32) drives lines[i]; the first character of a
+// "0000.0111" pattern is channel 0. Any number of channels up to
+// GPIO_MAX_LINES is supported.
+//
+// Backends group their lines into banks of up to 32: a GPSET/GPCLR
+// register pair, or one line request on a gpiochip. A frame is mapped to
+// one 32-bit image per bank, ideally once at load time (gpio_plan_t), so
+// playback only compares bank images with the shadow and issues set/clear
+// writes for the banks that changed. Write cost depends on the number of
+// banks touched, not on the number of channels.
+//
+// Backend specs accepted by gpio_open():
+//   "gpiod[:chip[,chip...]]"  libgpiod, lines requested once per bank
+//   "mmap[:device]"           BCM283x/2711 registers via /dev/gpiomem or /dev/mem
+//   "sim[:log.csv]"           in-memory register file, every write timestamped
+//                             (up to $LED_GPIO_SIM_EVENTS writes, then counted as dropped)
+//   "auto"                    mmap if available, otherwise gpiod
+//
+// Lines are BCM numbers for mmap and sim (0-53, bank 0 and bank 1). For
+// gpiod, GPIO_LINE(k, offset) selects the k-th chip of the spec; plain
+// numbers are offsets on the first chip.
+
+#define GPIO_MAX_LINES 256
+#define GPIO_MAX_BANKS 16
+#define GPIO_WORDS(n) (((n) + 31) / 32)
+#define GPIO_LINE(chip, offset) (((chip) << 16) | (offset))
+#define GPIO_DEFAULT_SPEC "auto"
+#define GPIO_SPEC_ENV "LED_GPIO"
+#define GPIO_SIM_EVENTS_ENV "LED_GPIO_SIM_EVENTS"
+#define GPIO_SIM_DEFAULT_EVENTS (1u << 20)  // 16 MB, a few minutes of BAM
+
+typedef struct gpio_backend gpio_backend_t;
+
+struct gpio_backend {
+    const char *name;
+    // Drive one bank: set/clr hold the bits that change, image the new state
+    int (*write_bank)(gpio_backend_t *b, int bank, uint32_t set, uint32_t clr, uint32_t image);
+    void (*close)(gpio_backend_t *b);
+    int lines[GPIO_MAX_LINES];
+    int num_lines;
+    // Channel i is bit line_bit[i] of bank line_bank[i], set by the backend
+    uint8_t line_bank[GPIO_MAX_LINES];
+    uint8_t line_bit[GPIO_MAX_LINES];
+    int num_banks;
+    // Set and clear bits of one bank land in a single write (no phantom
+    // state in between); separate SET/CLR registers cannot do that
+    int atomic_banks;
+    uint32_t bank_shadow[GPIO_MAX_BANKS];
+};
+
+gpio_backend_t *gpio_open(const char *spec, const int *lines, int num_lines);
+void gpio_close(gpio_backend_t *b);
+
+// Returns $LED_GPIO when set, otherwise the program's default spec
+const char *gpio_default_spec(const char *fallback);
+
+// Channel bitset of the given width -> one image per bank. Channels
+// beyond it are off. Walks every channel, so do it at load time; image
+// must hold num_banks words.
+void gpio_map(const gpio_backend_t *b, const uint32_t *bits, int channels, uint32_t *image);
+
+// Write a mapped frame. Banks whose image did not change are skipped.
+static inline int gpio_write_image(gpio_backend_t *b, const uint32_t *image) {
+    int ret = 0;
+    for (int k = 0; k < b->num_banks; ++k) {
+        uint32_t cur = b->bank_shadow[k], want = image[k];
+        if (cur == want)
+            continue;
+        if (b->write_bank(b, k, want & ~cur, cur & ~want, want) < 0)
+            ret = -1;
+        else
+            b->bank_shadow[k] = want;
+    }
+    return ret;
+}
+
+// Map and write a frame of GPIO_WORDS(num_lines) words
+int gpio_write_bits(gpio_backend_t *b, const uint32_t *bits);
+
+// Frame of channels 0-31, for programs with up to 32 LEDs
+static inline int gpio_write(gpio_backend_t *b, uint32_t frame) {
+    uint32_t bits[GPIO_WORDS(GPIO_MAX_LINES)] = {frame};
+    return gpio_write_bits(b, bits);
+}
+
+// Bank images for a whole timeline, mapped once before playback
+typedef struct {
+    uint32_t *image;        // frames x banks
+    int banks;
+    uint32_t frames;
+} gpio_plan_t;
+
+int gpio_plan_init(gpio_plan_t *p, const gpio_backend_t *b, uint32_t frames);
+void gpio_plan_free(gpio_plan_t *p);
+
+static inline uint32_t *gpio_plan_frame(const gpio_plan_t *p, uint32_t i) {
+    return p->image + (size_t)i * p->banks;
+}
+
+static inline void gpio_plan_set(gpio_plan_t *p, const gpio_backend_t *b, uint32_t i,
+                                 const uint32_t *bits, int channels) {
+    gpio_map(b, bits, channels, gpio_plan_frame(p, i));
+}
+
+// Backend constructors, normally reached through gpio_open()
+gpio_backend_t *gpio_gpiod_open(const char *chips, const int *lines, int num_lines);
+gpio_backend_t *gpio_mmap_open(const char *device, const int *lines, int num_lines);
+gpio_backend_t *gpio_sim_open(const char *log_path, const int *lines, int num_lines);
+
+// Simulated register file. Every register write is recorded with its
+// CLOCK_MONOTONIC timestamp so timing can be analysed after a run. The
+// log is allocated and touched at open; once full, writes still change
+// the registers but are only counted.
+// Bank k uses SET0 + k, CLR0 + k and LEV0 + k.
+#define GPIO_REG_SET0 (0x1C / 4)
+#define GPIO_REG_CLR0 (0x28 / 4)
+#define GPIO_REG_LEV0 (0x34 / 4)
+#define GPIO_BCM_BANKS 2
+
+typedef struct {
+    uint64_t t_ns;
+    uint32_t reg;
+    uint32_t value;
+} gpio_sim_event_t;
+
+// Events recorded so far by a "sim" backend (NULL for other backends)
+const gpio_sim_event_t *gpio_sim_events(gpio_backend_t *b, size_t *count);
+// Writes not recorded because the log was full (0 for other backends)
+size_t gpio_sim_dropped(gpio_backend_t *b);
+
+// Replay the events recorded since *cursor as one frame change from the
+// bank images from -> to. Every state in between that is neither frame is
+// a phantom; window_ns is how long phantoms were on the outputs (up to
+// the last write), wrong_bits how many LEDs they had off from the nearer
+// frame. Advances *cursor. Returns -1 for other backends.
+typedef struct {
+    unsigned writes;
+    unsigned phantoms;
+    unsigned wrong_bits;
+    uint64_t window_ns;
+} gpio_sim_transition_t;
+
+int gpio_sim_transition(gpio_backend_t *b, size_t *cursor, const uint32_t *from, const uint32_t *to,
+                        gpio_sim_transition_t *out);
+
+#endif
@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "gpio.h"
+
+#ifndef GPIO_NO_GPIOD
+
+#include <gpiod.h>
+
+#define CONSUMER "led_seq"
+#define MAX_CHIPS 4
+
+// Chips tried when no name is given: Pi 5 (RP1), Pi 4, older Pis
+static const char *default_chips[] = {"pinctrl-rp1", "pinctrl-bcm2711", "pinctrl-bcm2835", "gpiochip0"};
+
+// One bulk request per bank: up to 32 lines of one chip, in channel order
+typedef struct {
+    gpio_backend_t base;
+    struct gpiod_chip *chips[MAX_CHIPS];
+    int num_chips;
+    struct gpiod_line_bulk bulk[GPIO_MAX_BANKS];
+    int requested;
+} gpiod_backend_t;
+
+// A bank is a single ioctl however many of its lines change
+static int gpiod_write_bank(gpio_backend_t *b, int bank, uint32_t set, uint32_t clr, uint32_t image) {
+    gpiod_backend_t *g = (gpiod_backend_t *)b;
+    int values[32];
+    for (unsigned j = 0; j < g->bulk[bank].num_lines; ++j)
+        values[j] = (image >> j) & 1;
+    return gpiod_line_set_value_bulk(&g->bulk[bank], values);
+}
+
+static void gpiod_close(gpio_backend_t *b) {
+    gpiod_backend_t *g = (gpiod_backend_t *)b;
+    for (int k = 0; k < g->requested; ++k)
+        gpiod_line_release_bulk(&g->bulk[k]);
+    for (int c = 0; c < g->num_chips; ++c)
+        gpiod_chip_close(g->chips[c]);
+    free(g);
+}
+
+static struct gpiod_chip *open_default_chip(void) {
+    struct gpiod_chip *chip = NULL;
+    for (size_t i = 0; !chip && i < sizeof(default_chips) / sizeof(default_chips[0]); ++i)
+        chip = gpiod_chip_open_lookup(default_chips[i]);
+    return chip;
+}
+
+gpio_backend_t *gpio_gpiod_open(const char *chip_names, const int *lines, int num_lines) {
+    gpiod_backend_t *g = calloc(1, sizeof(*g));
+    if (!g) return NULL;
+
+    // "gpiochip0,gpiochip1": GPIO_LINE(k, offset) is on the k-th chip
+    if (chip_names && *chip_names) {
+        char names[128];
+        snprintf(names, sizeof(names), "%s", chip_names);
+        for (char *save, *name = strtok_r(names, ",", &save); name; name = strtok_r(NULL, ",", &save)) {
+            if (g->num_chips == MAX_CHIPS) break;
+            if (!(g->chips[g->num_chips] = gpiod_chip_open_lookup(name))) {
+                fprintf(stderr, "gpiod: open chip %s: %s\n", name, strerror(errno));
+                gpiod_close(&g->base);
+                return NULL;
+            }
+            g->num_chips++;
+        }
+    } else if ((g->chips[0] = open_default_chip())) {
+        g->num_chips = 1;
+    }
+    if (g->num_chips == 0) {
+        perror("gpiod: open chip failed");
+        free(g);
+        return NULL;
+    }
+
+    // Group the lines into banks, a new bank per chip and every 32 lines
+    int bank_chip[GPIO_MAX_BANKS];
+    for (int i = 0; i < num_lines; ++i) {
+        int c = lines[i] >> 16, offset = lines[i] & 0xFFFF;
+        if (c >= g->num_chips) {
+            fprintf(stderr, "gpiod: line %d is on chip %d, only %d given\n", offset, c, g->num_chips);
+            gpiod_close(&g->base);
+            return NULL;
+        }
+        int k;
+        for (k = 0; k < g->base.num_banks; ++k)
+            if (bank_chip[k] == c && g->bulk[k].num_lines < 32) break;
+        if (k == g->base.num_banks) {
+            if (k == GPIO_MAX_BANKS) {
+                fprintf(stderr, "gpiod: too many banks\n");
+                gpiod_close(&g->base);
+                return NULL;
+            }
+            bank_chip[k] = c;
+            gpiod_line_bulk_init(&g->bulk[k]);
+            g->base.num_banks++;
+        }
+
+        struct gpiod_line *line = gpiod_chip_get_line(g->chips[c], offset);
+        if (!line) {
+            perror("gpiod: get line failed");
+            gpiod_close(&g->base);
+            return NULL;
+        }
+        g->base.line_bank[i] = k;
+        g->base.line_bit[i] = g->bulk[k].num_lines;
+        gpiod_line_bulk_add(&g->bulk[k], line);
+    }
+
+    // Lines are requested once and kept for the lifetime of the backend
+    int defaults[32] = {0};
+    for (; g->requested < g->base.num_banks; ++g->requested) {
+        if (gpiod_line_request_bulk_output(&g->bulk[g->requested], CONSUMER, defaults) < 0) {
+            perror("gpiod: request lines as output failed");
+            gpiod_close(&g->base);
+            return NULL;
+        }
+    }
+
+    g->base.name = "gpiod";
+    g->base.atomic_banks = 1;
+    g->base.write_bank = gpiod_write_bank;
+    g->base.close = gpiod_close;
+    return &g->base;
+}
+
+#else
+
+gpio_backend_t *gpio_gpiod_open(const char *chip_names, const int *lines, int num_lines) {
+    (void)chip_names; (void)lines; (void)num_lines;
+    fprintf(stderr, "gpiod: built with GPIO_NO_GPIOD\n");
+    return NULL;
+}
+
+#endif
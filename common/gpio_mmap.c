@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "gpio.h"
+
+#define GPIO_LEN        0xB4      // Enough to cover all GPIO registers
+#define GPIO_OFFSET     0x200000  // GPIO block offset from the peripheral base
+#define PERI_BASE_PI1   0x20000000
+#define BCM_MAX_PIN     53
+
+typedef struct {
+    gpio_backend_t base;
+    int fd;
+    volatile uint32_t *gpio;
+    uint32_t led_mask[GPIO_BCM_BANKS];  // our pins in GPSETn/GPCLRn layout
+} mmap_backend_t;
+
+static int read_file(const char *path, unsigned char *buf, size_t len) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    ssize_t n = read(fd, buf, len);
+    close(fd);
+    return (int)n;
+}
+
+// Peripheral base as reported by the device tree, same logic as
+// bcm_host_get_peripheral_address(). Falls back to the Pi 1 address.
+static uint32_t peripheral_base(void) {
+    unsigned char r[12];
+    int n = read_file("/proc/device-tree/soc/ranges", r, sizeof(r));
+    if (n >= 8) {
+        uint32_t base = (r[4] << 24) | (r[5] << 16) | (r[6] << 8) | r[7];
+        if (base == 0 && n >= 12)
+            base = (r[8] << 24) | (r[9] << 16) | (r[10] << 8) | r[11];
+        if (base) return base;
+    }
+    return PERI_BASE_PI1;
+}
+
+// The Pi 5 moved GPIO to the RP1 chip, whose registers look nothing like
+// GPSET0/GPCLR0. Poking the old layout there would scribble over memory.
+static int board_has_bcm_gpio(void) {
+    char compat[256] = {0};
+    int n = read_file("/proc/device-tree/compatible", (unsigned char *)compat, sizeof(compat) - 1);
+    if (n <= 0) return 1;  // No device tree, trust the caller
+    for (int i = 0; i < n; ++i)
+        if (compat[i] == '\0') compat[i] = ' ';
+    return strstr(compat, "bcm2712") == NULL;
+}
+
+// Bank images are already in register layout: at most two stores per bank
+static int mmap_write_bank(gpio_backend_t *b, int bank, uint32_t set, uint32_t clr, uint32_t image) {
+    volatile uint32_t *gpio = ((mmap_backend_t *)b)->gpio;
+    if (set)
+        gpio[GPIO_REG_SET0 + bank] = set;
+    __sync_synchronize(); // CPU barrier
+    if (clr)
+        gpio[GPIO_REG_CLR0 + bank] = clr;
+    return 0;
+}
+
+static void mmap_close(gpio_backend_t *b) {
+    mmap_backend_t *m = (mmap_backend_t *)b;
+    munmap((void *)m->gpio, GPIO_LEN);
+    close(m->fd);
+    free(m);
+}
+
+gpio_backend_t *gpio_mmap_open(const char *device, const int *lines, int num_lines) {
+    if (!board_has_bcm_gpio()) {
+        fprintf(stderr, "mmap: board has no BCM283x GPIO block, use gpiod\n");
+        return NULL;
+    }
+
+    // /dev/gpiomem maps the GPIO block at offset 0 and needs no root,
+    // /dev/mem needs the physical address of the block.
+    const char *path = device ? device : "/dev/gpiomem";
+    int fd = open(path, O_RDWR | O_SYNC);
+    if (fd < 0 && !device) {
+        path = "/dev/mem";
+        fd = open(path, O_RDWR | O_SYNC);
+    }
+    if (fd < 0) {
+        perror("mmap: open gpio device");
+        return NULL;
+    }
+
+    off_t offset = strstr(path, "gpiomem") ? 0 : (off_t)peripheral_base() + GPIO_OFFSET;
+    volatile uint32_t *gpio = mmap(NULL, GPIO_LEN, PROT_READ | PROT_WRITE, MAP_SHARED, fd, offset);
+    if (gpio == MAP_FAILED) {
+        perror("mmap: mmap gpio registers");
+        close(fd);
+        return NULL;
+    }
+
+    mmap_backend_t *m = calloc(1, sizeof(*m));
+    if (!m) {
+        munmap((void *)gpio, GPIO_LEN);
+        close(fd);
+        return NULL;
+    }
+    m->fd = fd;
+    m->gpio = gpio;
+
+    for (int i = 0; i < num_lines; ++i) {
+        int pin = lines[i];
+        if (pin < 0 || pin > BCM_MAX_PIN) {
+            fprintf(stderr, "mmap: GPIO %d does not exist\n", pin);
+            mmap_close(&m->base);
+            return NULL;
+        }
+        m->base.line_bank[i] = pin / 32;
+        m->base.line_bit[i] = pin % 32;
+        m->led_mask[pin / 32] |= 1u << (pin % 32);
+        if (pin / 32 >= m->base.num_banks)
+            m->base.num_banks = pin / 32 + 1;
+
+        // Function select 001 = output
+        volatile uint32_t *fsel = gpio + (pin / 10);
+        int shift = (pin % 10) * 3;
+        *fsel = (*fsel & ~(7u << shift)) | (1u << shift);
+    }
+
+    // Start from a known dark state
+    for (int k = 0; k < m->base.num_banks; ++k)
+        if (m->led_mask[k])
+            gpio[GPIO_REG_CLR0 + k] = m->led_mask[k];
+
+    m->base.name = "mmap";
+    m->base.write_bank = mmap_write_bank;
+    m->base.close = mmap_close;
+    return &m->base;
+}
@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gpio.h"
+#include "timeutil.h"
+
+#define SIM_REGS          (0xB4 / 4)
+
+#define SIM_MAX_PIN       53
+
+// Register file with the same GPSETn/GPCLRn/GPLEVn semantics as the BCM
+// block, so a show can be played and timed on any Linux box.
+typedef struct {
+    gpio_backend_t base;
+    uint32_t regs[SIM_REGS];
+    gpio_sim_event_t *events;
+    size_t event_count;
+    size_t event_cap;
+    size_t dropped;
+    char *log_path;
+} sim_backend_t;
+
+static int reg_bank(uint32_t reg, uint32_t base) {
+    return reg >= base && reg < base + GPIO_BCM_BANKS ? (int)(reg - base) : -1;
+}
+
+static void sim_reg_write(sim_backend_t *s, uint32_t reg, uint32_t value) {
+    int k;
+    if ((k = reg_bank(reg, GPIO_REG_SET0)) >= 0)
+        s->regs[GPIO_REG_LEV0 + k] |= value;
+    else if ((k = reg_bank(reg, GPIO_REG_CLR0)) >= 0)
+        s->regs[GPIO_REG_LEV0 + k] &= ~value;
+    else
+        s->regs[reg] = value;
+
+    if (s->event_count == s->event_cap) {
+        s->dropped++;  // Keep simulating, stop recording
+        return;
+    }
+    s->events[s->event_count++] = (gpio_sim_event_t){.t_ns = now_ns(), .reg = reg, .value = value};
+}
+
+// Same register traffic as the mmap backend
+static int sim_write_bank(gpio_backend_t *b, int bank, uint32_t set, uint32_t clr, uint32_t image) {
+    sim_backend_t *s = (sim_backend_t *)b;
+    if (set)
+        sim_reg_write(s, GPIO_REG_SET0 + bank, set);
+    if (clr)
+        sim_reg_write(s, GPIO_REG_CLR0 + bank, clr);
+    return 0;
+}
+
+static void sim_close(gpio_backend_t *b) {
+    sim_backend_t *s = (sim_backend_t *)b;
+    if (s->dropped)
+        fprintf(stderr, "sim: log full at %zu writes, %zu more not recorded (raise %s)\n",
+                s->event_cap, s->dropped, GPIO_SIM_EVENTS_ENV);
+    if (s->log_path) {
+        FILE *f = fopen(s->log_path, "w");
+        if (f) {
+            // level is the state of the written bank after the write
+            fprintf(f, "t_ns,reg,value,level\n");
+            uint32_t level[GPIO_BCM_BANKS] = {0};
+            for (size_t i = 0; i < s->event_count; ++i) {
+                const gpio_sim_event_t *e = &s->events[i];
+                char reg[8] = "?";
+                int k;
+                if ((k = reg_bank(e->reg, GPIO_REG_SET0)) >= 0) {
+                    snprintf(reg, sizeof(reg), "GPSET%d", k);
+                    level[k] |= e->value;
+                } else if ((k = reg_bank(e->reg, GPIO_REG_CLR0)) >= 0) {
+                    snprintf(reg, sizeof(reg), "GPCLR%d", k);
+                    level[k] &= ~e->value;
+                }
+                fprintf(f, "%llu,%s,0x%08x,0x%08x\n", (unsigned long long)e->t_ns, reg, e->value,
+                        k >= 0 ? level[k] : 0);
+            }
+            fclose(f);
+        } else {
+            perror("sim: write log");
+        }
+        free(s->log_path);
+    }
+    free(s->events);
+    free(s);
+}
+
+const gpio_sim_event_t *gpio_sim_events(gpio_backend_t *b, size_t *count) {
+    if (!b || b->close != sim_close) {
+        *count = 0;
+        return NULL;
+    }
+    sim_backend_t *s = (sim_backend_t *)b;
+    *count = s->event_count;
+    return s->events;
+}
+
+size_t gpio_sim_dropped(gpio_backend_t *b) {
+    if (!b || b->close != sim_close)
+        return 0;
+    return ((sim_backend_t *)b)->dropped;
+}
+
+int gpio_sim_transition(gpio_backend_t *b, size_t *cursor, const uint32_t *from, const uint32_t *to,
+                        gpio_sim_transition_t *out) {
+    size_t count;
+    const gpio_sim_event_t *ev = gpio_sim_events(b, &count);
+    memset(out, 0, sizeof(*out));
+    if (!ev)
+        return -1;
+
+    uint32_t level[GPIO_BCM_BANKS] = {0};
+    size_t banks = b->num_banks * sizeof(uint32_t);
+    memcpy(level, from, banks);
+    uint64_t phantom_since = 0;
+    for (size_t i = *cursor; i < count; ++i) {
+        int k;
+        if ((k = reg_bank(ev[i].reg, GPIO_REG_SET0)) >= 0)
+            level[k] |= ev[i].value;
+        else if ((k = reg_bank(ev[i].reg, GPIO_REG_CLR0)) >= 0)
+            level[k] &= ~ev[i].value;
+        else
+            continue;
+        out->writes++;
+        if (phantom_since)
+            out->window_ns += ev[i].t_ns - phantom_since;
+        phantom_since = 0;
+        if (memcmp(level, from, banks) != 0 && memcmp(level, to, banks) != 0) {
+            unsigned d_from = 0, d_to = 0;
+            for (int j = 0; j < b->num_banks; ++j) {
+                d_from += __builtin_popcount(level[j] ^ from[j]);
+                d_to += __builtin_popcount(level[j] ^ to[j]);
+            }
+            out->phantoms++;
+            out->wrong_bits += d_from < d_to ? d_from : d_to;
+            phantom_since = ev[i].t_ns;
+        }
+    }
+    *cursor = count;
+    return 0;
+}
+
+gpio_backend_t *gpio_sim_open(const char *log_path, const int *lines, int num_lines) {
+    sim_backend_t *s = calloc(1, sizeof(*s));
+    if (!s) return NULL;
+
+    for (int i = 0; i < num_lines; ++i) {
+        int pin = lines[i];
+        if (pin < 0 || pin > SIM_MAX_PIN) {
+            fprintf(stderr, "sim: GPIO %d does not exist\n", pin);
+            free(s);
+            return NULL;
+        }
+        s->base.line_bank[i] = pin / 32;
+        s->base.line_bit[i] = pin % 32;
+        if (pin / 32 >= s->base.num_banks)
+            s->base.num_banks = pin / 32 + 1;
+    }
+    if (log_path && *log_path)
+        s->log_path = strdup(log_path);
+
+    // Sized once and touched now: the RT threads never allocate or fault
+    // on a write
+    const char *env = getenv(GPIO_SIM_EVENTS_ENV);
+    size_t cap = env && *env ? strtoull(env, NULL, 0) : GPIO_SIM_DEFAULT_EVENTS;
+    if (cap) {
+        s->events = malloc(cap * sizeof(*s->events));
+        if (!s->events) {
+            perror("sim: event log");
+            free(s->log_path);
+            free(s);
+            return NULL;
+        }
+        memset(s->events, 0, cap * sizeof(*s->events));
+        s->event_cap = cap;
+    }
+
+    s->base.name = "sim";
+    s->base.write_bank = sim_write_bank;
+    s->base.close = sim_close;
+    return &s->base;
+}
@@ -0,0 +1,85 @@
+#include <string.h>
+
+#include "latency_hist.h"
+
+#define SUB_COUNT     (1 << LHIST_SUB_BITS)        // buckets per power of two
+#define LINEAR_LIMIT  (2 * SUB_COUNT)              // values below are exact
+
+static int bucket_index(uint64_t v) {
+    if (v < LINEAR_LIMIT)
+        return (int)v;
+    int msb = 63 - __builtin_clzll(v);
+    int shift = msb - LHIST_SUB_BITS;
+    int idx = LINEAR_LIMIT + (msb - LHIST_SUB_BITS - 1) * SUB_COUNT + (int)((v >> shift) - SUB_COUNT);
+    return idx < LHIST_BUCKETS ? idx : LHIST_BUCKETS - 1;
+}
+
+// Largest value that lands in bucket idx
+static int64_t bucket_upper(int idx) {
+    if (idx < LINEAR_LIMIT)
+        return idx;
+    int group = (idx - LINEAR_LIMIT) / SUB_COUNT;
+    int sub = (idx - LINEAR_LIMIT) % SUB_COUNT;
+    int shift = group + 1;
+    return ((int64_t)(SUB_COUNT + sub + 1) << shift) - 1;
+}
+
+void lhist_init(lhist_t *h, const char *name) {
+    memset(h, 0, sizeof(*h));
+    h->name = name;
+}
+
+void lhist_reset(lhist_t *h) {
+    lhist_init(h, h->name);
+}
+
+void lhist_record(lhist_t *h, int64_t v) {
+    if (v < 0) {
+        h->negative++;
+        v = 0;
+    }
+    if (h->count == 0 || v < h->min) h->min = v;
+    if (v > h->max) h->max = v;
+    h->count++;
+    h->sum += (double)v;
+    h->buckets[bucket_index((uint64_t)v)]++;
+}
+
+int64_t lhist_percentile(const lhist_t *h, double p) {
+    if (h->count == 0)
+        return 0;
+    uint64_t rank = (uint64_t)(p / 100.0 * h->count + 0.5);
+    if (rank < 1) rank = 1;
+    if (rank > h->count) rank = h->count;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < LHIST_BUCKETS; ++i) {
+        seen += h->buckets[i];
+        if (seen >= rank) {
+            int64_t v = bucket_upper(i);
+            return v < h->max ? v : h->max;
+        }
+    }
+    return h->max;
+}
+
+void lhist_print_header(FILE *f) {
+    fprintf(f, "%-18s %10s %10s %10s %10s %10s %10s %10s\n",
+            "metric (us)", "count", "mean", "p50", "p99", "p99.9", "p99.99", "max");
+}
+
+void lhist_print(FILE *f, const lhist_t *h) {
+    double mean = h->count ? h->sum / h->count : 0;
+    fprintf(f, "%-18s %10llu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+            h->name, (unsigned long long)h->count, mean / 1000.0,
+            lhist_percentile(h, 50) / 1000.0, lhist_percentile(h, 99) / 1000.0,
+            lhist_percentile(h, 99.9) / 1000.0, lhist_percentile(h, 99.99) / 1000.0,
+            h->max / 1000.0);
+}
+
+void lhist_print_csv(FILE *f, const lhist_t *h) {
+    fprintf(f, "%s p50 (us),%.1f\n%s p99 (us),%.1f\n%s p99.9 (us),%.1f\n%s p99.99 (us),%.1f\n%s max (us),%.1f\n",
+            h->name, lhist_percentile(h, 50) / 1000.0, h->name, lhist_percentile(h, 99) / 1000.0,
+            h->name, lhist_percentile(h, 99.9) / 1000.0, h->name, lhist_percentile(h, 99.99) / 1000.0,
+            h->name, h->max / 1000.0);
+}
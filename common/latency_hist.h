@@ -0,0 +1,38 @@
+#ifndef LATENCY_HIST_H
+#define LATENCY_HIST_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// HDR-style log-bucketed latency histogram. Values are nanoseconds. The
+// first 64 buckets are 1 ns wide, after that every power of two is split
+// into 32 buckets, so any value is kept to within ~3% up to ~68 s in a
+// fixed 4 KB. Recording is O(1) and the histogram never allocates, so it
+// can be updated online for the whole run and reported at any time.
+
+#define LHIST_SUB_BITS   5
+#define LHIST_BUCKETS    1024
+
+typedef struct {
+    const char *name;
+    uint64_t count;
+    uint64_t negative;      // values below zero, counted as 0
+    int64_t min, max;
+    double sum;
+    uint32_t buckets[LHIST_BUCKETS];
+} lhist_t;
+
+void lhist_init(lhist_t *h, const char *name);
+void lhist_reset(lhist_t *h);
+void lhist_record(lhist_t *h, int64_t value_ns);
+
+// Value at percentile p (0-100), as the upper edge of its bucket
+int64_t lhist_percentile(const lhist_t *h, double p);
+
+// One line per histogram, values in µs:  name count p50 p99 p99.9 p99.99 max
+void lhist_print_header(FILE *f);
+void lhist_print(FILE *f, const lhist_t *h);
+// Same data as CSV rows "name,p50_us,..." for run logs
+void lhist_print_csv(FILE *f, const lhist_t *h);
+
+#endif
@@ -0,0 +1,308 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "netsync.h"
+#include "timeutil.h"
+
+enum { MSG_SYNC = 1, MSG_DELAY_REQ, MSG_DELAY_RESP };
+
+typedef struct {
+    uint32_t magic;
+    uint32_t type;
+    uint32_t seq;
+    uint32_t pad;
+    uint64_t t_ns;      // SYNC: t1, DELAY_RESP: t4
+    int64_t show_ns;    // SYNC: leader show position at t1, -1 if not playing
+} netsync_msg_t;
+
+static int open_socket(int port) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        perror("netsync: socket");
+        return -1;
+    }
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(port),
+                               .sin_addr.s_addr = htonl(INADDR_ANY)};
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("netsync: bind");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void init_common(netsync_t *n, int role) {
+    memset(n, 0, sizeof(*n));
+    n->role = role;
+    n->fd = -1;
+    atomic_init(&n->stop, 0);
+    n->rng = (unsigned)now_ns() | 1;
+    lhist_init(&n->path_delay, "net_delay");
+}
+
+int netsync_leader_open(netsync_t *n, int port, netsync_position_fn position, void *ctx) {
+    init_common(n, NETSYNC_LEADER);
+    n->position = position;
+    n->ctx = ctx;
+    n->fd = open_socket(port);
+    return n->fd < 0 ? -1 : 0;
+}
+
+int netsync_follower_open(netsync_t *n, const char *host, int port, avsync_t *sync) {
+    init_common(n, NETSYNC_FOLLOWER);
+    n->sync = sync;
+
+    struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_DGRAM}, *res;
+    int err = getaddrinfo(host, NULL, &hints, &res);
+    if (err != 0) {
+        fprintf(stderr, "netsync: %s: %s\n", host, gai_strerror(err));
+        return -1;
+    }
+    n->leader = *(struct sockaddr_in *)res->ai_addr;
+    n->leader.sin_port = htons(port);
+    freeaddrinfo(res);
+
+    n->fd = open_socket(0);  // Any free port, the leader learns it
+    return n->fd < 0 ? -1 : 0;
+}
+
+void netsync_set_impairment(netsync_t *n, long delay_us, long jitter_us, int loss_pct) {
+    n->delay_us = delay_us;
+    n->jitter_us = jitter_us;
+    n->loss_pct = loss_pct;
+}
+
+// xorshift, good enough for test impairments
+static unsigned next_rand(netsync_t *n) {
+    n->rng ^= n->rng << 13;
+    n->rng ^= n->rng >> 17;
+    n->rng ^= n->rng << 5;
+    return n->rng;
+}
+
+// Hold one message for the injected path delay. Returns 0 if it is lost.
+static int impair(netsync_t *n) {
+    if (n->loss_pct && (int)(next_rand(n) % 100) < n->loss_pct) {
+        n->dropped++;
+        return 0;
+    }
+    long us = n->delay_us + (n->jitter_us ? (long)(next_rand(n) % (n->jitter_us + 1)) : 0);
+    if (us > 0)
+        sleep_until_ns(now_ns() + us * 1000ull);
+    return 1;
+}
+
+static void send_msg(netsync_t *n, const struct sockaddr_in *to, uint32_t type, uint32_t seq,
+                     uint64_t t_ns, int64_t show_ns) {
+    netsync_msg_t m = {.magic = NETSYNC_MAGIC, .type = type, .seq = seq, .t_ns = t_ns, .show_ns = show_ns};
+    sendto(n->fd, &m, sizeof(m), 0, (const struct sockaddr *)to, sizeof(*to));
+}
+
+static void leader_register(netsync_t *n, const struct sockaddr_in *from, uint64_t now) {
+    int free_slot = -1;
+    for (int i = 0; i < NETSYNC_MAX_FOLLOWERS; ++i) {
+        if (n->followers[i].last_seen_ns &&
+            n->followers[i].addr.sin_addr.s_addr == from->sin_addr.s_addr &&
+            n->followers[i].addr.sin_port == from->sin_port) {
+            n->followers[i].last_seen_ns = now;
+            return;
+        }
+        if (free_slot < 0 && (!n->followers[i].last_seen_ns ||
+                              now - n->followers[i].last_seen_ns > NETSYNC_EXPIRE_MS * 1000000ull))
+            free_slot = i;
+    }
+    if (free_slot < 0)
+        return;
+    n->followers[free_slot].addr = *from;
+    n->followers[free_slot].last_seen_ns = now;
+    fprintf(stderr, "netsync: follower %s:%u joined\n", inet_ntoa(from->sin_addr), ntohs(from->sin_port));
+}
+
+static void *leader_fn(void *arg) {
+    netsync_t *n = arg;
+    uint64_t next_sync = now_ns();
+    struct pollfd pfd = {.fd = n->fd, .events = POLLIN};
+
+    while (!atomic_load_explicit(&n->stop, memory_order_relaxed)) {
+        uint64_t now = now_ns();
+        if (now >= next_sync) {
+            n->seq++;
+            for (int i = 0; i < NETSYNC_MAX_FOLLOWERS; ++i) {
+                if (!n->followers[i].last_seen_ns ||
+                    now - n->followers[i].last_seen_ns > NETSYNC_EXPIRE_MS * 1000000ull)
+                    continue;
+                // Timestamp as late as possible, per follower
+                uint64_t t1 = now_ns();
+                int64_t show_ns = -1;
+                if (n->position(n->ctx, t1, &show_ns) < 0)
+                    show_ns = -1;
+                send_msg(n, &n->followers[i].addr, MSG_SYNC, n->seq, t1, show_ns);
+            }
+            next_sync += NETSYNC_PERIOD_MS * 1000000ull;
+            if (next_sync < now) next_sync = now;  // After a stall, do not burst
+            continue;
+        }
+
+        int timeout_ms = (int)((next_sync - now) / 1000000) + 1;
+        if (poll(&pfd, 1, timeout_ms) <= 0)
+            continue;
+
+        netsync_msg_t m;
+        struct sockaddr_in from;
+        socklen_t len = sizeof(from);
+        ssize_t got = recvfrom(n->fd, &m, sizeof(m), 0, (struct sockaddr *)&from, &len);
+        uint64_t t4 = now_ns();
+        if (got != sizeof(m) || m.magic != NETSYNC_MAGIC || m.type != MSG_DELAY_REQ)
+            continue;
+        leader_register(n, &from, t4);
+        send_msg(n, &from, MSG_DELAY_RESP, m.seq, t4, 0);
+        n->exchanges++;
+    }
+    return NULL;
+}
+
+// Least-squares line through the low-delay exchanges of the window
+static void estimate(netsync_t *n) {
+    unsigned count = n->sample_count < NETSYNC_WINDOW ? n->sample_count : NETSYNC_WINDOW;
+    int64_t min_delay = INT64_MAX;
+    for (unsigned i = 0; i < count; ++i)
+        if (n->samples[i].delay_ns < min_delay)
+            min_delay = n->samples[i].delay_ns;
+
+    // Keep exchanges within 25% (at least 20 µs) of the best one
+    int64_t slack = min_delay / 4 > 20000 ? min_delay / 4 : 20000;
+    const netsync_sample_t *newest = &n->samples[(n->sample_count - 1) % NETSYNC_WINDOW];
+    double st = 0, so = 0, stt = 0, sto = 0;
+    unsigned used = 0;
+    for (unsigned i = 0; i < count; ++i) {
+        const netsync_sample_t *s = &n->samples[i];
+        if (s->delay_ns > min_delay + slack)
+            continue;
+        double t = (double)(int64_t)(s->t_ns - newest->t_ns);
+        double o = (double)s->offset_ns;
+        st += t; so += o; stt += t * t; sto += t * o;
+        used++;
+    }
+
+    double skew = 0, offset = so / used;
+    double var = used * stt - st * st;
+    if (used >= 4 && var > 0) {
+        skew = (used * sto - st * so) / var;
+        offset = (so - skew * st) / used;
+    }
+    n->est_offset_ns = offset;
+    n->est_skew_ppm = skew * 1e6;
+    n->est_t_ns = newest->t_ns;
+    n->have_estimate = 1;
+}
+
+int64_t netsync_offset_ns(const netsync_t *n, uint64_t now) {
+    if (!n->have_estimate)
+        return 0;
+    double dt = (double)(int64_t)(now - n->est_t_ns);
+    return (int64_t)(n->est_offset_ns + dt * n->est_skew_ppm / 1e6);
+}
+
+// The leader's position mapped onto our clock becomes the reference.
+// Between SYNCs (or when one is lost) it is extrapolated from the last.
+static void publish(netsync_t *n, uint64_t now) {
+    if (!n->have_estimate || n->show_ns < 0 || !n->last_sync_ns ||
+        now - n->last_sync_ns > NETSYNC_EXPIRE_MS * 1000000ull)
+        return;
+    int64_t leader_now = (int64_t)now + netsync_offset_ns(n, now);
+    avsync_reference_update(n->sync, n->show_ns + (leader_now - (int64_t)n->t1), now);
+}
+
+static void follower_message(netsync_t *n, const netsync_msg_t *m) {
+    if (m->type == MSG_SYNC) {
+        if (!impair(n))
+            return;
+        n->t2 = now_ns();
+        n->last_sync_ns = n->t2;
+        n->pending_seq = m->seq;
+        n->t1 = m->t_ns;
+        n->show_ns = m->show_ns;
+
+        publish(n, n->t2);
+
+        n->t3 = now_ns();
+        if (impair(n))
+            send_msg(n, &n->leader, MSG_DELAY_REQ, m->seq, 0, 0);
+    } else if (m->type == MSG_DELAY_RESP && m->seq && m->seq == n->pending_seq) {
+        if (!impair(n))
+            return;
+        uint64_t t4 = m->t_ns;
+        netsync_sample_t *s = &n->samples[n->sample_count % NETSYNC_WINDOW];
+        s->t_ns = n->t2;
+        s->offset_ns = ((int64_t)(n->t1 - n->t2) + (int64_t)(t4 - n->t3)) / 2;
+        s->delay_ns = ((int64_t)(n->t2 - n->t1) + (int64_t)(t4 - n->t3)) / 2;
+        n->sample_count++;
+        n->exchanges++;
+        n->pending_seq = 0;
+        lhist_record(&n->path_delay, s->delay_ns);
+        estimate(n);
+    }
+}
+
+static void *follower_fn(void *arg) {
+    netsync_t *n = arg;
+    struct pollfd pfd = {.fd = n->fd, .events = POLLIN};
+    uint64_t next_hello = 0;
+
+    while (!atomic_load_explicit(&n->stop, memory_order_relaxed)) {
+        // Not hearing from the leader: (re)register
+        uint64_t now = now_ns();
+        if (now - n->last_sync_ns > 10ull * NETSYNC_PERIOD_MS * 1000000 && now >= next_hello) {
+            send_msg(n, &n->leader, MSG_DELAY_REQ, 0, 0, 0);
+            next_hello = now + 10ull * NETSYNC_PERIOD_MS * 1000000;
+        }
+        if (poll(&pfd, 1, NETSYNC_PERIOD_MS / 5) <= 0) {
+            publish(n, now_ns());
+            continue;
+        }
+
+        netsync_msg_t m;
+        if (recv(n->fd, &m, sizeof(m), 0) != sizeof(m) || m.magic != NETSYNC_MAGIC)
+            continue;
+        follower_message(n, &m);
+    }
+    return NULL;
+}
+
+int netsync_start(netsync_t *n) {
+    if (pthread_create(&n->thread, NULL, n->role == NETSYNC_LEADER ? leader_fn : follower_fn, n) != 0)
+        return -1;
+    n->running = 1;
+    return 0;
+}
+
+void netsync_stop(netsync_t *n) {
+    if (n->running) {
+        atomic_store(&n->stop, 1);
+        pthread_join(n->thread, NULL);
+        n->running = 0;
+    }
+    if (n->fd >= 0)
+        close(n->fd);
+    n->fd = -1;
+}
+
+void netsync_report(const netsync_t *n, FILE *f) {
+    if (n->role == NETSYNC_LEADER) {
+        int active = 0;
+        for (int i = 0; i < NETSYNC_MAX_FOLLOWERS; ++i)
+            active += n->followers[i].last_seen_ns != 0;
+        fprintf(f, "netsync leader: %d followers, %lu delay requests answered\n", active, n->exchanges);
+        return;
+    }
+    fprintf(f, "netsync follower: %lu exchanges, %lu messages dropped, offset %.1f us, skew %.2f ppm\n",
+            n->exchanges, n->dropped, n->est_offset_ns / 1000.0, n->est_skew_ppm);
+    lhist_print_header(f);
+    lhist_print(f, &n->path_delay);
+}
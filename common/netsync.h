@@ -0,0 +1,101 @@
+#ifndef NETSYNC_H
+#define NETSYNC_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <netinet/in.h>
+
+#include "avsync.h"
+#include "latency_hist.h"
+
+// Shared show timeline for several controllers over UDP. The leader
+// sends SYNC {t1, show position at t1} to every follower each period.
+// A follower timestamps it (t2), answers with DELAY_REQ (sent at t3) and
+// gets the leader's receive time t4 back, as in PTP:
+//
+//   offset = ((t1 - t2) + (t4 - t3)) / 2     leader clock - follower clock
+//   delay  = ((t2 - t1) + (t4 - t3)) / 2     one-way path delay
+//
+// Only the exchanges with the lowest delay in a sliding window are
+// trusted (queueing only ever adds delay), and a line fitted through
+// them gives offset and skew. The leader's show position mapped onto the
+// follower's clock is fed to an avsync_t as its reference, so the
+// follower's LED timeline is slewed towards the leader's like a local
+// one is towards the sound card.
+//
+// Followers register by sending DELAY_REQ; the leader forgets followers
+// that stay silent for NETSYNC_EXPIRE_MS. For testing on one machine a
+// follower can add delay, jitter and loss to both directions.
+
+#define NETSYNC_DEFAULT_PORT   5005
+#define NETSYNC_PERIOD_MS      50
+#define NETSYNC_EXPIRE_MS      2000
+#define NETSYNC_MAX_FOLLOWERS  16
+#define NETSYNC_WINDOW         32   // exchanges kept for the estimator
+#define NETSYNC_MAGIC          0x4e59534cu  // "LSYN"
+
+enum { NETSYNC_LEADER, NETSYNC_FOLLOWER };
+
+// Leader: show position of the master timeline at now, -1 if not playing
+typedef int (*netsync_position_fn)(void *ctx, uint64_t now, int64_t *pos_ns);
+
+typedef struct {
+    uint64_t t_ns;              // follower clock (t2)
+    int64_t offset_ns;
+    int64_t delay_ns;
+} netsync_sample_t;
+
+typedef struct {
+    int role;
+    int fd;
+    struct sockaddr_in leader;  // follower: where to send
+    atomic_int stop;
+    pthread_t thread;
+    int running;
+
+    // Leader
+    netsync_position_fn position;
+    void *ctx;
+    struct {
+        struct sockaddr_in addr;
+        uint64_t last_seen_ns;
+    } followers[NETSYNC_MAX_FOLLOWERS];
+    uint32_t seq;
+
+    // Follower
+    avsync_t *sync;
+    long delay_us, jitter_us;   // injected per direction
+    int loss_pct;
+    unsigned rng;
+    uint32_t pending_seq;
+    uint64_t t1, t2, t3;
+    int64_t show_ns;
+    netsync_sample_t samples[NETSYNC_WINDOW];
+    unsigned sample_count;
+    int have_estimate;
+    double est_offset_ns;       // at est_t_ns
+    double est_skew_ppm;
+    uint64_t est_t_ns, last_sync_ns;
+
+    // Statistics
+    unsigned long exchanges, dropped;
+    lhist_t path_delay;
+} netsync_t;
+
+int netsync_leader_open(netsync_t *n, int port, netsync_position_fn position, void *ctx);
+// host:port of the leader; sync receives the leader's show position
+int netsync_follower_open(netsync_t *n, const char *host, int port, avsync_t *sync);
+// Follower only: each message is delayed by delay_us plus up to jitter_us
+// and dropped with probability loss_pct
+void netsync_set_impairment(netsync_t *n, long delay_us, long jitter_us, int loss_pct);
+
+int netsync_start(netsync_t *n);
+void netsync_stop(netsync_t *n);   // also closes the socket
+
+// Follower: leader clock minus local clock at now, 0 until estimated
+int64_t netsync_offset_ns(const netsync_t *n, uint64_t now);
+void netsync_report(const netsync_t *n, FILE *f);
+
+#endif
@@ -0,0 +1,153 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "pcm_out.h"
+#include "timeutil.h"
+
+enum { FAULT_XRUN, FAULT_STALL };
+
+typedef struct {
+    int kind;
+    uint64_t at_ns, ms;
+} pcm_fault_t;
+
+// One faulty device per process is enough for a test hook
+static pcm_fault_t faults[PCM_FAULT_MAX];
+static int fault_count, next_fault;
+static unsigned injected[2];
+static uint64_t first_write_ns;
+
+int pcm_access_parse(const char *name) {
+    if (strcmp(name, "rw") == 0) return PCM_ACCESS_RW;
+    if (strcmp(name, "mmap") == 0) return PCM_ACCESS_MMAP;
+    return -1;
+}
+
+const char *pcm_access_name(int access) {
+    return access == PCM_ACCESS_MMAP ? "mmap" : "rw";
+}
+
+int pcm_set_access(snd_pcm_t *pcm, snd_pcm_hw_params_t *params, int access) {
+    if (access == PCM_ACCESS_MMAP) {
+        int err = snd_pcm_hw_params_set_access(pcm, params, SND_PCM_ACCESS_MMAP_INTERLEAVED);
+        if (err == 0)
+            return PCM_ACCESS_MMAP;
+        fprintf(stderr, "pcm: no mmap access (%s), using writei\n", snd_strerror(err));
+    }
+    snd_pcm_hw_params_set_access(pcm, params, SND_PCM_ACCESS_RW_INTERLEAVED);
+    return PCM_ACCESS_RW;
+}
+
+int pcm_out_set_faults(const char *spec) {
+    char buf[512];
+    snprintf(buf, sizeof(buf), "%s", spec);
+    fault_count = next_fault = 0;
+    for (char *save, *tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        char kind[8];
+        double at;
+        unsigned ms = 0;
+        if (fault_count == PCM_FAULT_MAX || sscanf(tok, "%7[a-z]@%lf:%u", kind, &at, &ms) < 2)
+            return -1;
+        pcm_fault_t *f = &faults[fault_count];
+        if (strcmp(kind, "xrun") == 0) f->kind = FAULT_XRUN;
+        else if (strcmp(kind, "stall") == 0) f->kind = FAULT_STALL;
+        else return -1;
+        f->at_ns = (uint64_t)(at * 1e9);
+        f->ms = ms ? ms : f->kind == FAULT_XRUN ? PCM_FAULT_XRUN_MS : PCM_FAULT_STALL_MS;
+        if (fault_count && f->at_ns < faults[fault_count - 1].at_ns)
+            return -1;
+        fault_count++;
+    }
+    return 0;
+}
+
+void pcm_out_fault_counts(unsigned *xruns, unsigned *stalls) {
+    *xruns = injected[FAULT_XRUN];
+    *stalls = injected[FAULT_STALL];
+}
+
+static void inject_faults(snd_pcm_t *pcm) {
+    uint64_t now = now_ns();
+    if (!first_write_ns)
+        first_write_ns = now;
+    while (next_fault < fault_count && now - first_write_ns >= faults[next_fault].at_ns) {
+        const pcm_fault_t *f = &faults[next_fault++];
+        if (f->kind == FAULT_XRUN) {
+            // Starve the device: wait until it has played everything queued
+            snd_pcm_uframes_t buffer, period;
+            snd_pcm_sframes_t avail;
+            if (snd_pcm_get_params(pcm, &buffer, &period) == 0)
+                while ((avail = snd_pcm_avail_update(pcm)) >= 0 && (snd_pcm_uframes_t)avail < buffer)
+                    sleep_until_ns(now_ns() + 1000000);
+        }
+        sleep_until_ns(now_ns() + f->ms * 1000000);
+        injected[f->kind]++;
+        now = now_ns();
+    }
+}
+
+static snd_pcm_sframes_t mmap_write(snd_pcm_t *pcm, const int16_t *src,
+                                    snd_pcm_uframes_t frames, unsigned channels) {
+    size_t frame_bytes = channels * sizeof(int16_t);
+    snd_pcm_uframes_t done = 0;
+    while (done < frames) {
+        snd_pcm_sframes_t avail = snd_pcm_avail_update(pcm);
+        if (avail < 0)
+            return avail;
+        if (avail == 0) {
+            // Ring full: wait for the device to free a period
+            int err = snd_pcm_wait(pcm, PCM_OUT_WAIT_MS);
+            if (err < 0)
+                return err;
+            if (err == 0)
+                return -EIO;
+            continue;
+        }
+
+        // The area may end at the ring's wrap point before all frames fit
+        const snd_pcm_channel_area_t *areas;
+        snd_pcm_uframes_t offset, n = frames - done;
+        int err = snd_pcm_mmap_begin(pcm, &areas, &offset, &n);
+        if (err < 0)
+            return err;
+        // Interleaved: channel 0's area addresses whole frames
+        char *dst = (char *)areas[0].addr + areas[0].first / 8 + offset * (areas[0].step / 8);
+        if (src)
+            memcpy(dst, src + done * channels, n * frame_bytes);
+        else
+            memset(dst, 0, n * frame_bytes);
+        snd_pcm_sframes_t committed = snd_pcm_mmap_commit(pcm, offset, n);
+        if (committed < 0)
+            return committed;
+        if ((snd_pcm_uframes_t)committed != n)
+            return -EPIPE;
+        done += n;
+
+        // Commit does not apply the start threshold; start like writei would
+        if (snd_pcm_state(pcm) == SND_PCM_STATE_PREPARED && (err = snd_pcm_start(pcm)) < 0)
+            return err;
+    }
+    return done;
+}
+
+snd_pcm_sframes_t pcm_out_write(snd_pcm_t *pcm, int access, const int16_t *src,
+                                snd_pcm_uframes_t frames, unsigned channels) {
+    if (fault_count)
+        inject_faults(pcm);
+    if (access == PCM_ACCESS_MMAP)
+        return mmap_write(pcm, src, frames, channels);
+    if (src)
+        return snd_pcm_writei(pcm, src, frames);
+
+    static const int16_t zeros[1024 * 2];
+    snd_pcm_uframes_t done = 0, chunk = sizeof(zeros) / (channels * sizeof(int16_t));
+    while (done < frames) {
+        snd_pcm_uframes_t n = frames - done < chunk ? frames - done : chunk;
+        snd_pcm_sframes_t w = snd_pcm_writei(pcm, zeros, n);
+        if (w < 0)
+            return w;
+        done += w;
+    }
+    return done;
+}
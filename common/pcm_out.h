@@ -0,0 +1,46 @@
+#ifndef PCM_OUT_H
+#define PCM_OUT_H
+
+#include <stdint.h>
+#include <alsa/asoundlib.h>
+
+// Two ways to hand interleaved S16 frames to ALSA:
+//
+//   rw    snd_pcm_writei, ALSA copies from our buffer into its own
+//   mmap  snd_pcm_mmap_begin/commit: the source (a mapped WAV, the
+//         decoder ring) is copied straight into the device ring, with no
+//         period buffer in between and no copy inside the write call
+//
+// pcm_out_write blocks like writei until every frame is queued, so a
+// caller can switch between the two without changing its pacing.
+
+enum { PCM_ACCESS_RW, PCM_ACCESS_MMAP };
+
+#define PCM_OUT_WAIT_MS 1000    // longest wait for room in the device ring
+#define PCM_FAULT_MAX      32
+#define PCM_FAULT_STALL_MS 20   // default writer stall
+#define PCM_FAULT_XRUN_MS  50   // default silence after the device ran dry
+
+// "rw" or "mmap", -1 for anything else
+int pcm_access_parse(const char *name);
+const char *pcm_access_name(int access);
+
+// Request the access on hw params before snd_pcm_hw_params. A device
+// without mmap support falls back to rw. Returns the access in use.
+int pcm_set_access(snd_pcm_t *pcm, snd_pcm_hw_params_t *params, int access);
+
+// Fault injection for testing recovery, e.g. "xrun@5,stall@12:80,xrun@20:300".
+// Times are seconds after the first pcm_out_write. A stall blocks the
+// writer for the given ms; an xrun blocks it until the device has played
+// everything queued and then for the given ms more, a real underrun on
+// any device (the null and file plugins make a simulated PCM). Returns -1
+// for a malformed spec.
+int pcm_out_set_faults(const char *spec);
+void pcm_out_fault_counts(unsigned *xruns, unsigned *stalls);
+
+// Queue frames (src NULL = silence). Returns frames written or a negative
+// ALSA error for snd_pcm_recover.
+snd_pcm_sframes_t pcm_out_write(snd_pcm_t *pcm, int access, const int16_t *src,
+                                snd_pcm_uframes_t frames, unsigned channels);
+
+#endif
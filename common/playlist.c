@@ -0,0 +1,290 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bam.h"
+#include "playlist.h"
+#include "timeutil.h"
+
+void playlist_init(playlist_t *pl, gpio_backend_t *gpio, int leds, unsigned window_ms) {
+    memset(pl, 0, sizeof(*pl));
+    pl->gpio = gpio;
+    pl->leds = leds;
+    pl->window_ms = window_ms;
+    atomic_init(&pl->audio_track, 0);
+    atomic_init(&pl->led_track, 0);
+    atomic_init(&pl->stop, 0);
+    atomic_init(&pl->led_table, NULL);
+    atomic_init(&pl->led_epoch, 0);
+    atomic_init(&pl->led_exited, 0);
+    pthread_mutex_init(&pl->lock, NULL);
+}
+
+int playlist_add(playlist_t *pl, const char *audio_path, const char *show_path) {
+    if (pl->count == PLAYLIST_MAX) {
+        fprintf(stderr, "playlist: more than %d tracks\n", PLAYLIST_MAX);
+        return -1;
+    }
+    track_t *t = &pl->track[pl->count++];
+    t->audio_path = audio_path ? strdup(audio_path) : NULL;
+    t->show_path = strdup(show_path);
+    atomic_init(&t->state, TRACK_PENDING);
+    atomic_init(&t->table, NULL);
+    return 0;
+}
+
+int playlist_read(playlist_t *pl, const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    char line[1024], audio_path[512], show_path[512];
+    int n = 0, lineno = 0;
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        char *p = line;
+        while (isspace((unsigned char)*p)) p++;
+        if (*p == '#' || *p == '\0')
+            continue;
+        if (sscanf(p, "%511s %511s", audio_path, show_path) != 2) {
+            fprintf(stderr, "%s:%d: expected \"track show\"\n", path, lineno);
+            fclose(f);
+            return -1;
+        }
+        if (playlist_add(pl, audio_path, show_path) < 0) {
+            fclose(f);
+            return -1;
+        }
+        n++;
+    }
+    fclose(f);
+    return n;
+}
+
+static int plan_table(playlist_t *pl, show_table_t *tb) {
+    gpio_backend_t *gpio = pl->gpio;
+    const show_t *s = &tb->show;
+    if (gpio_plan_init(&tb->plan, gpio, s->frame_count * (pl->bam ? BAM_BITS : 1)) < 0)
+        return -1;
+    for (uint32_t i = 0; i < s->frame_count; ++i) {
+        if (!pl->bam) {
+            gpio_plan_set(&tb->plan, gpio, i, show_record(s, i)->bits, s->channels);
+            continue;
+        }
+        // An on/off show in a BAM run: lit channels at full level
+        uint8_t full[GPIO_MAX_LINES];
+        const uint8_t *levels = show_levels(s, i);
+        if (!levels) {
+            for (uint32_t c = 0; c < s->channels; ++c)
+                full[c] = (show_record(s, i)->bits[c / 32] >> (c % 32)) & 1 ? 255 : 0;
+            levels = full;
+        }
+        bam_map(gpio, levels, s->channels, gpio_plan_frame(&tb->plan, i * BAM_BITS));
+    }
+    if (!pl->bam && transition_plan_init(&tb->transitions, gpio, &tb->plan) < 0) {
+        gpio_plan_free(&tb->plan);
+        return -1;
+    }
+    return 0;
+}
+
+static void free_table(playlist_t *pl, show_table_t *tb) {
+    if (!pl->bam)
+        transition_plan_free(&tb->transitions);
+    gpio_plan_free(&tb->plan);
+    show_close(&tb->show);
+    free(tb);
+}
+
+// Load and plan a show for this run. The first one decides the output
+// mode. NULL when it cannot be played here.
+static show_table_t *load_table(playlist_t *pl, const char *path, int first, uint64_t *show_ns) {
+    show_table_t *tb = calloc(1, sizeof(*tb));
+    if (!tb) {
+        perror("playlist");
+        return NULL;
+    }
+    uint64_t t0 = now_ns();
+    if (show_load(&tb->show, path) < 0)
+        goto failed;
+    if (tb->show.channels > (uint32_t)pl->leds) {
+        fprintf(stderr, "playlist: %s has %u channels, only %d LEDs are wired\n",
+                path, tb->show.channels, pl->leds);
+        goto failed_show;
+    }
+    *show_ns = now_ns() - t0;
+    if (first) {
+        pl->bam = (tb->show.flags & SHOW_FLAG_LEVELS) != 0;
+    } else if ((tb->show.flags & SHOW_FLAG_LEVELS) && !pl->bam) {
+        // No BAM thread in this run; an on/off show in a BAM run is fine
+        fprintf(stderr, "playlist: %s has brightness levels, the run plays on/off frames\n", path);
+        goto failed_show;
+    }
+    if (plan_table(pl, tb) < 0)
+        goto failed_show;
+    return tb;
+
+failed_show:
+    show_close(&tb->show);
+failed:
+    free(tb);
+    return NULL;
+}
+
+int playlist_load(playlist_t *pl, int i) {
+    track_t *t = &pl->track[i];
+    uint64_t t0 = now_ns();
+    if (t->audio_path && wav_stream_open(&t->audio, t->audio_path, pl->window_ms) < 0)
+        goto failed;
+    if (t->audio_path && pl->sample_rate && (t->audio.sample_rate != pl->sample_rate || t->audio.channels != pl->channels)) {
+        fprintf(stderr, "playlist: %s is %u Hz/%u ch, the PCM runs %u Hz/%u ch, skipped\n", t->audio_path,
+                t->audio.sample_rate, t->audio.channels, pl->sample_rate, pl->channels);
+        goto failed_audio;
+    }
+
+    uint64_t t1 = now_ns();
+    show_table_t *tb = load_table(pl, t->show_path, i == 0, &t->show_ns);
+    if (!tb)
+        goto failed_audio;
+    if (i == 0) {
+        // The first track sets the format of the run
+        pl->sample_rate = t->audio.sample_rate;
+        pl->channels = t->audio.channels;
+    }
+    atomic_store_explicit(&t->table, tb, memory_order_relaxed);
+
+    t->ready_ns = now_ns();
+    t->audio_ns = t1 - t0;
+    t->plan_ns = t->ready_ns - t1 - t->show_ns;
+    t->start_frame = pl->end_frame;
+    pl->end_frame += t->audio.frames;
+    atomic_store_explicit(&t->state, TRACK_READY, memory_order_release);
+    return 0;
+
+failed_audio:
+    wav_stream_close(&t->audio);
+failed:
+    fprintf(stderr, "playlist: track %d (%s) skipped\n", i + 1, t->audio_path ? t->audio_path : t->show_path);
+    atomic_store_explicit(&t->state, TRACK_FAILED, memory_order_release);
+    return -1;
+}
+
+int playlist_reload(playlist_t *pl, int i, const char *show_path) {
+    uint64_t show_ns;
+    show_table_t *tb = load_table(pl, show_path, 0, &show_ns);
+    if (!tb)
+        return -1;
+
+    pthread_mutex_lock(&pl->lock);
+    track_t *t = &pl->track[i];
+    if (atomic_load_explicit(&t->state, memory_order_acquire) != TRACK_READY) {
+        pthread_mutex_unlock(&pl->lock);
+        free_table(pl, tb);
+        return -1;
+    }
+    uint64_t t0 = now_ns();
+    unsigned epoch = atomic_load_explicit(&pl->led_epoch, memory_order_acquire);
+    show_table_t *old = atomic_exchange_explicit(&t->table, tb, memory_order_acq_rel);
+
+    // A wakeup that began before the swap may still read the old table:
+    // wait for one to finish, and for the pins to move off it
+    while (!atomic_load_explicit(&pl->led_exited, memory_order_relaxed) &&
+           (atomic_load_explicit(&pl->led_epoch, memory_order_acquire) == epoch ||
+            atomic_load_explicit(&pl->led_table, memory_order_relaxed) == old))
+        sleep_until_ns(now_ns() + PLAYLIST_GRACE_POLL_MS * 1000000ull);
+    // The BAM thread may have taken the old planes just before the switch
+    if (pl->bam_engine)
+        bam_quiescent(pl->bam_engine);
+    free_table(pl, old);
+
+    uint64_t grace = now_ns() - t0;
+    if (grace > pl->max_grace_ns)
+        pl->max_grace_ns = grace;
+    pl->swaps++;
+    pthread_mutex_unlock(&pl->lock);
+    return 0;
+}
+
+static void release_track(playlist_t *pl, track_t *t) {
+    free_table(pl, atomic_load_explicit(&t->table, memory_order_relaxed));
+    atomic_store_explicit(&t->table, NULL, memory_order_relaxed);
+    wav_stream_close(&t->audio);
+    atomic_store_explicit(&t->state, TRACK_RELEASED, memory_order_release);
+}
+
+// Tracks before the one on the LEDs are done with, including its images
+static void release_behind(playlist_t *pl) {
+    int led = atomic_load_explicit(&pl->led_track, memory_order_acquire);
+    int waited = 0;
+    pthread_mutex_lock(&pl->lock);
+    for (int i = 0; i < led; ++i) {
+        if (atomic_load_explicit(&pl->track[i].state, memory_order_relaxed) != TRACK_READY)
+            continue;
+        // led_track moves on once a frame of track led is set: after one
+        // more BAM slot no plane of the earlier tracks is being read
+        if (pl->bam_engine && !waited++)
+            bam_quiescent(pl->bam_engine);
+        release_track(pl, &pl->track[i]);
+    }
+    pthread_mutex_unlock(&pl->lock);
+}
+
+static void *loader_fn(void *arg) {
+    playlist_t *pl = arg;
+    int prev = 0;
+    for (int i = 1; i < pl->count; ++i) {
+        // One track ahead: start on i once the writer has reached the
+        // last track loaded before it
+        while (!atomic_load_explicit(&pl->stop, memory_order_relaxed) &&
+               atomic_load_explicit(&pl->audio_track, memory_order_acquire) < prev) {
+            release_behind(pl);
+            sleep_until_ns(now_ns() + PLAYLIST_POLL_MS * 1000000ull);
+        }
+        if (atomic_load_explicit(&pl->stop, memory_order_relaxed))
+            return NULL;
+        if (playlist_load(pl, i) == 0)
+            prev = i;
+    }
+    while (!atomic_load_explicit(&pl->stop, memory_order_relaxed)) {
+        release_behind(pl);
+        sleep_until_ns(now_ns() + PLAYLIST_POLL_MS * 1000000ull);
+    }
+    return NULL;
+}
+
+int playlist_start(playlist_t *pl) {
+    if (pthread_create(&pl->loader, NULL, loader_fn, pl) != 0) {
+        perror("playlist loader");
+        return -1;
+    }
+    pl->loader_running = 1;
+    return 0;
+}
+
+void playlist_close(playlist_t *pl) {
+    if (pl->loader_running) {
+        atomic_store(&pl->stop, 1);
+        pthread_join(pl->loader, NULL);
+        pl->loader_running = 0;
+    }
+    for (int i = 0; i < pl->count; ++i) {
+        if (atomic_load(&pl->track[i].state) == TRACK_READY)
+            release_track(pl, &pl->track[i]);
+        free(pl->track[i].audio_path);
+        free(pl->track[i].show_path);
+    }
+    pl->count = 0;
+}
+
+int playlist_next(playlist_t *pl, int i) {
+    for (int j = i + 1; j < pl->count; ++j) {
+        int state = atomic_load_explicit(&pl->track[j].state, memory_order_acquire);
+        if (state == TRACK_PENDING)
+            return -1;
+        if (state == TRACK_READY)
+            return j;
+    }
+    return pl->count;
+}
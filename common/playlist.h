@@ -0,0 +1,127 @@
+#ifndef PLAYLIST_H
+#define PLAYLIST_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "bam.h"
+#include "gpio.h"
+#include "show.h"
+#include "transition.h"
+#include "wav_stream.h"
+
+// Tracks with their shows, played back to back on one open PCM and GPIO
+// backend. While track i plays, a normal-priority loader thread prepares
+// track i + 1: the WAV is mapped with its first window resident, the show
+// loaded and the GPIO images and write order planned. The audio writer
+// carries on into the next track within the same period and the LED
+// thread switches at the frame where its audio begins, so there is no gap.
+//
+// The tracks sit end to end on one timeline counted in frames
+// (start_frame). Every track must match the first one's rate and channel
+// count; one that does not, or fails to load, is skipped. Tracks the LED
+// thread has left are released by the loader.
+//
+// A track's show and its GPIO images form one show table, reached through
+// an atomic pointer. A new table (control "load", a changed show file) is
+// built off to the side and published with one store; the LED thread
+// picks it up at its next wakeup without a lock. The old table is freed
+// once the LED thread has passed a wakeup since the swap and no longer
+// has a frame of it on the pins, and in a BAM run once the BAM thread has
+// finished the slot that may still have been reading its planes.
+//
+// Playlist file: one "track.wav show.txt|show.show" per line, '#' comments.
+// A track without audio (NULL path) is a show alone, for a follower.
+
+#define PLAYLIST_MAX     256
+#define PLAYLIST_POLL_MS 10     // loader period while it waits or releases
+#define PLAYLIST_GRACE_POLL_MS 1  // table swap: check for the LED thread's next wakeup
+
+enum { TRACK_PENDING, TRACK_READY, TRACK_FAILED, TRACK_RELEASED };
+
+typedef struct {
+    show_t show;
+    gpio_plan_t plan;               // BAM_BITS images per frame for a BAM run
+    transition_plan_t transitions;  // not used for a BAM run
+} show_table_t;
+
+typedef struct {
+    char *audio_path, *show_path;
+    atomic_int state;
+    wav_stream_t audio;
+    _Atomic(show_table_t *) table;
+    int64_t start_frame;            // first frame on the playlist timeline
+    uint64_t ready_ns;              // load finished
+    uint64_t audio_ns, show_ns, plan_ns;  // load time breakdown
+    uint64_t start_ns;              // set by the player: audio writer reached it
+    int64_t gap_ns;                 // set by the player: silence before it
+} track_t;
+
+typedef struct {
+    track_t track[PLAYLIST_MAX];
+    int count;
+    gpio_backend_t *gpio;
+    int leds;                   // lines wired, the most channels a show may have
+    unsigned window_ms;         // wav_stream window
+    int bam;                    // decided by the first track: BAM planes or on/off frames
+    bam_t *bam_engine;          // set by the player before the loader starts in a BAM run
+    uint32_t sample_rate;       // of the first track
+    uint16_t channels;
+    int64_t end_frame;          // where the next loaded track starts
+
+    atomic_int audio_track;     // track the audio writer has reached
+    atomic_int led_track;       // track the LED thread shows, older ones can go
+    atomic_int stop;
+    pthread_t loader;
+    int loader_running;
+    pthread_mutex_t lock;       // loader releases vs. table swaps and pause rewinds, never the LED thread
+
+    // Grace periods for table swaps, written by the LED thread only
+    _Atomic(show_table_t *) led_table;  // whose frame is on the pins
+    atomic_uint led_epoch;              // wakeups finished
+    atomic_int led_exited;
+    unsigned long swaps;
+    uint64_t max_grace_ns;
+} playlist_t;
+
+void playlist_init(playlist_t *pl, gpio_backend_t *gpio, int leds, unsigned window_ms);
+int playlist_add(playlist_t *pl, const char *audio_path, const char *show_path);
+// Append the entries of a playlist file. Returns the number added or -1.
+int playlist_read(playlist_t *pl, const char *path);
+
+// Load track i on the calling thread (the first one, before playback).
+// Returns 0, or -1 when the track failed and is to be skipped.
+int playlist_load(playlist_t *pl, int i);
+// Loader thread for the tracks after the first
+int playlist_start(playlist_t *pl);
+// Stop the loader and release every track
+void playlist_close(playlist_t *pl);
+
+// Replace track i's show table with one loaded from show_path. Blocks
+// the caller (never the LED thread) until the old table can be freed.
+// Returns 0, or -1 when the new show does not load or does not fit the
+// run (channels, levels without BAM); the old table then stays.
+int playlist_reload(playlist_t *pl, int i, const char *show_path);
+
+// LED thread, at the end of every wakeup: it holds no table now except
+// on_pins, the one it last wrote a frame from
+static inline void playlist_led_quiescent(playlist_t *pl, show_table_t *on_pins) {
+    atomic_store_explicit(&pl->led_table, on_pins, memory_order_relaxed);
+    atomic_fetch_add_explicit(&pl->led_epoch, 1, memory_order_release);
+}
+
+static inline void playlist_led_exit(playlist_t *pl) {
+    atomic_store_explicit(&pl->led_exited, 1, memory_order_relaxed);
+    playlist_led_quiescent(pl, NULL);
+}
+
+// The first ready track after i: its index, -1 while the loader is still
+// working on it, pl->count at the end of the list. Never blocks.
+int playlist_next(playlist_t *pl, int i);
+
+static inline int64_t playlist_end_frame(const track_t *t) {
+    return t->start_frame + (int64_t)t->audio.frames;
+}
+
+#endif
@@ -0,0 +1,247 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "rt.h"
+
+#ifndef MCL_ONFAULT
+#define MCL_ONFAULT 4
+#endif
+
+typedef struct {
+    unsigned long minflt, majflt, nvcsw, nivcsw;
+} rt_usage_t;
+
+typedef struct {
+    const char *name;
+    pid_t tid;
+    int cpu, priority;
+    int done;
+    rt_usage_t base, last;
+} rt_thread_t;
+
+static rt_thread_t threads[RT_MAX_THREADS];
+static int thread_count;
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// "0-2,5" -> mask
+static uint64_t parse_cpu_list(const char *s) {
+    uint64_t mask = 0;
+    while (*s && *s != '\n') {
+        char *end;
+        long lo = strtol(s, &end, 10), hi = lo;
+        if (end == s) break;
+        if (*end == '-') hi = strtol(end + 1, &end, 10);
+        for (long c = lo; c <= hi && c < 64; ++c)
+            mask |= 1ull << c;
+        s = *end == ',' ? end + 1 : end;
+    }
+    return mask;
+}
+
+uint64_t rt_isolated_cpus(void) {
+    char buf[256] = "";
+    FILE *f = fopen("/sys/devices/system/cpu/isolated", "r");
+    if (!f) return 0;
+    if (!fgets(buf, sizeof(buf), f)) buf[0] = '\0';
+    fclose(f);
+    return parse_cpu_list(buf);
+}
+
+int rt_profile_init(rt_profile_t *p, const char *spec) {
+    p->led_cpu = p->audio_cpu = p->log_cpu = -1;
+
+    // LED thread on the highest isolated CPU, audio on the next one down
+    uint64_t isolated = rt_isolated_cpus();
+    if (isolated) {
+        uint64_t rest = isolated;
+        p->led_cpu = 63 - __builtin_clzll(rest);
+        rest &= ~(1ull << p->led_cpu);
+        p->audio_cpu = rest ? 63 - __builtin_clzll(rest) : p->led_cpu;
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        for (int c = 0; c < n && c < 64; ++c)
+            if (!((isolated >> c) & 1)) {
+                p->log_cpu = c;
+                break;
+            }
+    }
+
+    if (!spec || !*spec)
+        return 0;
+    char buf[128];
+    snprintf(buf, sizeof(buf), "%s", spec);
+    for (char *save, *tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        char *eq = strchr(tok, '=');
+        if (!eq) return -1;
+        *eq = '\0';
+        int cpu = atoi(eq + 1);
+        if (strcmp(tok, "led") == 0) p->led_cpu = cpu;
+        else if (strcmp(tok, "audio") == 0) p->audio_cpu = cpu;
+        else if (strcmp(tok, "log") == 0) p->log_cpu = cpu;
+        else return -1;
+    }
+    return 0;
+}
+
+void rt_profile_print(const rt_profile_t *p, FILE *f) {
+    uint64_t iso = rt_isolated_cpus();
+    fprintf(f, "RT: LED cpu %d, audio cpu %d, log cpu %d (-1 = any), isolated cpus mask 0x%llx\n",
+            p->led_cpu, p->audio_cpu, p->log_cpu, (unsigned long long)iso);
+}
+
+int rt_lock_memory(void) {
+    if (mlockall(MCL_CURRENT | MCL_FUTURE | MCL_ONFAULT) == 0)
+        return 0;
+    // Kernels before 4.4: lock what is mapped now, wav_stream locks its window
+    if (errno == EINVAL && mlockall(MCL_CURRENT) == 0)
+        return 0;
+    perror("rt: mlockall (page faults may hit the RT threads)");
+    return -1;
+}
+
+int rt_pin_thread(pthread_t t, int cpu) {
+    if (cpu < 0)
+        return 0;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int err = pthread_setaffinity_np(t, sizeof(set), &set);
+    if (err)
+        fprintf(stderr, "rt: pin to cpu %d: %s\n", cpu, strerror(err));
+    return err;
+}
+
+int rt_thread_create(pthread_t *t, int priority, int cpu, void *(*fn)(void *), void *arg) {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if (cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+    }
+    int err = EPERM;
+    if (priority > 0) {
+        struct sched_param param = {.sched_priority = priority};
+        pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+        pthread_attr_setschedparam(&attr, &param);
+        err = pthread_create(t, &attr, fn, arg);
+        if (err == EPERM) {
+            fprintf(stderr, "rt: no permission for SCHED_FIFO %d, running at normal priority\n", priority);
+            pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+        }
+    }
+    if (err == EPERM)
+        err = pthread_create(t, &attr, fn, arg);
+    if (err == EINVAL && cpu >= 0) {
+        fprintf(stderr, "rt: cpu %d not available, thread not pinned\n", cpu);
+        pthread_attr_destroy(&attr);
+        return rt_thread_create(t, priority, -1, fn, arg);
+    }
+    pthread_attr_destroy(&attr);
+    return err;
+}
+
+// Touch the stack below us so the first deadlines do not fault it in
+static void __attribute__((noinline)) prefault_stack(void) {
+    char buf[RT_STACK_PREFAULT];
+    memset(buf, 0, sizeof(buf));
+    __asm__ volatile("" : : "r"(buf) : "memory");
+}
+
+static int read_usage(pid_t tid, rt_usage_t *u) {
+    char path[64], line[256];
+    snprintf(path, sizeof(path), "/proc/self/task/%d/stat", (int)tid);
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    // Fields after "(comm)": state ppid pgrp session tty tpgid flags minflt cminflt majflt
+    int ok = fgets(line, sizeof(line), f) != NULL;
+    fclose(f);
+    char *p = ok ? strrchr(line, ')') : NULL;
+    if (!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %lu %*u %lu", &u->minflt, &u->majflt) != 2)
+        return -1;
+
+    snprintf(path, sizeof(path), "/proc/self/task/%d/status", (int)tid);
+    if (!(f = fopen(path, "r"))) return -1;
+    while (fgets(line, sizeof(line), f)) {
+        sscanf(line, "voluntary_ctxt_switches: %lu", &u->nvcsw);
+        sscanf(line, "nonvoluntary_ctxt_switches: %lu", &u->nivcsw);
+    }
+    fclose(f);
+    return 0;
+}
+
+// The one CPU the thread may run on, -1 when not pinned
+static int pinned_cpu(pid_t tid) {
+    cpu_set_t set;
+    if (sched_getaffinity(tid, sizeof(set), &set) != 0 || CPU_COUNT(&set) != 1)
+        return -1;
+    for (int c = 0; c < CPU_SETSIZE; ++c)
+        if (CPU_ISSET(c, &set)) return c;
+    return -1;
+}
+
+static rt_thread_t *self_entry(void) {
+    pid_t tid = (pid_t)syscall(SYS_gettid);
+    for (int i = 0; i < thread_count; ++i)
+        if (threads[i].tid == tid && !threads[i].done)
+            return &threads[i];
+    return NULL;
+}
+
+void rt_thread_enter(const char *name) {
+    prefault_stack();
+
+    pthread_mutex_lock(&registry_lock);
+    if (thread_count < RT_MAX_THREADS) {
+        rt_thread_t *t = &threads[thread_count++];
+        memset(t, 0, sizeof(*t));
+        t->name = name;
+        t->tid = (pid_t)syscall(SYS_gettid);
+        t->cpu = pinned_cpu(t->tid);
+        int policy;
+        struct sched_param param;
+        if (pthread_getschedparam(pthread_self(), &policy, &param) == 0 && policy == SCHED_FIFO)
+            t->priority = param.sched_priority;
+        read_usage(t->tid, &t->base);
+    }
+    pthread_mutex_unlock(&registry_lock);
+}
+
+void rt_thread_exit(void) {
+    struct rusage ru;
+    if (getrusage(RUSAGE_THREAD, &ru) != 0)
+        return;
+    pthread_mutex_lock(&registry_lock);
+    rt_thread_t *t = self_entry();
+    if (t) {
+        t->last = (rt_usage_t){ru.ru_minflt, ru.ru_majflt, ru.ru_nvcsw, ru.ru_nivcsw};
+        t->done = 1;
+    }
+    pthread_mutex_unlock(&registry_lock);
+}
+
+void rt_report(FILE *f) {
+    pthread_mutex_lock(&registry_lock);
+    fprintf(f, "%-14s %4s %4s %10s %10s %10s %10s\n", "thread", "cpu", "prio", "minflt", "majflt", "vcsw", "ivcsw");
+    for (int i = 0; i < thread_count; ++i) {
+        rt_thread_t *t = &threads[i];
+        // Modules start their threads before the caller pins them
+        if (!t->done) {
+            read_usage(t->tid, &t->last);
+            t->cpu = pinned_cpu(t->tid);
+        }
+        fprintf(f, "%-14s %4d %4d %10lu %10lu %10lu %10lu%s\n", t->name, t->cpu, t->priority,
+                t->last.minflt - t->base.minflt, t->last.majflt - t->base.majflt,
+                t->last.nvcsw - t->base.nvcsw, t->last.nivcsw - t->base.nivcsw, t->done ? "" : "  (running)");
+    }
+    pthread_mutex_unlock(&registry_lock);
+}
@@ -0,0 +1,58 @@
+#ifndef RT_H
+#define RT_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+// Real-time setup shared by the players: SCHED_FIFO threads pinned to a
+// CPU, memory locked so nothing the RT threads touch is paged out, stacks
+// prefaulted before the first deadline, and per-thread accounting of
+// page faults and context switches for the run report.
+//
+// Memory is locked with MCL_ONFAULT where the kernel has it: pages are
+// locked as they are first touched, so a mapped WAV is not pulled in as
+// a whole and wav_stream's sliding window keeps working. Everything an
+// RT thread uses must then be touched once before the show starts.
+//
+// CPU placement "led=3,audio=2,log=0" (-1 or absent = not pinned). When
+// the kernel was booted with isolcpus=, the RT threads default to the
+// isolated CPUs and logging to the others.
+
+#define RT_PRIO_LED         80
+#define RT_PRIO_AUDIO       75
+#define RT_STACK_PREFAULT   (256 * 1024)
+#define RT_MAX_THREADS      16
+
+typedef struct {
+    int led_cpu, audio_cpu, log_cpu;
+} rt_profile_t;
+
+// Defaults from the isolated CPUs, then "led=N,audio=N,log=N" on top
+// (spec may be NULL). Returns -1 for a malformed spec.
+int rt_profile_init(rt_profile_t *p, const char *spec);
+void rt_profile_print(const rt_profile_t *p, FILE *f);
+
+// Isolated CPUs as a bit mask (CPU i = bit i), 0 if none
+uint64_t rt_isolated_cpus(void);
+
+// mlockall; 0 on success, -1 with a warning (e.g. no CAP_IPC_LOCK)
+int rt_lock_memory(void);
+
+// SCHED_FIFO thread at priority (0 = normal) pinned to cpu (-1 = any).
+// Falls back to normal scheduling without permission. 0 or an errno.
+int rt_thread_create(pthread_t *t, int priority, int cpu, void *(*fn)(void *), void *arg);
+// Pin an existing thread, e.g. one started by a library module
+int rt_pin_thread(pthread_t t, int cpu);
+
+// Call first thing in a thread: prefaults its stack and registers it
+// for rt_report. rt_thread_exit takes the final counts before it ends.
+void rt_thread_enter(const char *name);
+void rt_thread_exit(void);
+
+// Faults and context switches of every registered thread since it
+// entered: live threads from /proc, finished ones from getrusage
+void rt_report(FILE *f);
+
+#endif
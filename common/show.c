@@ -0,0 +1,392 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "show.h"
+
+_Static_assert(sizeof(show_header_t) == 64, "show header must stay 64 bytes");
+
+#define SHOW_MAX_CHANNELS 256  // same as GPIO_MAX_LINES
+
+struct show_writer {
+    FILE *f;
+    show_header_t hdr;
+    uint32_t words;
+    uint64_t last_t_us;
+    uint8_t record[8 + 4 * (SHOW_MAX_CHANNELS / 32) + SHOW_MAX_CHANNELS];
+};
+
+uint32_t show_crc32(uint32_t crc, const void *data, size_t len) {
+    static uint32_t table[256];
+    if (!table[1]) {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k)
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+    }
+    const uint8_t *p = data;
+    crc = ~crc;
+    while (len--)
+        crc = table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+static uint32_t record_size_for(uint32_t channels, uint32_t flags) {
+    uint32_t words = (channels + 31) / 32;
+    uint32_t size = 8 + 4 * words;
+    if (flags & SHOW_FLAG_LEVELS)
+        size += channels;
+    return (size + 7) & ~7u;  // Keep t_us 8-byte aligned in the mapping
+}
+
+int show_open(show_t *s, const char *path) {
+    memset(s, 0, sizeof(*s));
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("show: open");
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(show_header_t)) {
+        fprintf(stderr, "show: %s is too small to be a show\n", path);
+        close(fd);
+        return -1;
+    }
+
+    // MAP_POPULATE prefaults the whole timeline before playback starts
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("show: mmap");
+        return -1;
+    }
+
+    const show_header_t *h = map;
+    const char *err = NULL;
+    if (memcmp(h->magic, SHOW_MAGIC, sizeof(SHOW_MAGIC)) != 0)
+        err = "bad magic";
+    else if (h->version != SHOW_VERSION)
+        err = "unsupported version";
+    else if (h->header_size < sizeof(show_header_t) || h->channels == 0 || h->frame_count == 0 ||
+             h->channels > SHOW_MAX_CHANNELS || h->record_size < record_size_for(h->channels, h->flags))
+        err = "bad header";
+    else if ((uint64_t)h->header_size + (uint64_t)h->frame_count * h->record_size != (uint64_t)st.st_size)
+        err = "truncated file";
+    else if (show_crc32(0, (const uint8_t *)map + h->header_size,
+                        (size_t)h->frame_count * h->record_size) != h->checksum)
+        err = "checksum mismatch";
+    if (err) {
+        fprintf(stderr, "show: %s: %s\n", path, err);
+        munmap(map, st.st_size);
+        return -1;
+    }
+
+    s->hdr = h;
+    s->records = (const uint8_t *)map + h->header_size;
+    s->frame_count = h->frame_count;
+    s->channels = h->channels;
+    s->record_size = h->record_size;
+    s->flags = h->flags;
+    s->duration_us = h->duration_us;
+    s->map_len = st.st_size;
+    return 0;
+}
+
+void show_close(show_t *s) {
+    if (s->hdr && s->owned)
+        free((void *)s->hdr);
+    else if (s->hdr)
+        munmap((void *)s->hdr, s->map_len);
+    memset(s, 0, sizeof(*s));
+}
+
+show_writer_t *show_writer_open(const char *path, uint32_t channels, uint32_t flags) {
+    if (channels == 0 || channels > SHOW_MAX_CHANNELS) {
+        fprintf(stderr, "show: %u channels not supported (max %d)\n", channels, SHOW_MAX_CHANNELS);
+        return NULL;
+    }
+    show_writer_t *w = calloc(1, sizeof(*w));
+    if (!w) return NULL;
+    w->f = fopen(path, "wb");
+    if (!w->f) {
+        perror("show: create");
+        free(w);
+        return NULL;
+    }
+
+    memcpy(w->hdr.magic, SHOW_MAGIC, sizeof(SHOW_MAGIC));
+    w->hdr.version = SHOW_VERSION;
+    w->hdr.header_size = sizeof(show_header_t);
+    w->hdr.record_size = record_size_for(channels, flags);
+    w->hdr.channels = channels;
+    w->hdr.flags = flags;
+    w->words = (channels + 31) / 32;
+
+    // Placeholder header, rewritten with the totals on close
+    fwrite(&w->hdr, sizeof(w->hdr), 1, w->f);
+    return w;
+}
+
+int show_writer_add(show_writer_t *w, uint64_t t_us, const uint32_t *bits, const uint8_t *levels) {
+    if (w->hdr.frame_count && t_us < w->last_t_us) {
+        fprintf(stderr, "show: frame %u goes back in time\n", w->hdr.frame_count);
+        return -1;
+    }
+    memset(w->record, 0, w->hdr.record_size);
+    memcpy(w->record, &t_us, sizeof(t_us));
+    memcpy(w->record + 8, bits, 4 * w->words);
+    if (w->hdr.flags & SHOW_FLAG_LEVELS)
+        memcpy(w->record + 8 + 4 * w->words, levels, w->hdr.channels);
+
+    if (fwrite(w->record, w->hdr.record_size, 1, w->f) != 1)
+        return -1;
+    w->hdr.checksum = show_crc32(w->hdr.checksum, w->record, w->hdr.record_size);
+    w->hdr.frame_count++;
+    w->last_t_us = t_us;
+    return 0;
+}
+
+int show_writer_close(show_writer_t *w, uint64_t duration_us) {
+    int ret = 0;
+    // Players need a frame to show; show_open refuses an empty timeline
+    if (w->hdr.frame_count == 0) {
+        fprintf(stderr, "show: no frames written\n");
+        ret = -1;
+    }
+    w->hdr.duration_us = duration_us;
+    if (fseek(w->f, 0, SEEK_SET) != 0 || fwrite(&w->hdr, sizeof(w->hdr), 1, w->f) != 1)
+        ret = -1;
+    if (fclose(w->f) != 0)
+        ret = -1;
+    free(w);
+    return ret;
+}
+
+// Channel field: '0'/'1' per channel, or two hex digits per channel for
+// levels; '.' is a visual separator only. Returns the channel count or 0.
+static uint32_t parse_field(const char **pp, uint32_t *bits, uint8_t *levels, uint32_t max_channels) {
+    const char *p = *pp;
+    uint32_t n = 0;
+    for (; *p && !isspace((unsigned char)*p); ++p) {
+        if (*p == '.') continue;
+        if (n >= max_channels) return 0;
+        if (bits) {
+            if (*p != '0' && *p != '1') return 0;
+            if (*p == '1') bits[n / 32] |= 1u << (n % 32);
+        } else {
+            if (!isxdigit((unsigned char)p[0]) || !isxdigit((unsigned char)p[1])) return 0;
+            char hex[3] = {p[0], p[1], 0};
+            levels[n] = (uint8_t)strtoul(hex, NULL, 16);
+            p++;
+        }
+        n++;
+    }
+    *pp = p;
+    return n;
+}
+
+int show_parse_line(const char *line, uint64_t *duration_us, uint32_t *bits, uint8_t *levels,
+                    uint32_t max_channels, uint32_t *channels, int *has_levels) {
+    const char *p = line;
+    while (isspace((unsigned char)*p)) p++;
+    if (!isdigit((unsigned char)*p))
+        return 0;
+
+    // From here on the line is meant as a frame: anything wrong is an error
+    // Duration in ms with up to µs resolution: "0650", "12.5", "0.125"
+    char *end;
+    uint64_t us = (uint64_t)strtoull(p, &end, 10) * 1000;
+    if (*end == '.') {
+        uint64_t scale = 100;
+        for (end++; isdigit((unsigned char)*end); end++) {
+            us += (*end - '0') * scale;
+            scale /= 10;
+        }
+    }
+    if (!isspace((unsigned char)*end))
+        return -1;
+    p = end;
+    while (isspace((unsigned char)*p)) p++;
+
+    memset(bits, 0, 4 * ((max_channels + 31) / 32));
+    uint32_t n = parse_field(&p, bits, NULL, max_channels);
+    if (n == 0)
+        return -1;
+
+    // Optional level field, otherwise lit channels are at full brightness
+    while (isspace((unsigned char)*p)) p++;
+    *has_levels = isxdigit((unsigned char)*p);
+    if (*has_levels && parse_field(&p, NULL, levels, max_channels) != n)
+        return -1;
+    for (uint32_t i = 0; i < n; ++i) {
+        int on = (bits[i / 32] >> (i % 32)) & 1;
+        if (!*has_levels)
+            levels[i] = on ? 255 : 0;
+        else if (!on)
+            levels[i] = 0;
+        else if (levels[i] == 0)
+            bits[i / 32] &= ~(1u << (i % 32));  // Lit at level 0 is off
+    }
+
+    *duration_us = us;
+    *channels = n;
+    return 1;
+}
+
+int show_parse_text(show_t *s, FILE *in) {
+    char line[SHOW_MAX_LINE];
+    uint32_t bits[SHOW_MAX_CHANNELS / 32];
+    uint8_t levels[SHOW_MAX_CHANNELS];
+    uint64_t t_us = 0, dur_us;
+    uint32_t channels = 0, n, frames = 0, stage_size = 0;
+    int has_levels, any_levels = 0;
+    long lineno = 0;
+    size_t cap = 0;
+    uint8_t *stage = NULL;
+
+    // Stage every frame with levels, the final layout is only known at the end
+    memset(s, 0, sizeof(*s));
+    while (fgets(line, sizeof(line), in)) {
+        lineno++;
+        int r = show_parse_line(line, &dur_us, bits, levels, SHOW_MAX_CHANNELS, &n, &has_levels);
+        if (r == 0)
+            continue;
+        if (r < 0) {
+            // A dropped frame would shift every later one earlier
+            line[strcspn(line, "\r\n")] = '\0';
+            fprintf(stderr, "show: line %ld: malformed frame \"%.40s\"\n", lineno, line);
+            free(stage);
+            return -1;
+        }
+        if (!stage_size) {
+            channels = n;
+            stage_size = record_size_for(channels, SHOW_FLAG_LEVELS);
+        } else if (n != channels) {
+            fprintf(stderr, "show: line %ld has %u channels, expected %u\n", lineno, n, channels);
+            free(stage);
+            return -1;
+        }
+        if ((size_t)(frames + 1) * stage_size > cap) {
+            cap = cap ? cap * 2 : 256 * (size_t)stage_size;
+            uint8_t *grown = realloc(stage, cap);
+            if (!grown) {
+                free(stage);
+                return -1;
+            }
+            stage = grown;
+        }
+        uint8_t *rec = stage + (size_t)frames * stage_size;
+        memcpy(rec, &t_us, sizeof(t_us));
+        memcpy(rec + 8, bits, 4 * ((channels + 31) / 32));
+        memcpy(rec + 8 + 4 * ((channels + 31) / 32), levels, channels);
+        any_levels |= has_levels;
+        frames++;
+        t_us += dur_us;
+    }
+
+    if (!frames) {
+        fprintf(stderr, "show: no frames found\n");
+        return -1;
+    }
+
+    // Same layout as the file: header followed by the records
+    show_header_t hdr = {0};
+    memcpy(hdr.magic, SHOW_MAGIC, sizeof(SHOW_MAGIC));
+    hdr.version = SHOW_VERSION;
+    hdr.header_size = sizeof(show_header_t);
+    hdr.flags = any_levels ? SHOW_FLAG_LEVELS : 0;
+    hdr.record_size = record_size_for(channels, hdr.flags);
+    hdr.channels = channels;
+    hdr.frame_count = frames;
+    hdr.duration_us = t_us;
+
+    size_t len = hdr.header_size + (size_t)frames * hdr.record_size;
+    uint8_t *mem = calloc(1, len);
+    if (!mem) {
+        free(stage);
+        return -1;
+    }
+    uint32_t copy = 8 + 4 * ((channels + 31) / 32) + (any_levels ? channels : 0);
+    for (uint32_t i = 0; i < frames; ++i) {
+        uint8_t *rec = mem + hdr.header_size + (size_t)i * hdr.record_size;
+        memcpy(rec, stage + (size_t)i * stage_size, copy);
+        hdr.checksum = show_crc32(hdr.checksum, rec, hdr.record_size);
+    }
+    free(stage);
+    memcpy(mem, &hdr, sizeof(hdr));
+
+    s->hdr = (const show_header_t *)mem;
+    s->records = mem + hdr.header_size;
+    s->frame_count = hdr.frame_count;
+    s->channels = hdr.channels;
+    s->record_size = hdr.record_size;
+    s->flags = hdr.flags;
+    s->duration_us = hdr.duration_us;
+    s->map_len = len;
+    s->owned = 1;
+    return 0;
+}
+
+int show_save(const show_t *s, const char *path) {
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        perror("show: create");
+        return -1;
+    }
+    size_t len = s->hdr->header_size + (size_t)s->frame_count * s->record_size;
+    int ret = fwrite(s->hdr, 1, len, f) == len ? 0 : -1;
+    if (fclose(f) != 0)
+        ret = -1;
+    if (ret < 0)
+        perror("show: write");
+    return ret;
+}
+
+long show_compile_text(FILE *in, const char *out_path) {
+    show_t s;
+    if (show_parse_text(&s, in) < 0)
+        return -1;
+    long frames = s.frame_count;
+    if (show_save(&s, out_path) < 0)
+        frames = -1;
+    show_close(&s);
+    return frames;
+}
+
+uint32_t show_find(const show_t *s, uint64_t t_us) {
+    uint32_t lo = 0, hi = s->frame_count;
+    while (hi - lo > 1) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (show_record(s, mid)->t_us <= t_us)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+int show_load(show_t *s, const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        perror("show: open");
+        return -1;
+    }
+    char magic[sizeof(SHOW_MAGIC)] = {0};
+    size_t got = fread(magic, 1, sizeof(magic), f);
+    if (got == sizeof(magic) && memcmp(magic, SHOW_MAGIC, sizeof(magic)) == 0) {
+        fclose(f);
+        return show_open(s, path);
+    }
+    rewind(f);
+    int ret = show_parse_text(s, f);
+    fclose(f);
+    return ret;
+}
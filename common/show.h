@@ -0,0 +1,122 @@
+#ifndef SHOW_H
+#define SHOW_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Compiled show timeline. The text format ("0650 0000.0111", duration in
+// ms then one character per LED; durations may have up to three decimals,
+// "0.125" is 125 µs) is parsed once by show_compile into:
+//
+//   show_header_t                  fixed 64 bytes
+//   record[frame_count]            record_size bytes each
+//
+// Each record holds the absolute start time of the frame in µs from the
+// start of the show followed by the channel bits (bit i of word i/32 is
+// channel i). A frame lasts until the next record starts, the last one
+// until duration_us. All fields are little-endian, as on the Pi.
+//
+// Brightness: a line may carry a third field with two hex digits per
+// channel, "0100 1111.0000 ff80.4010.0000.0000", for channels driven by
+// the BAM engine. Shows with any such line set SHOW_FLAG_LEVELS and every
+// record then has one level byte per channel after the bits (0 when the
+// bit is off, 255 for lines without levels).
+// Players mmap the file and walk the records with no parsing at all.
+
+#define SHOW_MAGIC       "LEDSHOW"
+#define SHOW_VERSION     1
+#define SHOW_MAX_LINE    2048  // room for 256 channels with levels
+#define SHOW_FLAG_LEVELS 0x1
+
+typedef struct {
+    char magic[8];          // "LEDSHOW\0"
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t record_size;
+    uint32_t channels;
+    uint32_t flags;
+    uint32_t frame_count;
+    uint64_t duration_us;
+    uint32_t checksum;      // CRC-32 of all records
+    uint8_t reserved[20];
+} show_header_t;
+
+typedef struct {
+    uint64_t t_us;
+    uint32_t bits[];
+} show_record_t;
+
+typedef struct {
+    const show_header_t *hdr;
+    const uint8_t *records;
+    uint32_t frame_count;
+    uint32_t channels;
+    uint32_t record_size;
+    uint32_t flags;
+    uint64_t duration_us;
+    size_t map_len;
+    int owned;              // parsed from text into malloc'd memory
+} show_t;
+
+// Map a compiled show and verify header and checksum. Pages are
+// prefaulted so playback never takes a page fault. Returns 0 or -1.
+int show_open(show_t *s, const char *path);
+void show_close(show_t *s);
+
+static inline const show_record_t *show_record(const show_t *s, uint32_t i) {
+    return (const show_record_t *)(s->records + (size_t)i * s->record_size);
+}
+
+// End of frame i, i.e. the start of the next one
+static inline uint64_t show_end_us(const show_t *s, uint32_t i) {
+    return i + 1 < s->frame_count ? show_record(s, i + 1)->t_us : s->duration_us;
+}
+
+// Frame showing at t_us: the last one starting at or before it (the last
+// frame also past duration_us). The record times are the running sum of
+// the frame durations, so this is a binary search, O(log frame_count).
+uint32_t show_find(const show_t *s, uint64_t t_us);
+
+// Level of each channel (0-255), NULL for shows without SHOW_FLAG_LEVELS
+static inline const uint8_t *show_levels(const show_t *s, uint32_t i) {
+    if (!(s->flags & SHOW_FLAG_LEVELS))
+        return NULL;
+    return (const uint8_t *)show_record(s, i)->bits + 4 * ((s->channels + 31) / 32);
+}
+
+// Frame of channels 0-31, the whole frame for shows of up to 32 LEDs
+static inline uint32_t show_frame_mask(const show_t *s, uint32_t i) {
+    return show_record(s, i)->bits[0];
+}
+
+// Writer used by show_compile and any tool that generates timelines
+typedef struct show_writer show_writer_t;
+
+show_writer_t *show_writer_open(const char *path, uint32_t channels, uint32_t flags);
+// levels is only read when the show was opened with SHOW_FLAG_LEVELS
+int show_writer_add(show_writer_t *w, uint64_t t_us, const uint32_t *bits, const uint8_t *levels);
+// Patches the header with count, duration and checksum. Returns 0, or -1
+// on a write error or when no frame was added.
+int show_writer_close(show_writer_t *w, uint64_t duration_us);
+
+// Parse one text line. Returns 1 and fills duration, up to max_channels
+// channel bits and levels, 0 for lines to skip (blank, comments, anything
+// not starting with a digit), -1 for a frame line that does not parse.
+// *has_levels tells whether the line had a level field.
+int show_parse_line(const char *line, uint64_t *duration_us, uint32_t *bits, uint8_t *levels,
+                    uint32_t max_channels, uint32_t *channels, int *has_levels);
+
+// Parse a whole text file into an in-memory show laid out exactly like a
+// compiled one, so players handle both the same way. Returns 0 or -1.
+int show_parse_text(show_t *s, FILE *in);
+int show_save(const show_t *s, const char *path);
+
+// Compile a whole text file. Returns the number of frames or -1.
+long show_compile_text(FILE *in, const char *out_path);
+
+// Open a compiled show, or parse a text one, going by the file's magic
+int show_load(show_t *s, const char *path);
+
+uint32_t show_crc32(uint32_t crc, const void *data, size_t len);
+
+#endif
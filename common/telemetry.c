@@ -0,0 +1,117 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "rt.h"
+#include "telemetry.h"
+#include "timeutil.h"
+
+int telem_channel_init(telem_channel_t *c, unsigned capacity, const char *path,
+                       const char *csv_header, telem_format_fn format,
+                       telem_finish_fn finish, void *ctx) {
+    memset(c, 0, sizeof(*c));
+    unsigned cap = 1;
+    while (cap < capacity) cap <<= 1;
+
+    // Touch the whole ring now so the RT thread never faults on it
+    c->ring.buf = calloc(cap, sizeof(telem_rec_t));
+    if (!c->ring.buf) return -1;
+    memset(c->ring.buf, 0, cap * sizeof(telem_rec_t));
+    c->ring.mask = cap - 1;
+    atomic_init(&c->ring.head, 0);
+    atomic_init(&c->ring.tail, 0);
+    atomic_init(&c->ring.dropped, 0);
+
+    size_t len = strlen(path);
+    c->binary = len > 4 && strcmp(path + len - 4, ".bin") == 0;
+    c->out = fopen(path, c->binary ? "wb" : "w");
+    if (!c->out) {
+        perror(path);
+        free(c->ring.buf);
+        return -1;
+    }
+    if (!c->binary && csv_header)
+        fprintf(c->out, "%s\n", csv_header);
+
+    c->format = format;
+    c->finish = finish;
+    c->ctx = ctx;
+    return 0;
+}
+
+static void drain(telem_channel_t *c) {
+    telem_rec_t rec;
+    while (telem_pop(&c->ring, &rec)) {
+        if (c->binary)
+            fwrite(&rec, sizeof(rec), 1, c->out);
+        // The formatter also keeps running statistics, so it sees every
+        // record even when the rows go to a binary file
+        c->format(c->binary ? NULL : c->out, &rec, c->ctx);
+        c->written++;
+    }
+}
+
+static void *writer_fn(void *arg) {
+    telem_writer_t *w = arg;
+    rt_thread_enter("telemetry");
+    uint64_t next_tick = now_ns() + (uint64_t)w->tick_ms * 1000000;
+    while (!atomic_load_explicit(&w->stop, memory_order_acquire)) {
+        for (int i = 0; i < w->count; ++i)
+            drain(w->ch[i]);
+        if (w->tick && now_ns() >= next_tick) {
+            w->tick(w->tick_ctx);
+            next_tick += (uint64_t)w->tick_ms * 1000000;
+        }
+        sleep_until_ns(now_ns() + (uint64_t)w->period_ms * 1000000);
+    }
+    rt_thread_exit();
+    return NULL;
+}
+
+void telem_writer_init(telem_writer_t *w, unsigned period_ms) {
+    memset(w, 0, sizeof(*w));
+    w->period_ms = period_ms;
+    atomic_init(&w->stop, 0);
+}
+
+int telem_writer_add(telem_writer_t *w, telem_channel_t *c) {
+    if (w->count >= TELEM_MAX_CHANNELS) return -1;
+    w->ch[w->count++] = c;
+    return 0;
+}
+
+void telem_writer_set_tick(telem_writer_t *w, telem_tick_fn fn, void *ctx, unsigned interval_ms) {
+    w->tick = fn;
+    w->tick_ctx = ctx;
+    w->tick_ms = interval_ms;
+}
+
+int telem_writer_start(telem_writer_t *w) {
+    // Default attributes: the writer inherits normal scheduling, never RT
+    if (pthread_create(&w->thread, NULL, writer_fn, w) != 0) {
+        perror("telemetry writer");
+        return -1;
+    }
+    w->running = 1;
+    return 0;
+}
+
+void telem_writer_stop(telem_writer_t *w) {
+    if (w->running) {
+        atomic_store(&w->stop, 1);
+        pthread_join(w->thread, NULL);
+        w->running = 0;
+    }
+    for (int i = 0; i < w->count; ++i) {
+        telem_channel_t *c = w->ch[i];
+        drain(c);
+        unsigned dropped = atomic_load(&c->ring.dropped);
+        if (c->finish)
+            c->finish(c->binary ? NULL : c->out, c->ctx);
+        if (dropped)
+            fprintf(stderr, "telemetry: %u records dropped (ring full)\n", dropped);
+        fclose(c->out);
+        free(c->ring.buf);
+        c->ring.buf = NULL;
+    }
+    w->count = 0;
+}
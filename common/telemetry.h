@@ -0,0 +1,100 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Wait-free single-producer/single-consumer rings that carry fixed-size
+// trace records out of the real-time threads. The RT thread only copies
+// 32 bytes and bumps an index; if the ring is full the record is counted
+// as dropped rather than waiting. A low-priority writer thread drains all
+// rings periodically into CSV (or raw binary when the path ends in .bin).
+
+#define TELEM_MAX_CHANNELS  8
+#define TELEM_PERIOD_MS     100
+#define TELEM_CACHELINE     64
+
+typedef struct {
+    uint64_t t_ns;
+    uint32_t seq;
+    uint32_t kind;
+    int32_t v[4];
+} telem_rec_t;
+
+typedef struct {
+    telem_rec_t *buf;
+    uint32_t mask;
+    _Alignas(TELEM_CACHELINE) atomic_uint head;     // written by the producer
+    _Alignas(TELEM_CACHELINE) atomic_uint tail;     // written by the consumer
+    _Alignas(TELEM_CACHELINE) atomic_uint dropped;
+} telem_ring_t;
+
+// Producer side, safe to call from an RT thread
+static inline int telem_push(telem_ring_t *r, const telem_rec_t *rec) {
+    unsigned head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+    if (head - tail > r->mask) {
+        atomic_store_explicit(&r->dropped,
+                              atomic_load_explicit(&r->dropped, memory_order_relaxed) + 1,
+                              memory_order_relaxed);
+        return -1;
+    }
+    r->buf[head & r->mask] = *rec;
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+    return 0;
+}
+
+// Consumer side
+static inline int telem_pop(telem_ring_t *r, telem_rec_t *rec) {
+    unsigned tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&r->head, memory_order_acquire);
+    if (tail == head)
+        return 0;
+    *rec = r->buf[tail & r->mask];
+    atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+    return 1;
+}
+
+typedef void (*telem_format_fn)(FILE *f, const telem_rec_t *rec, void *ctx);
+typedef void (*telem_finish_fn)(FILE *f, void *ctx);
+
+typedef struct {
+    telem_ring_t ring;
+    FILE *out;
+    int binary;
+    telem_format_fn format;     // one CSV row per record, also sees binary runs
+    telem_finish_fn finish;     // optional summary written before close
+    void *ctx;
+    uint64_t written;
+} telem_channel_t;
+
+// capacity is rounded up to a power of two. Returns 0 or -1.
+int telem_channel_init(telem_channel_t *c, unsigned capacity, const char *path,
+                       const char *csv_header, telem_format_fn format,
+                       telem_finish_fn finish, void *ctx);
+
+typedef void (*telem_tick_fn)(void *ctx);
+
+typedef struct {
+    telem_channel_t *ch[TELEM_MAX_CHANNELS];
+    int count;
+    unsigned period_ms;
+    telem_tick_fn tick;         // optional periodic hook, e.g. live reports
+    void *tick_ctx;
+    unsigned tick_ms;
+    atomic_int stop;
+    pthread_t thread;
+    int running;
+} telem_writer_t;
+
+void telem_writer_init(telem_writer_t *w, unsigned period_ms);
+int telem_writer_add(telem_writer_t *w, telem_channel_t *c);
+// Call fn every interval_ms on the writer thread, after the rings are drained
+void telem_writer_set_tick(telem_writer_t *w, telem_tick_fn fn, void *ctx, unsigned interval_ms);
+int telem_writer_start(telem_writer_t *w);
+// Drain what is left, run finish hooks and close the files
+void telem_writer_stop(telem_writer_t *w);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef TIMEUTIL_H
+#define TIMEUTIL_H
+
+#include <stdint.h>
+#include <time.h>
+
+// All timing in the show engine is taken from CLOCK_MONOTONIC.
+
+static inline uint64_t timespec_to_ns(struct timespec t) {
+    return (uint64_t)t.tv_sec * 1000000000ull + (uint64_t)t.tv_nsec;
+}
+
+static inline struct timespec ns_to_timespec(uint64_t ns) {
+    struct timespec t;
+    t.tv_sec = ns / 1000000000ull;
+    t.tv_nsec = ns % 1000000000ull;
+    return t;
+}
+
+static inline uint64_t now_ns(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return timespec_to_ns(t);
+}
+
+static inline long time_diff_us(struct timespec start, struct timespec end) {
+    return (end.tv_sec - start.tv_sec) * 1000000L + (end.tv_nsec - start.tv_nsec) / 1000L;
+}
+
+static inline void timespec_add_ns(struct timespec *t, long ns) {
+    t->tv_nsec += ns;
+    while (t->tv_nsec >= 1000000000) {
+        t->tv_sec++;
+        t->tv_nsec -= 1000000000;
+    }
+}
+
+// Sleep until an absolute CLOCK_MONOTONIC time in ns
+static inline void sleep_until_ns(uint64_t deadline_ns) {
+    struct timespec t = ns_to_timespec(deadline_ns);
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL);
+}
+
+#endif
@@ -0,0 +1,179 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "trace.h"
+
+static const struct {
+    const char *name, *cat, *arg;
+} trace_names[TRACE_EVENT_COUNT] = {
+    [TRACE_WAKE]       = {"wake", "sched", "late_ns"},
+    [TRACE_DEADLINE]   = {"deadline", "sched", "due"},
+    [TRACE_GPIO_WRITE] = {"gpio_write", "gpio", "frame"},
+    [TRACE_PCM_WRITE]  = {"pcm_write", "alsa", "frames"},
+    [TRACE_PCM_DELAY]  = {"pcm_delay", "alsa", "frames"},
+    [TRACE_XRUN]       = {"xrun", "alsa", "error"},
+};
+
+static const char *const marker_paths[] = {
+    "/sys/kernel/tracing/trace_marker",
+    "/sys/kernel/debug/tracing/trace_marker",
+};
+
+__thread trace_thread_t *trace_self;
+int trace_marker_fd = -1;
+atomic_int trace_markers_on;
+
+static trace_thread_t trace_threads[TRACE_MAX_THREADS];
+static int trace_thread_count;
+static atomic_int trace_claimed;
+static char *trace_path;
+static int trace_pid;
+
+// Cost of one event into a buffer, with and without reading the clock
+static void calibrate(double *event_ns, double *clock_ns) {
+    trace_thread_t cal = {.capacity = TRACE_CALIBRATE_EVENTS};
+    cal.ev = calloc(TRACE_CALIBRATE_EVENTS, sizeof(trace_event_t));
+    if (!cal.ev) {
+        *event_ns = *clock_ns = 0;
+        return;
+    }
+    atomic_store(&trace_markers_on, 0);
+    trace_self = &cal;
+
+    uint64_t t0 = now_ns();
+    for (int i = 0; i < TRACE_CALIBRATE_EVENTS; ++i)
+        trace_instant(TRACE_WAKE, now_ns(), i);
+    uint64_t t1 = now_ns();
+    for (int i = 0; i < TRACE_CALIBRATE_EVENTS; ++i)
+        now_ns();
+    uint64_t t2 = now_ns();
+    *clock_ns = (double)(t2 - t1) / TRACE_CALIBRATE_EVENTS;
+    *event_ns = (double)(t1 - t0) / TRACE_CALIBRATE_EVENTS;
+
+    trace_self = NULL;
+    atomic_store(&trace_markers_on, trace_marker_fd >= 0);
+    free(cal.ev);
+}
+
+int trace_open(const char *path, int threads, uint32_t events_each, int markers) {
+    if (threads > TRACE_MAX_THREADS)
+        threads = TRACE_MAX_THREADS;
+    trace_pid = getpid();
+    atomic_init(&trace_claimed, 0);
+    if (markers) {
+        for (size_t i = 0; i < sizeof(marker_paths) / sizeof(marker_paths[0]) && trace_marker_fd < 0; ++i)
+            trace_marker_fd = open(marker_paths[i], O_WRONLY | O_CLOEXEC);
+        if (trace_marker_fd < 0) {
+            fprintf(stderr, "trace: no trace_marker (%s), is tracefs mounted?\n", strerror(errno));
+            return -1;
+        }
+    }
+    if (path) {
+        trace_path = strdup(path);
+        for (int i = 0; i < threads; ++i) {
+            trace_thread_t *t = &trace_threads[i];
+            t->ev = malloc((size_t)events_each * sizeof(trace_event_t));
+            if (!t->ev) {
+                perror("trace");
+                return -1;
+            }
+            // Touched now so the RT threads never fault on their buffer
+            memset(t->ev, 0, (size_t)events_each * sizeof(trace_event_t));
+            t->capacity = events_each;
+        }
+    }
+    trace_thread_count = threads;
+
+    double event_ns, clock_ns;
+    calibrate(&event_ns, &clock_ns);
+    fprintf(stderr, "trace: %s%s%s, %.0f ns per event (%.0f ns of it the clock read)\n",
+            path ? path : "", path && markers ? " and " : "", markers ? "trace_marker" : "",
+            event_ns, clock_ns);
+    return 0;
+}
+
+void trace_thread(const char *name) {
+    int i = atomic_fetch_add(&trace_claimed, 1);
+    if (i >= trace_thread_count) {
+        fprintf(stderr, "trace: no buffer left for thread %s\n", name);
+        return;
+    }
+    trace_thread_t *t = &trace_threads[i];
+    t->tid = syscall(SYS_gettid);
+    snprintf(t->name, sizeof(t->name), "%s", name);
+    trace_self = t;
+}
+
+void trace_marker(int ph, int id, int64_t value) {
+    char buf[96];
+    int n;
+    if (ph == 'E')
+        n = snprintf(buf, sizeof(buf), "E|%d", trace_pid);
+    else if (ph == 'C')
+        n = snprintf(buf, sizeof(buf), "C|%d|%s|%lld", trace_pid, trace_names[id].name, (long long)value);
+    else
+        n = snprintf(buf, sizeof(buf), "%c|%d|%s", ph, trace_pid, trace_names[id].name);
+    // Tracing was switched off under us: stop trying. The other threads
+    // may be in write(2) on the fd, so only trace_close closes it.
+    if (write(trace_marker_fd, buf, n) < 0)
+        atomic_store_explicit(&trace_markers_on, 0, memory_order_relaxed);
+}
+
+static void write_event(FILE *f, const trace_thread_t *t, const trace_event_t *e) {
+    const char *name = trace_names[e->id].name, *cat = trace_names[e->id].cat, *arg = trace_names[e->id].arg;
+    fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"pid\":%d,\"tid\":%d,\"ts\":%llu.%03u", name, cat,
+            trace_pid, t->tid, (unsigned long long)(e->t_ns / 1000), (unsigned)(e->t_ns % 1000));
+    if (e->phase == TRACE_PH_SPAN)
+        fprintf(f, ",\"ph\":\"X\",\"dur\":%u.%03u", e->dur_ns / 1000, e->dur_ns % 1000);
+    else if (e->phase == TRACE_PH_INSTANT)
+        fprintf(f, ",\"ph\":\"i\",\"s\":\"t\"");
+    else
+        fprintf(f, ",\"ph\":\"C\"");
+    fprintf(f, ",\"args\":{\"%s\":%lld}}", arg, (long long)e->arg);
+}
+
+void trace_close(FILE *report) {
+    int threads = atomic_load(&trace_claimed);
+    if (threads > trace_thread_count)
+        threads = trace_thread_count;
+    if (trace_path) {
+        FILE *f = fopen(trace_path, "w");
+        if (!f) {
+            perror(trace_path);
+        } else {
+            unsigned long events = 0, dropped = 0;
+            fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n"
+                       "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"%s\"}}",
+                    trace_pid, program_invocation_short_name);
+            for (int i = 0; i < threads; ++i) {
+                const trace_thread_t *t = &trace_threads[i];
+                fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                        trace_pid, t->tid, t->name);
+                for (uint32_t k = 0; k < t->count; ++k)
+                    write_event(f, t, &t->ev[k]);
+                events += t->count;
+                dropped += t->dropped;
+            }
+            fprintf(f, "\n]}\n");
+            if (fclose(f) != 0)
+                perror(trace_path);
+            fprintf(report, "Trace: %lu events from %d threads in %s, %lu dropped on a full buffer\n",
+                    events, threads, trace_path, dropped);
+        }
+    }
+    for (int i = 0; i < trace_thread_count; ++i)
+        free(trace_threads[i].ev);
+    memset(trace_threads, 0, sizeof(trace_threads));
+    free(trace_path);
+    trace_path = NULL;
+    atomic_store(&trace_markers_on, 0);
+    if (trace_marker_fd >= 0)
+        close(trace_marker_fd);
+    trace_marker_fd = -1;
+}
@@ -0,0 +1,120 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "timeutil.h"
+
+// Opt-in event trace of the RT threads, exported as Chrome trace-event
+// JSON (chrome://tracing, ui.perfetto.dev). Each thread that calls
+// trace_thread gets its own preallocated, prefaulted buffer; an event is
+// a 24-byte store and an index bump with no atomics or locks. Calls from
+// threads without a buffer, or with tracing off, return at once. A full
+// buffer keeps its first events and counts the rest as dropped. The file
+// is written by trace_close after the threads have finished.
+//
+// Timestamps are CLOCK_MONOTONIC, the clock of all the show's logs. With
+// markers on, each event is also written to the kernel's trace_marker in
+// the atrace form ("B|pid|name", "E|pid", "C|pid|name|value", "I|pid|name")
+// so it lines up with sched_switch and friends in an ftrace capture; set
+// trace_clock to mono for the same timebase. That costs a write(2) per
+// event, the buffers alone stay well under a microsecond (trace_open
+// measures and prints it).
+
+#define TRACE_DEFAULT_EVENTS    262144  // per thread, 6 MB
+#define TRACE_MAX_THREADS       8
+#define TRACE_CALIBRATE_EVENTS  100000
+
+// Events of the show engine; names and argument labels are in trace.c
+enum {
+    TRACE_WAKE,         // instant: thread woke, arg = ns past its deadline
+    TRACE_DEADLINE,     // instant at the next planned wakeup, arg = what is due
+    TRACE_GPIO_WRITE,   // span, arg = frame
+    TRACE_PCM_WRITE,    // span around snd_pcm_writei/mmap, arg = frames or error
+    TRACE_PCM_DELAY,    // counter: frames queued in the device
+    TRACE_XRUN,         // instant, arg = ALSA error
+    TRACE_EVENT_COUNT
+};
+
+enum { TRACE_PH_SPAN, TRACE_PH_INSTANT, TRACE_PH_COUNTER };
+
+typedef struct {
+    uint64_t t_ns;
+    int64_t arg;
+    uint32_t dur_ns;
+    uint16_t id;
+    uint16_t phase;
+} trace_event_t;
+
+typedef struct {
+    trace_event_t *ev;
+    uint32_t count, capacity;
+    uint32_t dropped;
+    int tid;
+    char name[16];
+    uint64_t begin_ns[TRACE_EVENT_COUNT];   // open spans
+} trace_thread_t;
+
+extern __thread trace_thread_t *trace_self;
+extern int trace_marker_fd;
+extern atomic_int trace_markers_on;  // cleared on a failed write, the fd stays open
+
+// Buffers for up to threads threads of events_each events. path NULL:
+// markers only. Returns 0 or -1.
+int trace_open(const char *path, int threads, uint32_t events_each, int markers);
+// Claim a buffer for the calling thread. Call before its first deadline.
+void trace_thread(const char *name);
+// Write the JSON file, report the counts and free the buffers
+void trace_close(FILE *report);
+
+// Slow path for trace_marker, one write(2)
+void trace_marker(int ph, int id, int64_t value);
+
+// A timestamp for call sites that have none, free when tracing is off
+static inline uint64_t trace_now(void) {
+    return trace_self ? now_ns() : 0;
+}
+
+static inline void trace_add(trace_thread_t *t, int phase, int id, uint64_t t_ns, uint32_t dur_ns, int64_t arg) {
+    if (t->count < t->capacity)
+        t->ev[t->count++] = (trace_event_t){.t_ns = t_ns, .arg = arg, .dur_ns = dur_ns, .id = id, .phase = phase};
+    else if (t->capacity)
+        t->dropped++;
+}
+
+static inline void trace_instant(int id, uint64_t t_ns, int64_t arg) {
+    if (!trace_self)
+        return;
+    trace_add(trace_self, TRACE_PH_INSTANT, id, t_ns, 0, arg);
+    if (atomic_load_explicit(&trace_markers_on, memory_order_relaxed))
+        trace_marker('I', id, 0);
+}
+
+static inline void trace_counter(int id, uint64_t t_ns, int64_t value) {
+    if (!trace_self)
+        return;
+    trace_add(trace_self, TRACE_PH_COUNTER, id, t_ns, 0, value);
+    if (atomic_load_explicit(&trace_markers_on, memory_order_relaxed))
+        trace_marker('C', id, value);
+}
+
+static inline void trace_begin(int id, uint64_t t_ns) {
+    if (!trace_self)
+        return;
+    trace_self->begin_ns[id] = t_ns;
+    if (atomic_load_explicit(&trace_markers_on, memory_order_relaxed))
+        trace_marker('B', id, 0);
+}
+
+static inline void trace_end(int id, uint64_t t_ns, int64_t arg) {
+    trace_thread_t *t = trace_self;
+    if (!t)
+        return;
+    trace_add(t, TRACE_PH_SPAN, id, t->begin_ns[id], (uint32_t)(t_ns - t->begin_ns[id]), arg);
+    if (atomic_load_explicit(&trace_markers_on, memory_order_relaxed))
+        trace_marker('E', id, 0);
+}
+
+#endif
@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "transition.h"
+
+static int weight(const transition_step_t *s) {
+    return __builtin_popcount(s->set) + __builtin_popcount(s->clr);
+}
+
+// LEDs wrong in the phantoms: after each write but the last, the state
+// is done bits away from the old frame and total - done from the new one
+static int order_cost(const transition_step_t *s, const int *order, int n, int total) {
+    int done = 0, cost = 0;
+    for (int j = 0; j + 1 < n; ++j) {
+        done += weight(&s[order[j]]);
+        cost += done < total - done ? done : total - done;
+    }
+    return cost;
+}
+
+static void search(const transition_step_t *s, int *order, int k, int n, int total, int *best, int *best_order) {
+    if (k == n) {
+        int cost = order_cost(s, order, n, total);
+        if (cost < *best) {
+            *best = cost;
+            memcpy(best_order, order, n * sizeof(int));
+        }
+        return;
+    }
+    for (int i = k; i < n; ++i) {
+        int t = order[k]; order[k] = order[i]; order[i] = t;
+        search(s, order, k + 1, n, total, best, best_order);
+        t = order[k]; order[k] = order[i]; order[i] = t;
+    }
+}
+
+void transition_plan(const gpio_backend_t *b, const uint32_t *from, const uint32_t *to, transition_t *t) {
+    transition_step_t raw[TRANSITION_MAX_STEPS];
+    int n = 0, total = 0;
+    for (int k = 0; k < b->num_banks; ++k) {
+        uint32_t set = to[k] & ~from[k], clr = from[k] & ~to[k];
+        if (b->atomic_banks) {
+            if (set | clr)
+                raw[n++] = (transition_step_t){.bank = k, .set = set, .clr = clr};
+        } else {
+            if (set)
+                raw[n++] = (transition_step_t){.bank = k, .set = set};
+            if (clr)
+                raw[n++] = (transition_step_t){.bank = k, .clr = clr};
+        }
+    }
+    int order[TRANSITION_MAX_STEPS];
+    for (int i = 0; i < n; ++i) {
+        order[i] = i;
+        total += weight(&raw[i]);
+    }
+
+    int best = order_cost(raw, order, n, total);
+    if (n > 2 && n <= TRANSITION_SEARCH_STEPS) {
+        int work[TRANSITION_MAX_STEPS];
+        memcpy(work, order, n * sizeof(int));
+        search(raw, work, 0, n, total, &best, order);
+    } else if (n > TRANSITION_SEARCH_STEPS) {
+        // Heaviest writes at both ends, the light ones in the middle
+        int sorted[TRANSITION_MAX_STEPS];
+        memcpy(sorted, order, n * sizeof(int));
+        for (int i = 1; i < n; ++i)
+            for (int j = i; j > 0 && weight(&raw[sorted[j]]) > weight(&raw[sorted[j - 1]]); --j) {
+                int tmp = sorted[j]; sorted[j] = sorted[j - 1]; sorted[j - 1] = tmp;
+            }
+        for (int i = 0, lo = 0, hi = n - 1; i < n; ++i)
+            order[i & 1 ? hi-- : lo++] = sorted[i];
+        best = order_cost(raw, order, n, total);
+    }
+
+    t->steps = n;
+    t->phantoms = n > 0 ? n - 1 : 0;
+    t->wrong_bits = best;
+    for (int i = 0; i < n; ++i)
+        t->step[i] = raw[order[i]];
+}
+
+static int write_steps(gpio_backend_t *b, const transition_step_t *s, int n) {
+    int ret = 0;
+    for (int i = 0; i < n; ++i) {
+        uint32_t image = (b->bank_shadow[s[i].bank] | s[i].set) & ~s[i].clr;
+        if (b->write_bank(b, s[i].bank, s[i].set, s[i].clr, image) < 0)
+            ret = -1;
+        else
+            b->bank_shadow[s[i].bank] = image;
+    }
+    return ret;
+}
+
+int transition_write(gpio_backend_t *b, const transition_t *t) {
+    return write_steps(b, t->step, t->steps);
+}
+
+int transition_plan_init(transition_plan_t *p, const gpio_backend_t *b, const gpio_plan_t *images) {
+    static const uint32_t dark[GPIO_MAX_BANKS];
+    size_t cap = (size_t)images->frames * b->num_banks + 1, used = 0;
+    memset(p, 0, sizeof(*p));
+    p->images = images;
+    p->first = malloc(((size_t)images->frames + 1) * sizeof(uint32_t));
+    p->steps = malloc(cap * sizeof(transition_step_t));
+    if (!p->first || !p->steps) {
+        perror("transition: plan");
+        transition_plan_free(p);
+        return -1;
+    }
+
+    transition_t t;
+    for (uint32_t i = 0; i < images->frames; ++i) {
+        transition_plan(b, i ? gpio_plan_frame(images, i - 1) : dark, gpio_plan_frame(images, i), &t);
+        if (used + t.steps > cap) {
+            cap *= 2;
+            transition_step_t *grown = realloc(p->steps, cap * sizeof(transition_step_t));
+            if (!grown) {
+                perror("transition: plan");
+                transition_plan_free(p);
+                return -1;
+            }
+            p->steps = grown;
+        }
+        p->first[i] = used;
+        memcpy(p->steps + used, t.step, t.steps * sizeof(transition_step_t));
+        used += t.steps;
+        p->phantoms += t.phantoms;
+        p->wrong_bits += t.wrong_bits;
+    }
+    p->first[images->frames] = used;
+    return 0;
+}
+
+void transition_plan_free(transition_plan_t *p) {
+    free(p->steps);
+    free(p->first);
+    p->steps = NULL;
+    p->first = NULL;
+}
+
+int transition_play(gpio_backend_t *b, const transition_plan_t *p, uint32_t i) {
+    static const uint32_t dark[GPIO_MAX_BANKS];
+    const uint32_t *from = i ? gpio_plan_frame(p->images, i - 1) : dark;
+    if (memcmp(b->bank_shadow, from, b->num_banks * sizeof(uint32_t)) == 0)
+        return write_steps(b, p->steps + p->first[i], p->first[i + 1] - p->first[i]);
+
+    transition_t t;
+    transition_plan(b, b->bank_shadow, gpio_plan_frame(p->images, i), &t);
+    return transition_write(b, &t);
+}
@@ -0,0 +1,57 @@
+#ifndef TRANSITION_H
+#define TRANSITION_H
+
+#include <stdint.h>
+
+#include "gpio.h"
+
+// Order of the device writes for a frame change. Between two writes the
+// outputs show a state that is neither frame, a phantom. A change needs
+// one write per bank on backends that set and clear a bank at once
+// (gpiod), so changes within a bank are glitch-free there; with separate
+// SET/CLR registers (mmap, sim) a bank that gains and loses LEDs needs
+// two. Every write but the last leaves a phantom, so the planner:
+//
+//   - uses the fewest writes the backend allows
+//   - orders them so the phantoms are as close as possible to the old or
+//     the new frame (fewest LEDs wrong), searching all orders for up to
+//     TRANSITION_SEARCH_STEPS writes, largest writes at the ends beyond
+//
+// This generalises the popcount ordering of set/clear for one bank.
+
+#define TRANSITION_MAX_STEPS    (2 * GPIO_MAX_BANKS)
+#define TRANSITION_SEARCH_STEPS 6
+
+typedef struct {
+    uint8_t bank;
+    uint32_t set, clr;
+} transition_step_t;
+
+typedef struct {
+    int steps;
+    int phantoms;           // states between the frames
+    int wrong_bits;         // over all phantoms, LEDs off from the nearer frame
+    transition_step_t step[TRANSITION_MAX_STEPS];
+} transition_t;
+
+void transition_plan(const gpio_backend_t *b, const uint32_t *from, const uint32_t *to, transition_t *t);
+// Issue the writes and update the backend's shadow
+int transition_write(gpio_backend_t *b, const transition_t *t);
+
+// Planned changes between consecutive frames of a gpio_plan_t, frame 0
+// coming from all off
+typedef struct {
+    const gpio_plan_t *images;
+    transition_step_t *steps;
+    uint32_t *first;        // frames + 1 offsets into steps
+    uint64_t phantoms, wrong_bits;
+} transition_plan_t;
+
+int transition_plan_init(transition_plan_t *p, const gpio_backend_t *b, const gpio_plan_t *images);
+void transition_plan_free(transition_plan_t *p);
+
+// Show frame i: the planned writes when the outputs hold frame i - 1,
+// otherwise (after a skip) a change planned on the spot
+int transition_play(gpio_backend_t *b, const transition_plan_t *p, uint32_t i);
+
+#endif
@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "timeutil.h"
+#include "wav_stream.h"
+
+static size_t page_size;
+
+static size_t page_down(size_t x) { return x & ~(page_size - 1); }
+static size_t page_up(size_t x) { return (x + page_size - 1) & ~(page_size - 1); }
+
+static uint32_t le32(const uint8_t *p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+static uint16_t le16(const uint8_t *p) { return p[0] | (p[1] << 8); }
+
+// Make [start, end) of the mapping resident
+static void window_load(wav_stream_t *ws, size_t start, size_t end) {
+    if (start >= end) return;
+    void *addr = (void *)(ws->map + start);
+    if (ws->locked && mlock(addr, end - start) == 0)
+        return;  // mlock faults the pages in
+
+    if (ws->locked) {
+        perror("wav_stream: mlock (falling back to prefault only)");
+        ws->locked = 0;
+    }
+    madvise(addr, end - start, MADV_WILLNEED);
+    volatile uint8_t sink = 0;
+    for (size_t off = start; off < end; off += page_size)
+        sink += ws->map[off];
+    (void)sink;
+}
+
+// Release [start, end) of the mapping. The file is still there, so the
+// pages come back from the page cache if they are ever touched again.
+static void window_drop(wav_stream_t *ws, size_t start, size_t end) {
+    if (start >= end) return;
+    void *addr = (void *)(ws->map + start);
+    if (ws->locked)
+        munlock(addr, end - start);
+    madvise(addr, end - start, MADV_DONTNEED);
+}
+
+// Slide the resident window so it covers the cursor plus window_frames
+static void window_update(wav_stream_t *ws) {
+    size_t frame_bytes = ws->channels * sizeof(int16_t);
+    size_t data_off = (const uint8_t *)ws->samples - ws->map;
+    size_t cursor = atomic_load_explicit(&ws->cursor, memory_order_acquire);
+
+    size_t start = page_down(data_off + cursor * frame_bytes);
+    size_t end = page_up(data_off + (cursor + ws->window_frames) * frame_bytes);
+    if (end > ws->map_len) end = page_up(ws->map_len);
+    if (start > end) start = end;
+
+    // Load what is new, drop what fell out (either side, seeks included)
+    size_t old_start = ws->win_start, old_end = ws->win_end;
+    window_load(ws, start, end < old_start ? end : old_start);
+    window_load(ws, start > old_end ? start : old_end, end);
+    window_drop(ws, old_start, start);  // also pages the reader touched past a jump
+    window_drop(ws, old_start > end ? old_start : end, old_end);
+
+    ws->win_start = start;
+    ws->win_end = end;
+}
+
+static void *helper_fn(void *arg) {
+    wav_stream_t *ws = arg;
+    while (!atomic_load_explicit(&ws->stop, memory_order_acquire)) {
+        pthread_mutex_lock(&ws->window_lock);
+        window_update(ws);
+        pthread_mutex_unlock(&ws->window_lock);
+        sleep_until_ns(now_ns() + WAV_STREAM_REFILL_MS * 1000000ull);
+    }
+    return NULL;
+}
+
+int wav_stream_open(wav_stream_t *ws, const char *path, unsigned int window_ms) {
+    memset(ws, 0, sizeof(*ws));
+    pthread_mutex_init(&ws->window_lock, NULL);
+    page_size = sysconf(_SC_PAGESIZE);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) { perror("wav_stream: open"); return -1; }
+    struct stat st;
+    if (fstat(fd, &st) < 0) { perror("wav_stream: fstat"); close(fd); return -1; }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) { perror("wav_stream: mmap"); return -1; }
+    ws->map = map;
+    ws->map_len = st.st_size;
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    // Walk the RIFF chunks instead of assuming a 44-byte header
+    const uint8_t *p = ws->map;
+    if (ws->map_len < 12 || memcmp(p, "RIFF", 4) || memcmp(p + 8, "WAVE", 4)) {
+        fprintf(stderr, "wav_stream: %s is not a WAV file\n", path);
+        wav_stream_close(ws);
+        return -1;
+    }
+    int have_fmt = 0;
+    uint16_t format = 0, bits = 0;
+    size_t off = 12;
+    while (off + 8 <= ws->map_len) {
+        uint32_t len = le32(p + off + 4);
+        const uint8_t *body = p + off + 8;
+        if (!memcmp(p + off, "fmt ", 4) && len >= 16) {
+            format = le16(body);
+            ws->channels = le16(body + 2);
+            ws->sample_rate = le32(body + 4);
+            bits = le16(body + 14);
+            have_fmt = 1;
+        } else if (!memcmp(p + off, "data", 4)) {
+            size_t avail = ws->map_len - (off + 8);
+            if (len > avail) len = avail;  // Tolerate streaming writers' headers
+            ws->samples = (const int16_t *)body;
+            ws->frames = have_fmt && ws->channels ? len / (ws->channels * sizeof(int16_t)) : 0;
+            break;
+        }
+        off += 8 + len + (len & 1);
+    }
+    if (!have_fmt || !ws->samples || format != 1 || bits != 16 || ws->channels == 0) {
+        fprintf(stderr, "wav_stream: %s must be 16-bit PCM\n", path);
+        wav_stream_close(ws);
+        return -1;
+    }
+
+    ws->window_frames = (size_t)ws->sample_rate * window_ms / 1000;
+    atomic_init(&ws->cursor, 0);
+    atomic_init(&ws->stop, 0);
+    ws->locked = 1;
+    ws->win_start = ws->win_end = page_down((const uint8_t *)ws->samples - ws->map);
+
+    // First window synchronously, so playback can start right away
+    window_update(ws);
+
+    if (pthread_create(&ws->helper, NULL, helper_fn, ws) != 0) {
+        perror("wav_stream: helper thread");
+        wav_stream_close(ws);
+        return -1;
+    }
+    ws->helper_running = 1;
+    return 0;
+}
+
+void wav_stream_seek(wav_stream_t *ws, size_t frame) {
+    wav_stream_advance(ws, frame);
+    pthread_mutex_lock(&ws->window_lock);
+    window_update(ws);
+    pthread_mutex_unlock(&ws->window_lock);
+}
+
+void wav_stream_close(wav_stream_t *ws) {
+    if (ws->helper_running) {
+        atomic_store(&ws->stop, 1);
+        pthread_join(ws->helper, NULL);
+        ws->helper_running = 0;
+    }
+    if (ws->map) {
+        if (ws->locked && ws->win_end > ws->win_start)
+            munlock((void *)(ws->map + ws->win_start), ws->win_end - ws->win_start);
+        munmap((void *)ws->map, ws->map_len);
+        pthread_mutex_destroy(&ws->window_lock);
+    }
+    memset(ws, 0, sizeof(*ws));
+}
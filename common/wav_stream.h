@@ -0,0 +1,56 @@
+#ifndef WAV_STREAM_H
+#define WAV_STREAM_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// 16-bit PCM WAV played straight from an mmap of the file. Only a sliding
+// window ahead of the playback cursor is kept resident: a normal-priority
+// helper thread prefaults and mlocks the pages the audio thread is about
+// to read and drops the ones it has finished with. Memory use is set by
+// the window, not by the track length, and the first samples are ready as
+// soon as the first window has been faulted in.
+
+#define WAV_STREAM_WINDOW_MS   4000  // resident audio ahead of the cursor
+#define WAV_STREAM_REFILL_MS   100   // helper thread period
+
+typedef struct {
+    const uint8_t *map;
+    size_t map_len;
+    const int16_t *samples;     // start of the data chunk
+    size_t frames;
+    uint32_t sample_rate;
+    uint16_t channels;
+
+    size_t window_frames;
+    atomic_size_t cursor;       // next frame the audio thread will read
+    atomic_int stop;
+    pthread_t helper;
+    int helper_running;
+    int locked;                 // mlock worked, otherwise pages are only touched
+    pthread_mutex_t window_lock; // helper vs. wav_stream_seek, never the audio thread
+    size_t win_start, win_end;  // resident byte range
+} wav_stream_t;
+
+// Map the file, parse the RIFF chunks and prefault the first window.
+// Starts the helper thread. Returns 0 or -1.
+int wav_stream_open(wav_stream_t *ws, const char *path, unsigned int window_ms);
+void wav_stream_close(wav_stream_t *ws);
+
+static inline const int16_t *wav_stream_frames(const wav_stream_t *ws, size_t frame) {
+    return ws->samples + frame * ws->channels;
+}
+
+// Audio thread: tell the helper how far playback has read
+static inline void wav_stream_advance(wav_stream_t *ws, size_t frame) {
+    atomic_store_explicit(&ws->cursor, frame, memory_order_release);
+}
+
+// Move the cursor before playback starts there (a mid-song start) and
+// make the window at it resident before returning. Not for the audio
+// thread: it faults in up to a whole window.
+void wav_stream_seek(wav_stream_t *ws, size_t frame);
+
+#endif
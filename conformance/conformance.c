@@ -0,0 +1,377 @@
+// Build: gcc -O2 -Wall -o conformance conformance.c ../common/show.c ../common/latency_hist.c
+//
+// Check a logic-analyzer capture of the LED outputs against the show it
+// was playing. The capture is read once, front to back, so captures of
+// any size stream through at disk speed. Accepted formats:
+//
+//   pulseview   "6010-19013 Parallel: Items: e0" lines (Parallel decoder export)
+//   csv         sigrok-cli -O csv, one "0,1,1,..." row per sample
+//   binary      sigrok-cli -O binary, unitsize bytes per sample (-u)
+//
+// Capture bit k is channel k, as in process_logicalyzer.py. The first
+// capture change to the show's first state anchors the timeline; every
+// later frame change is matched to a capture change to the same state
+// within the window. Reported:
+//
+//   latency     capture time - source time of each change, vs the anchor
+//   drift       slope of the latency over the song (clock error, ppm)
+//   residual    latency with the drift removed (jitter)
+//   missed      frame changes that never show up in the capture
+//   extra       unexpected states held longer than the phantom limit
+//   phantom     short intermediate states, e.g. a frame written in two steps
+//
+// Exits with 2 when the capture fails the limits, so it can gate a change.
+//
+//   ./conformance [-f pulseview|csv|binary] [-r rate] [-u unitsize] [-w window_ms]
+//                 [-g phantom_us] [-P p99_limit_us] [-o transitions.csv] show.txt|.show capture
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#include "../common/latency_hist.h"
+#include "../common/show.h"
+
+#define DEFAULT_RATE        20000
+#define DEFAULT_WINDOW_MS   100
+#define DEFAULT_PHANTOM_US  2000
+#define READ_BUFFER         (1 << 20)
+
+enum { FMT_PULSEVIEW, FMT_CSV, FMT_BINARY };
+
+typedef struct {
+    uint64_t t_ns;          // source time of the change
+    uint64_t state;
+    uint32_t frame;
+    int64_t latency_ns;     // capture - source - anchor offset, valid if matched
+    int matched;
+} expected_t;
+
+typedef struct {
+    expected_t *exp;
+    size_t count, next;
+    uint64_t mask;
+    int64_t window_ns, phantom_ns;
+    int anchored;
+    int64_t anchor_ns, offset_ns;   // capture - source at the anchor, and latest
+    uint64_t prev_state;            // last state seen in the capture
+
+    // One change of delay: a state's class depends on how long it lasted
+    int have_pending;
+    uint64_t pending_t, pending_state;
+
+    unsigned long matched, missed, extra, phantom, changes;
+    double sx, sy, sxx, sxy;        // least squares of latency over time
+    lhist_t latency, residual, phantom_len;
+    FILE *csv;
+} matcher_t;
+
+static void csv_row(matcher_t *m, const char *kind, long frame, double exp_us, double cap_us,
+                    double latency_us, double duration_us) {
+    if (m->csv)
+        fprintf(m->csv, "%s,%ld,%.1f,%.1f,%.1f,%.1f\n", kind, frame, exp_us, cap_us, latency_us, duration_us);
+}
+
+static void classify(matcher_t *m, uint64_t t, uint64_t state, uint64_t duration) {
+    if (!m->anchored) {
+        if (state != m->exp[0].state)
+            return;  // Before the show started
+        m->anchored = 1;
+        m->anchor_ns = m->offset_ns = (int64_t)t - (int64_t)m->exp[0].t_ns;
+    }
+
+    // Expected changes that can no longer match are missed
+    while (m->next < m->count && (int64_t)t > (int64_t)m->exp[m->next].t_ns + m->offset_ns + m->window_ns) {
+        expected_t *e = &m->exp[m->next++];
+        m->missed++;
+        csv_row(m, "missed", e->frame, e->t_ns / 1e3, 0, 0, 0);
+    }
+
+    // Match against any change inside the window; skipped ones are missed
+    for (size_t j = m->next; j < m->count; ++j) {
+        expected_t *e = &m->exp[j];
+        int64_t predicted = (int64_t)e->t_ns + m->offset_ns;
+        if ((int64_t)t < predicted - m->window_ns)
+            break;
+        if (e->state != state)
+            continue;
+        for (; m->next < j; m->next++) {
+            m->missed++;
+            csv_row(m, "missed", m->exp[m->next].frame, m->exp[m->next].t_ns / 1e3, 0, 0, 0);
+        }
+        e->matched = 1;
+        e->latency_ns = (int64_t)t - (int64_t)e->t_ns - m->anchor_ns;
+        m->offset_ns = (int64_t)t - (int64_t)e->t_ns;  // follow the drift
+        m->next = j + 1;
+        m->matched++;
+        lhist_record(&m->latency, e->latency_ns);
+        double x = e->t_ns / 1e9, y = (double)e->latency_ns;
+        m->sx += x; m->sy += y; m->sxx += x * x; m->sxy += x * y;
+        csv_row(m, "matched", e->frame, e->t_ns / 1e3, (t - m->anchor_ns) / 1e3, e->latency_ns / 1e3,
+                duration / 1e3);
+        return;
+    }
+
+    if ((int64_t)duration < m->phantom_ns) {
+        m->phantom++;
+        lhist_record(&m->phantom_len, duration);
+        csv_row(m, "phantom", -1, 0, (t - m->anchor_ns) / 1e3, 0, duration / 1e3);
+    } else {
+        m->extra++;
+        csv_row(m, "extra", -1, 0, (t - m->anchor_ns) / 1e3, 0, duration / 1e3);
+    }
+}
+
+// A sample of the capture; only changes of the show's channels count
+static inline void feed(matcher_t *m, uint64_t t, uint64_t state) {
+    state &= m->mask;
+    if (state == m->prev_state)
+        return;
+    m->prev_state = state;
+    m->changes++;
+    if (m->have_pending)
+        classify(m, m->pending_t, m->pending_state, t - m->pending_t);
+    m->have_pending = 1;
+    m->pending_t = t;
+    m->pending_state = state;
+}
+
+static void finish(matcher_t *m, uint64_t end_t) {
+    if (m->have_pending)
+        classify(m, m->pending_t, m->pending_state, end_t - m->pending_t);
+    m->have_pending = 0;
+}
+
+static inline uint64_t sample_ns(uint64_t sample, uint64_t rate) {
+    return sample / rate * 1000000000ull + sample % rate * 1000000000ull / rate;
+}
+
+static int read_pulseview(FILE *f, matcher_t *m, uint64_t rate, uint64_t *end_t) {
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        char *p = line;
+        uint64_t start = 0, end = 0;
+        if (!isdigit((unsigned char)*p))
+            continue;
+        while (isdigit((unsigned char)*p)) start = start * 10 + (*p++ - '0');
+        // Hyphen or en-dash between start and end sample
+        while (*p && !isdigit((unsigned char)*p) && *p != ' ') p++;
+        while (isdigit((unsigned char)*p)) end = end * 10 + (*p++ - '0');
+        char *items = strstr(p, "Items:");
+        if (!items)
+            continue;
+        uint64_t state = strtoull(items + 6, NULL, 16);
+        // The decoder only emits items, gaps between them are unknown
+        feed(m, sample_ns(start, rate), state);
+        *end_t = sample_ns(end, rate);
+    }
+    return ferror(f) ? -1 : 0;
+}
+
+static int read_csv(FILE *f, matcher_t *m, uint64_t rate, uint64_t *end_t) {
+    char line[1024], prev[1024] = "";
+    uint64_t sample = 0, state = 0;
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] != '0' && line[0] != '1')
+            continue;  // Comments and the header row
+        // Most rows repeat the previous one, skip parsing those
+        if (strcmp(line, prev) != 0) {
+            state = 0;
+            int bit = 0;
+            for (char *p = line; *p && bit < 64; ++p)
+                if (*p == '0' || *p == '1')
+                    state |= (uint64_t)(*p - '0') << bit++;
+            strcpy(prev, line);
+            feed(m, sample_ns(sample, rate), state);
+        }
+        sample++;
+    }
+    *end_t = sample_ns(sample, rate);
+    return ferror(f) ? -1 : 0;
+}
+
+static int read_binary(FILE *f, matcher_t *m, uint64_t rate, int unit, uint64_t *end_t) {
+    uint8_t *buf = malloc(READ_BUFFER);
+    if (!buf) return -1;
+    uint64_t sample = 0;
+    uint8_t prev[8] = {0};
+    int have_prev = 0;
+    size_t n, keep = 0;
+    while ((n = fread(buf + keep, 1, READ_BUFFER - keep, f)) > 0) {
+        n += keep;
+        size_t i = 0;
+        for (; i + unit <= n; i += unit, sample++) {
+            if (have_prev && memcmp(buf + i, prev, unit) == 0)
+                continue;
+            memcpy(prev, buf + i, unit);
+            have_prev = 1;
+            uint64_t state = 0;
+            memcpy(&state, buf + i, unit);  // little-endian, bit k = channel k
+            feed(m, sample_ns(sample, rate), state);
+        }
+        keep = n - i;
+        memmove(buf, buf + i, keep);
+    }
+    free(buf);
+    *end_t = sample_ns(sample, rate);
+    return ferror(f) ? -1 : 0;
+}
+
+// Frame changes of the show: identical neighbours cannot be seen in a
+// capture, and the players switch the LEDs off after the last frame.
+static expected_t *load_expected(const show_t *s, size_t *count) {
+    expected_t *exp = calloc(s->frame_count + 1, sizeof(*exp));
+    if (!exp) return NULL;
+    size_t n = 0;
+    uint64_t prev = 0;
+    for (uint32_t i = 0; i < s->frame_count; ++i) {
+        const show_record_t *r = show_record(s, i);
+        uint64_t state = r->bits[0];
+        if (s->channels > 32)
+            state |= (uint64_t)r->bits[1] << 32;
+        if (state == prev)
+            continue;
+        exp[n++] = (expected_t){.t_ns = r->t_us * 1000, .state = state, .frame = i};
+        prev = state;
+    }
+    if (prev)
+        exp[n++] = (expected_t){.t_ns = s->duration_us * 1000, .state = 0, .frame = s->frame_count};
+    *count = n;
+    return exp;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-f pulseview|csv|binary] [-r rate] [-u unitsize] [-w window_ms]\n"
+                    "          [-g phantom_us] [-P p99_limit_us] [-o transitions.csv] show.txt|.show capture\n", prog);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    int format = FMT_PULSEVIEW, unit = 1;
+    uint64_t rate = DEFAULT_RATE;
+    double window_ms = DEFAULT_WINDOW_MS, phantom_us = DEFAULT_PHANTOM_US, p99_limit_us = 0;
+    const char *csv_path = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "f:r:u:w:g:P:o:")) != -1) {
+        switch (opt) {
+        case 'f':
+            if (strcmp(optarg, "pulseview") == 0) format = FMT_PULSEVIEW;
+            else if (strcmp(optarg, "csv") == 0) format = FMT_CSV;
+            else if (strcmp(optarg, "binary") == 0) format = FMT_BINARY;
+            else usage(argv[0]);
+            break;
+        case 'r': rate = strtoull(optarg, NULL, 10); break;
+        case 'u': unit = atoi(optarg); break;
+        case 'w': window_ms = atof(optarg); break;
+        case 'g': phantom_us = atof(optarg); break;
+        case 'P': p99_limit_us = atof(optarg); break;
+        case 'o': csv_path = optarg; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (argc - optind != 2 || rate == 0 || unit < 1 || unit > 8)
+        usage(argv[0]);
+
+    show_t show;
+    if (show_load(&show, argv[optind]) < 0)
+        return 1;
+    if (show.channels > 64) {
+        fprintf(stderr, "Show has %u channels, at most 64 can be checked\n", show.channels);
+        return 1;
+    }
+
+    matcher_t m = {0};
+    m.exp = load_expected(&show, &m.count);
+    if (!m.exp || m.count == 0) {
+        fprintf(stderr, "Show has no visible frame changes\n");
+        return 1;
+    }
+    m.mask = show.channels == 64 ? ~0ull : (1ull << show.channels) - 1;
+    m.window_ns = (int64_t)(window_ms * 1e6);
+    m.phantom_ns = (int64_t)(phantom_us * 1e3);
+    lhist_init(&m.latency, "latency");
+    lhist_init(&m.residual, "residual");
+    lhist_init(&m.phantom_len, "phantom_duration");
+    if (csv_path) {
+        m.csv = fopen(csv_path, "w");
+        if (!m.csv) {
+            perror("Failed to create CSV");
+            return 1;
+        }
+        fprintf(m.csv, "kind,frame,expected_us,captured_us,latency_us,duration_us\n");
+    }
+
+    FILE *in = fopen(argv[optind + 1], format == FMT_BINARY ? "rb" : "r");
+    if (!in) {
+        perror("Failed to open capture");
+        return 1;
+    }
+    setvbuf(in, NULL, _IOFBF, READ_BUFFER);
+    uint64_t end_t = 0;
+    int ret = format == FMT_PULSEVIEW ? read_pulseview(in, &m, rate, &end_t)
+            : format == FMT_CSV ? read_csv(in, &m, rate, &end_t)
+            : read_binary(in, &m, rate, unit, &end_t);
+    fclose(in);
+    if (ret < 0) {
+        perror("Failed to read capture");
+        return 1;
+    }
+    finish(&m, end_t);
+    if (!m.anchored) {
+        fprintf(stderr, "The show's first state never appears in the capture\n");
+        return 1;
+    }
+
+    // Changes the capture could not have recorded in full are not missed
+    unsigned long uncaptured = 0;
+    for (; m.next < m.count; m.next++) {
+        if ((int64_t)m.exp[m.next].t_ns + m.offset_ns + m.window_ns > (int64_t)end_t) {
+            uncaptured++;
+        } else {
+            m.missed++;
+            csv_row(&m, "missed", m.exp[m.next].frame, m.exp[m.next].t_ns / 1e3, 0, 0, 0);
+        }
+    }
+    if (m.csv)
+        fclose(m.csv);
+
+    // Drift: straight line through the latencies, jitter is what remains
+    double slope = 0, icept = m.matched ? m.sy / m.matched : 0;
+    double den = m.matched * m.sxx - m.sx * m.sx;
+    if (m.matched > 1 && den > 0) {
+        slope = (m.matched * m.sxy - m.sx * m.sy) / den;
+        icept = (m.sy - slope * m.sx) / m.matched;
+    }
+    int64_t early_max = 0;
+    for (size_t i = 0; i < m.count; ++i) {
+        if (!m.exp[i].matched) continue;
+        double r = m.exp[i].latency_ns - (icept + slope * m.exp[i].t_ns / 1e9);
+        lhist_record(&m.residual, (int64_t)(r < 0 ? -r : r));
+        if (m.exp[i].latency_ns < early_max) early_max = m.exp[i].latency_ns;
+    }
+
+    double song_s = m.exp[m.count - 1].t_ns / 1e9;
+    printf("%s vs %s: %zu frame changes, %lu capture changes\n", argv[optind + 1], argv[optind],
+           m.count, m.changes);
+    printf("matched %lu, missed %lu, extra %lu, phantom %lu, after capture end %lu\n",
+           m.matched, m.missed, m.extra, m.phantom, uncaptured);
+    printf("drift %+.1f ppm, %+.1f us over %.1f s, max early %.1f us\n",
+           slope / 1e3, slope * song_s / 1e3, song_s, -early_max / 1e3);
+    lhist_print_header(stdout);
+    lhist_print(stdout, &m.latency);
+    lhist_print(stdout, &m.residual);
+    if (m.phantom)
+        lhist_print(stdout, &m.phantom_len);
+
+    int pass = m.missed == 0 && m.extra == 0 && m.phantom == 0;
+    if (p99_limit_us > 0 && lhist_percentile(&m.residual, 99) / 1e3 > p99_limit_us)
+        pass = 0;
+    printf("%s\n", pass ? "PASS" : "FAIL");
+
+    free(m.exp);
+    show_close(&show);
+    return pass ? 0 : 2;
+}
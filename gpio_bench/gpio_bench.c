@@ -0,0 +1,396 @@
+// Build: gcc -O2 -Wall -o gpio_bench gpio_bench.c ../common/gpio*.c ../common/latency_hist.c ../common/transition.c -lgpiod
+//
+// Side-by-side cost of the ways this repo has written LEDs. Every
+// strategy plays the same sequence of frames back to back:
+//
+//   plan      frames mapped to bank images up front, gpio_write_image
+//             (the show engine; bulk ioctl on gpiod, GPSET/GPCLR on mmap)
+//   map       frame mapped to bank images on every write, gpio_write_bits
+//   ordered   like plan, but the larger of the set/clear groups goes
+//             first (the old popcount-ordered GPSET0/GPCLR0 variant)
+//   planned   transition planner: fewest writes, phantoms closest to a frame
+//   per-line  one bank write per changed line
+//   request   gpiod only: request, set and release every changed line on
+//             each write, as the old set_led() did
+//
+// For each one it reports the per-write latency distribution, device
+// writes and system calls per frame (syscalls need perf events, i.e.
+// perf_event_paranoid <= 1 or root; null otherwise) and the sustained
+// frame rate. "sim" works on any host and also replays its register log
+// to count phantom states (neither the old nor the new frame) and how
+// long they were visible. Use -L with lines in both banks to see the
+// cross-bank case. Results are JSON, one result per line with a fixed
+// key order, so two runs can be diffed.
+//
+//   ./gpio_bench [-n frames] [-L gpio,gpio,...] [-o results.json] [spec ...]
+//   e.g.  ./gpio_bench sim mmap gpiod          ./gpio_bench -L 5,6,40,41 sim
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <linux/perf_event.h>
+
+#include "../common/gpio.h"
+#include "../common/latency_hist.h"
+#include "../common/timeutil.h"
+#include "../common/transition.h"
+
+#ifndef GPIO_NO_GPIOD
+#include <gpiod.h>
+#endif
+
+int led_lines[32] = {22, 5, 6, 26, 23, 24, 25, 16}; // BCM numbers
+int num_leds = 8;
+#define DEFAULT_FRAMES 20000
+#define WARMUP_FRAMES  1000
+#define CONSUMER "gpio_bench"
+
+enum { STRAT_PLAN, STRAT_MAP, STRAT_ORDERED, STRAT_PLANNED, STRAT_PER_LINE, STRAT_REQUEST, STRAT_COUNT };
+static const char *strategy_names[STRAT_COUNT] = {"plan", "map", "ordered", "planned", "per-line", "request"};
+
+typedef struct {
+    const char *backend;
+    const char *strategy;
+    uint64_t frames;
+    lhist_t write;
+    double device_writes_per_frame;
+    double syscalls_per_frame;      // < 0 when not measurable
+    double frames_per_s;
+    // sim only, < 0 otherwise
+    double phantoms_per_frame;
+    double phantom_wrong_leds;      // per frame, summed over its phantoms
+    double phantom_window_ns;       // mean per frame
+    int64_t phantom_window_max_ns;
+    int64_t sim_dropped;            // writes past the end of the sim log
+} result_t;
+
+// Count bank writes by interposing on the backend
+static int (*real_write_bank)(gpio_backend_t *, int, uint32_t, uint32_t, uint32_t);
+static uint64_t device_writes;
+
+static int counting_write_bank(gpio_backend_t *b, int bank, uint32_t set, uint32_t clr, uint32_t image) {
+    device_writes++;
+    return real_write_bank(b, bank, set, clr, image);
+}
+
+// Per-thread count of syscall entries, -1 if perf events are not allowed
+static int syscall_counter_open(void) {
+    const char *paths[] = {"/sys/kernel/tracing/events/raw_syscalls/sys_enter/id",
+                           "/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id"};
+    long id = -1;
+    for (size_t i = 0; i < 2 && id < 0; ++i) {
+        FILE *f = fopen(paths[i], "r");
+        if (!f) continue;
+        if (fscanf(f, "%ld", &id) != 1) id = -1;
+        fclose(f);
+    }
+    if (id < 0)
+        return -1;
+    struct perf_event_attr attr = {0};
+    attr.type = PERF_TYPE_TRACEPOINT;
+    attr.size = sizeof(attr);
+    attr.config = id;
+    attr.disabled = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void random_frames(uint32_t *frames, int n, int channels) {
+    uint32_t x = 0x2545f491, mask = channels >= 32 ? ~0u : (1u << channels) - 1;
+    for (int i = 0; i < n; ++i) {
+        do {
+            x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+        } while (i && (x & mask) == frames[i - 1]);  // Every frame is a change
+        frames[i] = x & mask;
+    }
+}
+
+// Larger group first, each group its own bank write
+static void write_ordered(gpio_backend_t *b, const uint32_t *image) {
+    for (int k = 0; k < b->num_banks; ++k) {
+        uint32_t cur = b->bank_shadow[k], want = image[k];
+        uint32_t set = want & ~cur, clr = cur & ~want;
+        if (!set && !clr)
+            continue;
+        if (__builtin_popcount(set) >= __builtin_popcount(clr)) {
+            b->write_bank(b, k, set, 0, cur | set);
+            b->write_bank(b, k, 0, clr, want);
+        } else {
+            b->write_bank(b, k, 0, clr, cur & ~clr);
+            b->write_bank(b, k, set, 0, want);
+        }
+        b->bank_shadow[k] = want;
+    }
+}
+
+static void write_per_line(gpio_backend_t *b, const uint32_t *image) {
+    for (int k = 0; k < b->num_banks; ++k) {
+        uint32_t cur = b->bank_shadow[k];
+        for (uint32_t diff = cur ^ image[k]; diff; diff &= diff - 1) {
+            uint32_t bit = diff & -diff;
+            cur ^= bit;
+            b->write_bank(b, k, image[k] & bit, ~image[k] & bit, cur);
+        }
+        b->bank_shadow[k] = cur;
+    }
+}
+
+#ifndef GPIO_NO_GPIOD
+// The original set_led(): nothing is kept between writes
+static int write_request(struct gpiod_chip *chip, const int *lines, int channels, uint32_t prev, uint32_t frame) {
+    for (int i = 0; i < channels; ++i) {
+        if (!(((prev ^ frame) >> i) & 1))
+            continue;
+        struct gpiod_line *line = gpiod_chip_get_line(chip, lines[i] & 0xffff);
+        if (!line || gpiod_line_request_output(line, CONSUMER, 0) < 0)
+            return -1;
+        gpiod_line_set_value(line, (frame >> i) & 1);
+        gpiod_line_release(line);
+        device_writes++;
+    }
+    return 0;
+}
+#endif
+
+static int run(result_t *r, const char *spec, int strategy, const uint32_t *frames, int n,
+               const int *lines, int channels, int sys_fd) {
+    gpio_backend_t *b = NULL;
+    uint32_t *plan = NULL;
+    gpio_plan_t images = {0};
+    transition_plan_t planned = {0};
+#ifndef GPIO_NO_GPIOD
+    struct gpiod_chip *chip = NULL;
+#endif
+
+    if (strategy == STRAT_REQUEST) {
+#ifdef GPIO_NO_GPIOD
+        return -1;
+#else
+        // Needs the lines free, so no backend is opened
+        if (strncmp(spec, "gpiod", 5) != 0)
+            return -1;
+        const char *name = spec[5] == ':' && spec[6] ? spec + 6 : "gpiochip0";
+        char first[64];
+        snprintf(first, sizeof(first), "%.*s", (int)strcspn(name, ","), name);
+        if (!(chip = gpiod_chip_open_lookup(first))) {
+            perror("gpiod: open chip");
+            return -1;
+        }
+#endif
+    } else {
+        if (!(b = gpio_open(spec, lines, channels)))
+            return -1;
+        plan = malloc((size_t)n * b->num_banks * sizeof(uint32_t));
+        if (!plan) {
+            gpio_close(b);
+            return -1;
+        }
+        for (int i = 0; i < n; ++i)
+            gpio_map(b, &frames[i], channels, plan + (size_t)i * b->num_banks);
+        images = (gpio_plan_t){.image = plan, .banks = b->num_banks, .frames = n};
+        if (strategy == STRAT_PLANNED && transition_plan_init(&planned, b, &images) < 0) {
+            gpio_close(b);
+            free(plan);
+            return -1;
+        }
+        real_write_bank = b->write_bank;
+        b->write_bank = counting_write_bank;
+    }
+
+    memset(r, 0, sizeof(*r));
+    r->backend = b ? b->name : "gpiod";
+    r->strategy = strategy_names[strategy];
+    lhist_init(&r->write, "write");
+
+    uint64_t start = 0;
+    size_t cursor = 0;
+    int sim = b && gpio_sim_events(b, &cursor) != NULL;
+    uint64_t phantoms = 0, wrong = 0, window_sum = 0;
+    uint32_t from[GPIO_MAX_BANKS];
+#ifndef GPIO_NO_GPIOD
+    uint32_t prev = 0;
+#endif
+    for (int i = -WARMUP_FRAMES; i < n; ++i) {
+        int f = i < 0 ? (i + WARMUP_FRAMES) % n : i;
+        if (i == 0) {
+            device_writes = 0;
+            if (sys_fd >= 0) {
+                ioctl(sys_fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(sys_fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+            start = now_ns();
+            if (sim)
+                gpio_sim_events(b, &cursor);
+        }
+        if (b)
+            memcpy(from, b->bank_shadow, sizeof(from));
+        uint64_t t0 = now_ns();
+        switch (strategy) {
+        case STRAT_PLAN:     gpio_write_image(b, plan + (size_t)f * b->num_banks); break;
+        case STRAT_MAP:      gpio_write_bits(b, &frames[f]); break;
+        case STRAT_ORDERED:  write_ordered(b, plan + (size_t)f * b->num_banks); break;
+        case STRAT_PLANNED:  transition_play(b, &planned, f); break;
+        case STRAT_PER_LINE: write_per_line(b, plan + (size_t)f * b->num_banks); break;
+#ifndef GPIO_NO_GPIOD
+        case STRAT_REQUEST:  write_request(chip, lines, channels, prev, frames[f]); break;
+#endif
+        }
+        if (i >= 0)
+            lhist_record(&r->write, now_ns() - t0);
+        gpio_sim_transition_t tr;
+        if (sim && i >= 0 &&
+            gpio_sim_transition(b, &cursor, from, plan + (size_t)f * b->num_banks, &tr) == 0) {
+            phantoms += tr.phantoms;
+            wrong += tr.wrong_bits;
+            window_sum += tr.window_ns;
+            if ((int64_t)tr.window_ns > r->phantom_window_max_ns)
+                r->phantom_window_max_ns = tr.window_ns;
+        }
+#ifndef GPIO_NO_GPIOD
+        prev = frames[f];
+#endif
+    }
+    uint64_t elapsed = now_ns() - start;
+    long long syscalls = -1;
+    if (sys_fd >= 0) {
+        ioctl(sys_fd, PERF_EVENT_IOC_DISABLE, 0);
+        // The clock reads around each write go through the vDSO, not syscalls
+        if (read(sys_fd, &syscalls, sizeof(syscalls)) != sizeof(syscalls))
+            syscalls = -1;
+    }
+
+    r->frames = n;
+    r->device_writes_per_frame = (double)device_writes / n;
+    r->syscalls_per_frame = syscalls >= 0 ? (double)syscalls / n : -1;
+    r->frames_per_s = n / (elapsed / 1e9);
+    r->phantoms_per_frame = sim ? (double)phantoms / n : -1;
+    r->phantom_wrong_leds = sim ? (double)wrong / n : -1;
+    r->phantom_window_ns = sim ? (double)window_sum / n : -1;
+    r->sim_dropped = sim ? (int64_t)gpio_sim_dropped(b) : -1;
+    if (!sim)
+        r->phantom_window_max_ns = -1;
+
+    if (b) {
+        gpio_write(b, 0);
+        gpio_close(b);
+    }
+#ifndef GPIO_NO_GPIOD
+    if (chip)
+        gpiod_chip_close(chip);
+#endif
+    transition_plan_free(&planned);
+    free(plan);
+    return 0;
+}
+
+// JSON number, or null for values that were not measured
+static const char *json_num(char *buf, size_t len, double v, int decimals) {
+    if (v < 0)
+        snprintf(buf, len, "null");
+    else
+        snprintf(buf, len, "%.*f", decimals, v);
+    return buf;
+}
+
+static void print_json(FILE *f, const result_t *res, int count, int n, int channels) {
+    struct utsname u;
+    uname(&u);
+    fprintf(f, "{\"host\": \"%s\", \"machine\": \"%s\", \"kernel\": \"%s\", \"frames\": %d, \"channels\": %d,\n"
+               " \"results\": [\n", u.nodename, u.machine, u.release, n, channels);
+    for (int i = 0; i < count; ++i) {
+        const result_t *r = &res[i];
+        char sys[32], ph[32], wr[32], win[32], win_max[32], drop[32];
+        fprintf(f, "  {\"backend\": \"%s\", \"strategy\": \"%s\", \"mean_ns\": %.0f, \"p50_ns\": %lld, "
+                   "\"p99_ns\": %lld, \"p999_ns\": %lld, \"max_ns\": %lld, \"device_writes_per_frame\": %.3f, "
+                   "\"syscalls_per_frame\": %s, \"frames_per_s\": %.0f, \"phantoms_per_frame\": %s, "
+                   "\"phantom_wrong_leds\": %s, \"phantom_window_ns\": %s, \"phantom_window_max_ns\": %s, \"sim_dropped\": %s}%s\n",
+                r->backend, r->strategy, r->write.count ? r->write.sum / r->write.count : 0.0,
+                (long long)lhist_percentile(&r->write, 50), (long long)lhist_percentile(&r->write, 99),
+                (long long)lhist_percentile(&r->write, 99.9), (long long)r->write.max,
+                r->device_writes_per_frame, json_num(sys, sizeof(sys), r->syscalls_per_frame, 3),
+                r->frames_per_s, json_num(ph, sizeof(ph), r->phantoms_per_frame, 3),
+                json_num(wr, sizeof(wr), r->phantom_wrong_leds, 3),
+                json_num(win, sizeof(win), r->phantom_window_ns, 0),
+                json_num(win_max, sizeof(win_max), r->phantom_window_max_ns, 0),
+                json_num(drop, sizeof(drop), r->sim_dropped, 0), i + 1 < count ? "," : "");
+    }
+    fprintf(f, " ]}\n");
+}
+
+int main(int argc, char **argv) {
+    int n = DEFAULT_FRAMES;
+    const char *out_path = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:o:L:")) != -1) {
+        switch (opt) {
+        case 'n': n = atoi(optarg); break;
+        case 'o': out_path = optarg; break;
+        case 'L':
+            num_leds = 0;
+            for (char *p = optarg; *p && num_leds < 32; ) {
+                char *end;
+                led_lines[num_leds++] = (int)strtol(p, &end, 0);
+                if (end == p) break;
+                p = *end == ',' ? end + 1 : end;
+            }
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-n frames] [-L gpio,gpio,...] [-o results.json] [spec ...]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (n <= 0) n = DEFAULT_FRAMES;
+    const char *default_spec = gpio_default_spec("sim");
+    const char **specs = optind < argc ? (const char **)&argv[optind] : &default_spec;
+    int num_specs = optind < argc ? argc - optind : 1;
+
+    int channels = num_leds;
+    uint32_t *frames = malloc(n * sizeof(uint32_t));
+    result_t *res = calloc((size_t)num_specs * STRAT_COUNT, sizeof(result_t));
+    if (!frames || !res)
+        return 1;
+    random_frames(frames, n, channels);
+
+    int sys_fd = syscall_counter_open();
+    if (sys_fd < 0)
+        fprintf(stderr, "gpio_bench: perf events not available, syscalls will be null\n");
+
+    int count = 0;
+    for (int s = 0; s < num_specs; ++s)
+        for (int k = 0; k < STRAT_COUNT; ++k) {
+            if (k == STRAT_REQUEST && strncmp(specs[s], "gpiod", 5) != 0)
+                continue;  // Only meaningful on the character device
+            if (run(&res[count], specs[s], k, frames, n, led_lines, channels, sys_fd) == 0) {
+                fprintf(stderr, "%-6s %-9s p50 %6.2f us  p99 %6.2f us  %8.0f frames/s", res[count].backend,
+                        res[count].strategy, lhist_percentile(&res[count].write, 50) / 1e3,
+                        lhist_percentile(&res[count].write, 99) / 1e3, res[count].frames_per_s);
+                if (res[count].phantoms_per_frame >= 0)
+                    fprintf(stderr, "  %.2f phantoms/frame, %.2f LEDs wrong, %.0f ns", res[count].phantoms_per_frame,
+                            res[count].phantom_wrong_leds, res[count].phantom_window_ns);
+                if (res[count].sim_dropped > 0)
+                    fprintf(stderr, "  %lld writes not logged", (long long)res[count].sim_dropped);
+                fprintf(stderr, "\n");
+                count++;
+            } else {
+                fprintf(stderr, "gpio_bench: %s %s failed\n", specs[s], strategy_names[k]);
+            }
+        }
+
+    FILE *out = out_path ? fopen(out_path, "w") : stdout;
+    if (!out) {
+        perror("Failed to create output");
+        return 1;
+    }
+    print_json(out, res, count, n, channels);
+    if (out != stdout)
+        fclose(out);
+    if (sys_fd >= 0)
+        close(sys_fd);
+    free(frames);
+    free(res);
+    return count ? 0 : 1;
+}
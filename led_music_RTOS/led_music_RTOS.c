@@ -1,81 +1,98 @@
+// Build: gcc -O2 -Wall -o led_music_RTOS led_music_RTOS.c ../common/gpio*.c ../common/effect.c ../common/show.c ../common/audio_engine.c ../common/pcm_out.c ../common/avsync.c ../common/wav_stream.c ../common/rt.c -lmpg123 -lasound -lgpiod -lpthread
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
 #include <unistd.h>
-#include <gpiod.h>
+#include <stdint.h>
+#include <string.h>
 
-const int LED_PINS[8] = {22, 5, 6, 26, 23, 24, 25, 16}; // BCM numbers
-#define CHIPNAME "gpiochip4"  // For GPIOs 0–31 on Raspberry Pi
-
-struct gpiod_line_bulk led_lines;
-struct gpiod_chip *chip;
+#include "../common/audio_engine.h"
+#include "../common/effect.h"
+#include "../common/gpio.h"
+#include "../common/rt.h"
+#include "../common/timeutil.h"
 
-void cleanup_gpio() {
-    gpiod_line_release_bulk(&led_lines);
-    gpiod_chip_close(chip);
-}
+const int LED_PINS[8] = {22, 5, 6, 26, 23, 24, 25, 16}; // BCM numbers
+#define GPIO_SPEC "auto"  // or "gpiod:gpiochip4" for GPIOs 0–31 on a Pi 5
+#define MUSIC_FILE "/home/pi/country-drive-265942.mp3"  // or a .wav
+#define EFFECT "chase(8, 70)"  // or e.g. "or(chase(8, 70), blink(0x81, 35, 525))"
+
+gpio_backend_t *gpio;
+audio_engine_t audio;
+pthread_barrier_t start_barrier;  // LED thread and audio writer start together
+uint64_t led_start_ns;
+rt_profile_t rt;  // isolated CPUs when the kernel has them
+effect_stream_t stream;
+atomic_int led_stop;  // set once the music has finished
 
 void* led_thread(void* arg) {
-    while (1) {
-        for (int i = 0; i < 8; i++) {
-            int values[8] = {0};
-            values[i] = 1;
-            gpiod_line_set_value_bulk(&led_lines, values);
-            usleep(70000); // 70 ms
-        }
-    }
-    return NULL;
-}
-
-void* music_thread(void* arg) {
-    system("mpg123 ~/country-drive-265942.mp3 > /dev/null 2>&1");
+    rt_thread_enter("led");
+    pthread_barrier_wait(&start_barrier);
+    led_start_ns = now_ns();
+    // Absolute deadlines from the common start, so the chaser keeps its
+    // phase against the music however long a write takes
+    effect_play(gpio, &stream, led_start_ns, &led_stop);
+    rt_thread_exit();
     return NULL;
 }
 
-int main() {
-    pthread_t t_led, t_music;
-    int ret;
+int main(int argc, char **argv) {
+    pthread_t t_led;
 
-    chip = gpiod_chip_open_by_name(CHIPNAME);
-    if (!chip) {
-        perror("Open chip failed");
+    // Parsed up front; the LED thread generates its frames as it plays
+    effect_t *fx = effect_parse(argc > 1 ? argv[1] : EFFECT);
+    if (!fx || effect_stream_init(&stream, fx, 0, 0) < 0)
         return 1;
-    }
 
-    struct gpiod_line *lines[8];
-    for (int i = 0; i < 8; i++) {
-        lines[i] = gpiod_chip_get_line(chip, LED_PINS[i]);
-        if (!lines[i]) {
-            perror("Get line failed");
-            cleanup_gpio();
-            return 1;
-        }
-    }
+    rt_profile_init(&rt, NULL);
+    rt_lock_memory();
 
-    gpiod_line_bulk_init(&led_lines);
-    for (int i = 0; i < 8; i++) {
-        gpiod_line_bulk_add(&led_lines, lines[i]);
+    gpio = gpio_open(gpio_default_spec(GPIO_SPEC), LED_PINS, 8);
+    if (!gpio) {
+        fprintf(stderr, "Open GPIO backend failed\n");
+        return 1;
     }
 
-    ret = gpiod_line_request_bulk_output(&led_lines, "led_music", NULL);
-    if (ret < 0) {
-        perror("Request lines as output failed");
-        cleanup_gpio();
+    // The chaser and the audio writer are released together
+    pthread_barrier_init(&start_barrier, NULL, 2);
+    audio.path = MUSIC_FILE;
+    audio.priority = AUDIO_ENGINE_PRIORITY;
+    audio.start = &start_barrier;
+    if (audio_engine_open(&audio) < 0 || audio_engine_start(&audio) < 0) {
+        fprintf(stderr, "Audio start failed\n");
+        audio_engine_close(&audio);
+        gpio_close(gpio);
+        return 1;
+    }
+    rt_pin_thread(audio.write_thread, rt.audio_cpu);
+    int err = rt_thread_create(&t_led, RT_PRIO_LED, rt.led_cpu, led_thread, NULL);
+    if (err) {
+        fprintf(stderr, "LED thread: %s\n", strerror(err));
+        // Stand in for the LED thread at the barrier so the writer sees the stop
+        atomic_store(&audio.stop, 1);
+        pthread_barrier_wait(&start_barrier);
+        audio_engine_close(&audio);
+        effect_stream_free(&stream);
+        effect_free(fx);
+        gpio_close(gpio);
         return 1;
     }
 
-    pthread_create(&t_led, NULL, led_thread, NULL);
-    pthread_create(&t_music, NULL, music_thread, NULL);
-
-    pthread_join(t_music, NULL);
+    audio_engine_wait(&audio);
 
-    pthread_cancel(t_led);
+    // The chaser runs forever: stop it after the music, at its next frame
+    atomic_store(&led_stop, 1);
     pthread_join(t_led, NULL);
+    rt_report(stderr);
 
-    int all_off[8] = {0};
-    gpiod_line_set_value_bulk(&led_lines, all_off);
+    fprintf(stderr, "Audio started %+.3f ms after the LEDs, %u underflows\n",
+            ((int64_t)audio.start_ns - (int64_t)led_start_ns) / 1e6, audio.underflows);
+    audio_engine_close(&audio);
+    effect_stream_free(&stream);
+    effect_free(fx);
 
-    cleanup_gpio();
+    gpio_write(gpio, 0);
+    gpio_close(gpio);
     return 0;
 }
 
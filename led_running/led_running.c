@@ -1,75 +1,38 @@
+// Build: gcc -O2 -Wall -o led_running led_running.c ../common/gpio*.c ../common/effect.c ../common/show.c -lgpiod
+//
+//   ./led_running ["effect"]    e.g. ./led_running "bounce(8, 70, 2)"
 #include <stdio.h> // For printf
 #include <stdlib.h> // for exit()
-#include <unistd.h> // for usleep() (delays)
-#include <gpiod.h> // for GPIO control
+#include <stdint.h>
+#include "../common/effect.h" // generated frames
+#include "../common/gpio.h" // for GPIO control
+#include "../common/timeutil.h"
 
-#define GPIO_CHIP "gpiochip0"
+#define GPIO_SPEC "auto"
+#define EFFECT "chase(8, 70, 1, 1)"  // one LED up the row, then an all-dark step
 
 const int LED_PINS[8] = {22, 5, 6, 26, 23, 24, 25, 16};
 
-void set_leds(struct gpiod_chip *chip, int state);
-void set_led(struct gpiod_chip *chip, int led, int state);
-
-int main()
+int main(int argc, char **argv)
 {
-	struct gpiod_chip *chip = gpiod_chip_open_by_name(GPIO_CHIP);
-	if (!chip)
-	{
-		perror("Failed to open GPIO chip");
+	effect_t *fx = effect_parse(argc > 1 ? argv[1] : EFFECT);
+	effect_stream_t stream;
+	if (!fx || effect_stream_init(&stream, fx, 0, 0) < 0)
 		return 1;
-	}
 
-	while(1)
+	gpio_backend_t *gpio = gpio_open(gpio_default_spec(GPIO_SPEC), LED_PINS, 8);
+	if (!gpio)
 	{
-		for(int i = 0; i < 8; i++)
-		{
-			usleep(70000);
-			if (i == 0)
-				set_led(chip, i, 1);
-			       // usleep(70000);
-			if (i == 7)
-			{
-				set_led(chip, i-1, 0);
-				set_led(chip, i, 1);
-				usleep(70000);
-				set_led(chip, i, 0);
-				i = -1;
-			       // usleep(70000);
-			}
-			else
-			{
-				set_led(chip, i-1, 0);
-				set_led(chip, i, 1);
-			       // usleep(70000);
-			}
-		}
+		fprintf(stderr, "Failed to open GPIO backend\n");
+		return 1;
 	}
 
-	gpiod_chip_close(chip);
-	return 0;
-}
-
-
-
-
+	// One bulk write per step: the previous LED goes off in the same
+	// write that turns the next one on
+	effect_play(gpio, &stream, now_ns(), NULL);
 
-
-
-void set_leds(struct gpiod_chip *chip, int state)
-{
-	for (int i = 0; i < 8; i++)
-	{
-		struct gpiod_line *line = gpiod_chip_get_line(chip, LED_PINS[i]);
-		gpiod_line_request_output(line, "led_control", 0);
-		gpiod_line_set_value(line, state);
-		gpiod_line_release(line);
-	}
-}
-
-void set_led(struct gpiod_chip *chip, int led, int state)
-{
-	struct gpiod_line *line = gpiod_chip_get_line(chip, LED_PINS[led]);
-	gpiod_line_request_output(line, "led_control", 0);
-	gpiod_line_set_value(line, state);
-	gpiod_line_release(line);
+	effect_stream_free(&stream);
+	effect_free(fx);
+	gpio_close(gpio);
+	return 0;
 }
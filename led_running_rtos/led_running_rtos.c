@@ -1,75 +1,57 @@
+// Build: gcc -O2 -Wall -o led_running_rtos led_running_rtos.c ../common/gpio*.c ../common/effect.c ../common/show.c -lgpiod -lpthread
+//
+//   ./led_running_rtos ["effect"]    e.g. ./led_running_rtos "rotate(0x11, 8, 70)"
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <pthread.h>
-#include <gpiod.h>
+#include <stdint.h>
 #include <time.h>
+#include "../common/effect.h"
+#include "../common/gpio.h"
+#include "../common/timeutil.h"
 
-#define GPIO_CHIP "gpiochip0"
+#define GPIO_SPEC "auto"
+#define EFFECT "chase(8, 70, 1, 1)"  // the last step of a run is all dark
 const int LED_PINS[8] = {22, 5, 6, 26, 23, 24, 25, 16};
 
 // Function declarations
 void* led_thread(void* arg);
-void set_leds(struct gpiod_chip *chip, int state);
-void set_led(struct gpiod_chip *chip, int led, int state);
 
-int main() {
+int main(int argc, char **argv) {
+	effect_t *fx = effect_parse(argc > 1 ? argv[1] : EFFECT);
+	if (!fx)
+		return 1;
+
 	pthread_t thread;
-	if (pthread_create(&thread, NULL, led_thread, NULL) != 0) {
+	if (pthread_create(&thread, NULL, led_thread, fx) != 0) {
 		perror("Failed to create LED thread");
 		return 1;
 	}
 
 	// Join thread (never ends in this example)
 	pthread_join(thread, NULL);
+	effect_free(fx);
 	return 0;
 }
 
 // This is your LED control logic, now in a thread
 void* led_thread(void* arg) {
-	struct gpiod_chip *chip = gpiod_chip_open_by_name(GPIO_CHIP);
-	if (!chip) {
-		perror("Failed to open GPIO chip");
+	effect_stream_t stream;
+	if (effect_stream_init(&stream, arg, 0, 0) < 0)
 		pthread_exit(NULL);
-	}
 
-	int i = 0;
-	while (1) {
-		usleep(70000);
-
-		if (i == 0) {
-			set_led(chip, i, 1);
-		}
-		if (i == 7) {
-			set_led(chip, i - 1, 0);
-			set_led(chip, i, 1);
-			usleep(70000);
-			set_led(chip, i, 0);
-			i = -1;
-		} else {
-			set_led(chip, i - 1, 0);
-			set_led(chip, i, 1);
-		}
-		i++;
+	gpio_backend_t *gpio = gpio_open(gpio_default_spec(GPIO_SPEC), LED_PINS, 8);
+	if (!gpio) {
+		fprintf(stderr, "Failed to open GPIO backend\n");
+		effect_stream_free(&stream);
+		pthread_exit(NULL);
 	}
 
-	gpiod_chip_close(chip);
-	pthread_exit(NULL);
-}
+	// Frames come a window at a time and go out at absolute deadlines
+	effect_play(gpio, &stream, now_ns(), NULL);
 
-void set_leds(struct gpiod_chip *chip, int state) {
-	for (int i = 0; i < 8; i++) {
-		struct gpiod_line *line = gpiod_chip_get_line(chip, LED_PINS[i]);
-		gpiod_line_request_output(line, "led_control", 0);
-		gpiod_line_set_value(line, state);
-		gpiod_line_release(line);
-	}
-}
-
-void set_led(struct gpiod_chip *chip, int led, int state) {
-	if (led < 0 || led > 7) return;
-	struct gpiod_line *line = gpiod_chip_get_line(chip, LED_PINS[led]);
-	gpiod_line_request_output(line, "led_control", 0);
-	gpiod_line_set_value(line, state);
-	gpiod_line_release(line);
+	effect_stream_free(&stream);
+	gpio_close(gpio);
+	pthread_exit(NULL);
 }
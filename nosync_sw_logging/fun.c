@@ -1,129 +1,168 @@
+// Build: gcc -O2 -Wall -o fun fun.c ../common/gpio*.c ../common/show.c ../common/telemetry.c ../common/audio_engine.c ../common/pcm_out.c ../common/avsync.c ../common/wav_stream.c ../common/rt.c -lmpg123 -lasound -lgpiod -lpthread
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
 #include <unistd.h>
-#include <gpiod.h>
+#include <stdint.h>
 #include <string.h>
+#include <time.h>
 
-const int LED_PINS[8] = {22, 5, 6, 26, 23, 24, 25, 16}; // BCM numbers
-#define CHIPNAME "gpiochip4"  // For GPIOs 0–31 on Raspberry Pi
+#include "../common/audio_engine.h"
+#include "../common/gpio.h"
+#include "../common/rt.h"
+#include "../common/show.h"
+#include "../common/telemetry.h"
+#include "../common/timeutil.h"
 
-struct gpiod_line_bulk led_lines;
-struct gpiod_chip *chip;
+const int LED_PINS[8] = {22, 5, 6, 26, 23, 24, 25, 16}; // BCM numbers
+#define GPIO_SPEC "auto"  // or "gpiod:gpiochip4" for GPIOs 0–31 on a Pi 5
+#define MUSIC_FILE "/home/pi/top_gun1.mp3"  // or a .wav
+#define SHOW_FILE "/home/pi/top_gun1.show"  // compiled with show_compile
+#define RUNTIME_LOG "/home/pi/top_gun1_runtime.log"
+
+gpio_backend_t *gpio;
+audio_engine_t audio;
+pthread_barrier_t start_barrier;  // LED thread and audio writer start together
+uint64_t led_start_ns;
+rt_profile_t rt;  // isolated CPUs when the kernel has them
+telem_writer_t telem;
+telem_channel_t led_telem;
+uint64_t start_us;  // argv[1]: start this far into the song
 
 static inline long ms_diff(struct timespec a, struct timespec b) {
     return (a.tv_sec - b.tv_sec) * 1000 + (a.tv_nsec - b.tv_nsec) / 1000000;
 }
 
 
-void cleanup_gpio() {
-    gpiod_line_release_bulk(&led_lines);
-    gpiod_chip_close(chip);
+// Runs on the telemetry thread, off the LED timing path
+static void log_row(FILE* f, const telem_rec_t* r, void* ctx) {
+    if (!f) return;
+    char bits[8];
+    for (int b = 0; b < 8; b++)
+        bits[b] = ((r->v[1] >> b) & 1) ? '1' : '0';
+    fprintf(f, "%04d %c%c%c%c.%c%c%c%c\n",
+        r->v[0],
+        bits[0], bits[1], bits[2], bits[3],
+        bits[4], bits[5], bits[6], bits[7]);
 }
 
 void* led_thread(void* arg) {
-    FILE* f = (FILE*)arg;
-    FILE* log = fopen("/home/pi/top_gun1_runtime.log", "w");
-    if (!log) {
-        perror("Cannot open runtime log file");
-        return NULL;
-    }
-
-    char line[32];
-    int delay;
-    char bitstr[16];
-    char bits[9];
-    int values[8];
+    const show_t* show = (const show_t*)arg;
+    rt_thread_enter("led");
 
-    while (fgets(line, sizeof(line), f)) {
-        if (sscanf(line, "%d %s", &delay, bitstr) != 2) continue;
+    // Released together with the audio writer once the decoder is ahead
+    pthread_barrier_wait(&start_barrier);
+    uint64_t start_ns = led_start_ns = now_ns();
 
-        // Parse bit string (remove dot)
-        int bi = 0;
-        for (int i = 0; bitstr[i] != '\0' && bi < 8; ++i) {
-            if (bitstr[i] == '.') continue;
-            bits[bi++] = bitstr[i];
-        }
+    // Mid-song start: the frame showing at start_us goes out with the first
+    // audio, its logged duration cut to what is left of it
+    for (uint32_t i = show_find(show, start_us); i < show->frame_count; ++i) {
+        const show_record_t* rec = show_record(show, i);
+        uint64_t t_us = rec->t_us > start_us ? rec->t_us : start_us;
+        uint64_t end_us = (i + 1 < show->frame_count) ? show_record(show, i + 1)->t_us : show->duration_us;
+        uint32_t frame = rec->bits[0];
 
-        for (int i = 0; i < 8; i++) {
-            values[i] = (bits[i] == '1') ? 1 : 0;
-        }
+        // Frames carry absolute start times, so late wakeups do not accumulate
+        sleep_until_ns(start_ns + (t_us - start_us) * 1000);
 
         // Set GPIOs immediately
-        gpiod_line_set_value_bulk(&led_lines, values);
+        gpio_write(gpio, frame);
 
-        // Log immediately
-        fprintf(log, "%04d %c%c%c%c.%c%c%c%c\n",
-            delay,
-            bits[0], bits[1], bits[2], bits[3],
-            bits[4], bits[5], bits[6], bits[7]);
-
-        // Hold the pattern for 'delay' ms
-        usleep(delay * 1000);
+        // Log immediately: a record into the ring, formatted later
+        telem_rec_t entry = {.t_ns = now_ns(), .seq = i,
+                             .v = {(int32_t)((end_us - t_us) / 1000), (int32_t)frame}};
+        telem_push(&led_telem.ring, &entry);
     }
 
-    fclose(log);
+    // Hold the last pattern for its duration
+    sleep_until_ns(start_ns + (show->duration_us - start_us) * 1000);
+    rt_thread_exit();
     return NULL;
 }
 
-void* music_thread(void* arg) {
-    system("mpg123 ~/top_gun1.mp3 > /dev/null 2>&1");
-    return NULL;
-}
+int main(int argc, char **argv) {
+    pthread_t t_led;
+    double start_sec = argc > 1 ? atof(argv[1]) : 0;
 
-int main() {
-    pthread_t t_led, t_music;
-    int ret;
+    rt_profile_init(&rt, NULL);
+    rt_lock_memory();
 
-    FILE* sequence_file = fopen("/home/pi/top_gun1.txt", "r");
-    if (!sequence_file) {
-        perror("Failed to open sequence.txt");
+    show_t show;
+    if (show_open(&show, SHOW_FILE) < 0) {
+        fprintf(stderr, "Failed to load show %s\n", SHOW_FILE);
         return 1;
     }
-
-    chip = gpiod_chip_open_by_name(CHIPNAME);
-    if (!chip) {
-        perror("Open chip failed");
-        fclose(sequence_file);
+    start_us = (uint64_t)(start_sec * 1e6);
+    if (start_sec < 0 || start_us >= show.duration_us) {
+        fprintf(stderr, "Usage: %s [start_s], within the %.1f s show\n", argv[0], show.duration_us / 1e6);
+        show_close(&show);
         return 1;
     }
-
-    struct gpiod_line *lines[8];
-    for (int i = 0; i < 8; i++) {
-        lines[i] = gpiod_chip_get_line(chip, LED_PINS[i]);
-        if (!lines[i]) {
-            perror("Get line failed");
-            cleanup_gpio();
-            fclose(sequence_file);
-            return 1;
-        }
+    if (show.channels > 8) {
+        fprintf(stderr, "Show has %u channels, only 8 LEDs are wired\n", show.channels);
+        show_close(&show);
+        return 1;
     }
 
-    gpiod_line_bulk_init(&led_lines);
-    for (int i = 0; i < 8; i++) {
-        gpiod_line_bulk_add(&led_lines, lines[i]);
+    gpio = gpio_open(gpio_default_spec(GPIO_SPEC), LED_PINS, 8);
+    if (!gpio) {
+        fprintf(stderr, "Open GPIO backend failed\n");
+        show_close(&show);
+        return 1;
     }
 
-    ret = gpiod_line_request_bulk_output(&led_lines, "led_music", NULL);
-    if (ret < 0) {
-        perror("Request lines as output failed");
-        cleanup_gpio();
-        fclose(sequence_file);
+    telem_writer_init(&telem, TELEM_PERIOD_MS);
+    if (telem_channel_init(&led_telem, 1024, RUNTIME_LOG, NULL, log_row, NULL, NULL) < 0) {
+        perror("Cannot open runtime log file");
+        gpio_close(gpio);
+        show_close(&show);
+        return 1;
+    }
+    telem_writer_add(&telem, &led_telem);
+    telem_writer_start(&telem);
+    rt_pin_thread(telem.thread, rt.log_cpu);
+
+    pthread_barrier_init(&start_barrier, NULL, 2);
+    audio.path = MUSIC_FILE;
+    audio.priority = AUDIO_ENGINE_PRIORITY;
+    audio.start = &start_barrier;
+    audio.start_us = start_us;
+    if (audio_engine_open(&audio) < 0 || audio_engine_start(&audio) < 0) {
+        fprintf(stderr, "Audio start failed\n");
+        audio_engine_close(&audio);
+        telem_writer_stop(&telem);
+        gpio_close(gpio);
+        show_close(&show);
+        return 1;
+    }
+    rt_pin_thread(audio.write_thread, rt.audio_cpu);
+    int err = rt_thread_create(&t_led, RT_PRIO_LED, rt.led_cpu, led_thread, &show);
+    if (err) {
+        fprintf(stderr, "LED thread: %s\n", strerror(err));
+        // Stand in for the LED thread at the barrier so the writer sees the stop
+        atomic_store(&audio.stop, 1);
+        pthread_barrier_wait(&start_barrier);
+        audio_engine_close(&audio);
+        telem_writer_stop(&telem);
+        gpio_close(gpio);
+        show_close(&show);
         return 1;
     }
 
-    pthread_create(&t_led, NULL, led_thread, sequence_file);
-    pthread_create(&t_music, NULL, music_thread, NULL);
-
-    pthread_join(t_music, NULL);  // Wait for music to finish
+    audio_engine_wait(&audio);    // Wait for music to finish
 
     pthread_join(t_led, NULL);    // Wait for LED playback to finish
 
-    int all_off[8] = {0};
-    gpiod_line_set_value_bulk(&led_lines, all_off);
+    fprintf(stderr, "Audio started %+.3f ms after the LEDs, %u underflows\n",
+            ((int64_t)audio.start_ns - (int64_t)led_start_ns) / 1e6, audio.underflows);
+    rt_report(stderr);
+    audio_engine_close(&audio);
+
+    telem_writer_stop(&telem);
 
-    cleanup_gpio();
-    fclose(sequence_file);
+    gpio_write(gpio, 0);
+    gpio_close(gpio);
+    show_close(&show);
 
     return 0;
 }
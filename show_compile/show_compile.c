@@ -0,0 +1,51 @@
+// Build: gcc -O2 -Wall -o show_compile show_compile.c ../common/show.c ../common/effect.c
+//
+// Compile a text pattern file (e.g. top_gun1.txt) into the binary show
+// format played by the sequencers:  ./show_compile top_gun1.txt top_gun1.show
+// or render a procedural effect (see common/effect.h) for a number of
+// seconds:  ./show_compile -e "xor(chase(8, 70), blink(0xff, 560))" 60 chase.show
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../common/effect.h"
+#include "../common/show.h"
+
+int main(int argc, char **argv) {
+    int effect = argc == 5 && strcmp(argv[1], "-e") == 0;
+    if (argc != 3 && !effect) {
+        fprintf(stderr, "Usage: %s <patterns.txt> <out.show>\n"
+                        "       %s -e <effect> <seconds> <out.show>\n", argv[0], argv[0]);
+        return 1;
+    }
+    const char *out_path = argv[argc - 1];
+
+    long frames;
+    if (effect) {
+        effect_t *fx = effect_parse(argv[2]);
+        if (!fx)
+            return 1;
+        frames = effect_compile(fx, (uint64_t)(atof(argv[3]) * 1e6), out_path);
+        effect_free(fx);
+    } else {
+        FILE *in = fopen(argv[1], "r");
+        if (!in) {
+            perror("Failed to open pattern file");
+            return 1;
+        }
+        frames = show_compile_text(in, out_path);
+        fclose(in);
+    }
+    if (frames < 0)
+        return 1;
+
+    // Read the result back through the player path as a sanity check
+    show_t show;
+    if (show_open(&show, out_path) < 0)
+        return 1;
+    printf("%s: %u frames, %u channels%s, %.3f s, crc32 %08x\n", out_path, show.frame_count,
+           show.channels, (show.flags & SHOW_FLAG_LEVELS) ? " with levels" : "",
+           show.duration_us / 1e6, show.hdr->checksum);
+    show_close(&show);
+    return 0;
+}
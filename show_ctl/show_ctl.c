@@ -0,0 +1,89 @@
+// Build: gcc -O2 -Wall -o show_ctl show_ctl.c ../common/latency_hist.c
+//
+// Send commands to a running led_music_test -U socket and print the
+// replies. With a count the commands are repeated back to back as fast
+// as the show answers, to load the control path while the show's own
+// report gives the LED jitter under that load; the round trip times are
+// reported here.
+//
+//   ./show_ctl [-s socket] [-n count] command [command...]
+//   e.g.  ./show_ctl pos
+//         ./show_ctl -n 10000 pos "load top_gun1.txt" "offset 0"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "../common/control.h"
+#include "../common/latency_hist.h"
+#include "../common/timeutil.h"
+
+// One reply line into buf, NUL terminated without the newline
+static int read_reply(int fd, char *buf, size_t len) {
+    size_t used = 0;
+    while (used < len - 1) {
+        ssize_t n = recv(fd, buf + used, 1, 0);
+        if (n <= 0)
+            return -1;
+        if (buf[used] == '\n')
+            break;
+        used++;
+    }
+    buf[used] = '\0';
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    const char *sock_path = CONTROL_DEFAULT_SOCKET;
+    long count = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:n:")) != -1) {
+        switch (opt) {
+        case 's': sock_path = optarg; break;
+        case 'n': count = atol(optarg); break;
+        default: count = 0;
+        }
+    }
+    if (optind >= argc || count <= 0) {
+        fprintf(stderr, "Usage: %s [-s socket] [-n count] command [command...]\n", argv[0]);
+        return 1;
+    }
+
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", sock_path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror(sock_path);
+        return 1;
+    }
+
+    lhist_t rtt;
+    lhist_init(&rtt, "control_rtt");
+    char line[CONTROL_LINE_MAX], reply[CONTROL_LINE_MAX];
+    unsigned long errors = 0;
+    for (long n = 0; n < count; ++n) {
+        for (int i = optind; i < argc; ++i) {
+            int len = snprintf(line, sizeof(line), "%s\n", argv[i]);
+            uint64_t t0 = now_ns();
+            if (send(fd, line, len, MSG_NOSIGNAL) != len || read_reply(fd, reply, sizeof(reply)) < 0) {
+                fprintf(stderr, "%s: connection closed\n", sock_path);
+                return 1;
+            }
+            lhist_record(&rtt, (int64_t)(now_ns() - t0));
+            errors += strncmp(reply, "error", 5) == 0;
+            if (count == 1)
+                printf("%s\n", reply);
+        }
+    }
+    close(fd);
+
+    if (count > 1) {
+        printf("%lu commands, %lu errors\n", (unsigned long)rtt.count, errors);
+        lhist_print_header(stdout);
+        lhist_print(stdout, &rtt);
+    }
+    return errors ? 2 : 0;
+}
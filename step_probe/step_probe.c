@@ -0,0 +1,85 @@
+// Build: gcc -O2 -Wall -o step_probe step_probe.c ../common/gpio*.c ../common/latency_hist.c -lgpiod
+//
+// Measure the shortest frame a GPIO backend can reproduce. Channel 0 is
+// toggled on absolute deadlines at shrinking step sizes; for each step the
+// lateness of every edge (deadline to write complete) is recorded. A step
+// is achievable when the p99 lateness stays below half of it.
+//
+//   ./step_probe [backend-spec] [edges-per-step]     e.g.  ./step_probe sim 2000
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "../common/gpio.h"
+#include "../common/latency_hist.h"
+#include "../common/timeutil.h"
+
+const int LED_PINS[8] = {22, 5, 6, 26, 23, 24, 25, 16}; // BCM numbers
+#define GPIO_SPEC "auto"
+#define DEFAULT_EDGES 2000
+
+static const uint32_t steps_us[] = {10000, 5000, 2000, 1000, 500, 200, 100, 50, 20, 10, 5, 2, 1};
+
+int main(int argc, char **argv) {
+    const char *spec = argc > 1 ? argv[1] : gpio_default_spec(GPIO_SPEC);
+    int edges = argc > 2 ? atoi(argv[2]) : DEFAULT_EDGES;
+    if (edges <= 0) {
+        fprintf(stderr, "Usage: %s [backend-spec] [edges-per-step]\n", argv[0]);
+        return 1;
+    }
+
+    gpio_backend_t *gpio = gpio_open(spec, LED_PINS, 8);
+    if (!gpio) {
+        fprintf(stderr, "Open GPIO backend %s failed\n", spec);
+        return 1;
+    }
+
+    // Raw cost of one write, back to back with no sleeping
+    lhist_t write_cost;
+    lhist_init(&write_cost, "write");
+    for (int i = 0; i < edges; i++) {
+        uint64_t t0 = now_ns();
+        gpio_write(gpio, i & 1);
+        lhist_record(&write_cost, now_ns() - t0);
+    }
+
+    printf("backend %s, %d edges per step\n", gpio->name, edges);
+    printf("write cost: p50 %.2f us, p99 %.2f us, max %.2f us\n",
+           lhist_percentile(&write_cost, 50) / 1000.0,
+           lhist_percentile(&write_cost, 99) / 1000.0, write_cost.max / 1000.0);
+    printf("%8s %10s %10s %10s  %s\n", "step_us", "p50_us", "p99_us", "max_us", "ok");
+
+    uint32_t min_step_us = 0;
+    for (size_t s = 0; s < sizeof(steps_us) / sizeof(steps_us[0]); s++) {
+        uint64_t step_ns = steps_us[s] * 1000ull;
+        lhist_t late;
+        lhist_init(&late, "late");
+
+        uint64_t deadline = now_ns() + 1000000;  // Settle for 1 ms
+        for (int i = 0; i < edges; i++) {
+            sleep_until_ns(deadline);
+            gpio_write(gpio, i & 1);
+            lhist_record(&late, (int64_t)(now_ns() - deadline));
+            deadline += step_ns;
+        }
+
+        int64_t p99 = lhist_percentile(&late, 99);
+        int ok = p99 < (int64_t)step_ns / 2;
+        printf("%8u %10.2f %10.2f %10.2f  %s\n", steps_us[s],
+               lhist_percentile(&late, 50) / 1000.0, p99 / 1000.0, late.max / 1000.0,
+               ok ? "yes" : "no");
+        if (!ok)
+            break;  // Smaller steps only get worse
+        min_step_us = steps_us[s];
+    }
+
+    if (min_step_us)
+        printf("minimum achievable step: %u us\n", min_step_us);
+    else
+        printf("minimum achievable step: above %u us\n", steps_us[0]);
+
+    gpio_write(gpio, 0);
+    gpio_close(gpio);
+    return 0;
+}